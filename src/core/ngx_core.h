@@ -100,7 +100,10 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #define ngx_max(val1, val2)  ((val1 < val2) ? (val2) : (val1))
 #define ngx_min(val1, val2)  ((val1 > val2) ? (val2) : (val1))
 
+#define NGX_CPU_SSE42  0x0001
+
 void ngx_cpuinfo(void);
+extern ngx_uint_t  ngx_cpu_features;
 
 #if (NGX_HAVE_OPENAT)
 #define NGX_DISABLE_SYMLINKS_OFF        0
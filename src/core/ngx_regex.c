@@ -20,6 +20,10 @@ static void ngx_libc_cdecl ngx_regex_free(void *p);
 static void ngx_pcre_free_studies(void *data);
 #endif
 
+#ifdef PCRE_EXTRA_MARK
+static ngx_uint_t ngx_regex_set_combinable(u_char *p);
+#endif
+
 static ngx_int_t ngx_regex_module_init(ngx_cycle_t *cycle);
 
 static void *ngx_regex_create_conf(ngx_cycle_t *cycle);
@@ -227,6 +231,269 @@ ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 }
 
 
+/*
+ * a regex set is matched against a subject in a few passes instead of
+ * a pass per regex: up to NGX_REGEX_SET_PART regexes are combined into
+ * a single one, where an alternative per regex sets a mark with the regex
+ * index and tests the regex in a lookahead assertion at any position:
+ *
+ *     \A(?:(*MARK:0)(?=[\s\S]*?(?:re0))|(*MARK:1)(?=[\s\S]*?(?i:re1))|...)
+ *
+ * so the mark of the matched alternative is the first matching regex;
+ * the regexes which refer to groups, use verbs, or are compiled with
+ * options other than caseless, cannot be combined
+ */
+
+ngx_regex_set_t *
+ngx_regex_compile_set(ngx_regex_compile_t *rc, ngx_regex_elt_t *elts,
+    ngx_uint_t n)
+{
+#ifdef PCRE_EXTRA_MARK
+    u_char           *p;
+    size_t            len;
+    ngx_str_t         err;
+    ngx_uint_t        i, k, last;
+    unsigned long     options;
+    ngx_regex_set_t  *set;
+
+    for (i = 0; i < n; i++) {
+
+        if (pcre_fullinfo(elts[i].regex->code, NULL, PCRE_INFO_OPTIONS,
+                          &options)
+            != 0
+            || (options & ~(unsigned long) (PCRE_CASELESS|PCRE_ANCHORED))
+            || !ngx_regex_set_combinable(elts[i].name))
+        {
+            rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                                       "regex \"%s\" cannot be combined",
+                                       elts[i].name)
+                          - rc->err.data;
+            return NULL;
+        }
+    }
+
+    set = ngx_palloc(rc->pool, sizeof(ngx_regex_set_t));
+    if (set == NULL) {
+        goto nomem;
+    }
+
+    set->nelts = n;
+    set->nparts = (n + NGX_REGEX_SET_PART - 1) / NGX_REGEX_SET_PART;
+
+    set->parts = ngx_palloc(rc->pool, set->nparts * sizeof(ngx_regex_t *));
+    if (set->parts == NULL) {
+        goto nomem;
+    }
+
+    err = rc->err;
+
+    for (k = 0; k < set->nparts; k++) {
+
+        last = ngx_min(n, (k + 1) * NGX_REGEX_SET_PART);
+
+        len = sizeof("\\A(?:)") - 1;
+
+        for (i = k * NGX_REGEX_SET_PART; i < last; i++) {
+            len += sizeof("|(*MARK:)(?=[\\s\\S]*?(?i:))") - 1
+                   + NGX_INT_T_LEN + ngx_strlen(elts[i].name);
+        }
+
+        p = ngx_pnalloc(rc->pool, len + 1);
+        if (p == NULL) {
+            goto nomem;
+        }
+
+        rc->pattern.data = p;
+
+        p = ngx_cpymem(p, "\\A(?:", sizeof("\\A(?:") - 1);
+
+        for (i = k * NGX_REGEX_SET_PART; i < last; i++) {
+
+            (void) pcre_fullinfo(elts[i].regex->code, NULL, PCRE_INFO_OPTIONS,
+                                 &options);
+
+            p = ngx_sprintf(p, "%s(*MARK:%ui)(?=[\\s\\S]*?(?%s:%s))",
+                            (i == k * NGX_REGEX_SET_PART) ? "" : "|",
+                            i - k * NGX_REGEX_SET_PART,
+                            (options & PCRE_CASELESS) ? "i" : "",
+                            elts[i].name);
+        }
+
+        *p++ = ')';
+        *p = '\0';
+
+        rc->pattern.len = p - rc->pattern.data;
+        rc->err = err;
+
+        /* the combined regexes may use the same names for their groups */
+
+        rc->options = PCRE_DUPNAMES;
+
+        if (ngx_regex_compile(rc) != NGX_OK) {
+            return NULL;
+        }
+
+        set->parts[k] = rc->regex;
+    }
+
+    return set;
+
+nomem:
+
+    rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                               "regex set compilation failed: no memory")
+                  - rc->err.data;
+    return NULL;
+
+#else
+
+    rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                               "PCRE library does not support marks")
+                  - rc->err.data;
+    return NULL;
+
+#endif
+}
+
+
+ngx_int_t
+ngx_regex_exec_set(ngx_regex_set_t *set, ngx_str_t *s)
+{
+#ifdef PCRE_EXTRA_MARK
+    int           rc;
+    u_char       *mark;
+    ngx_int_t     n;
+    ngx_uint_t    k;
+    pcre_extra    extra;
+    ngx_regex_t  *re;
+
+    for (k = 0; k < set->nparts; k++) {
+
+        re = set->parts[k];
+
+        if (re->extra) {
+            extra = *re->extra;
+
+        } else {
+            ngx_memzero(&extra, sizeof(pcre_extra));
+        }
+
+        mark = NULL;
+
+        extra.flags |= PCRE_EXTRA_MARK;
+        extra.mark = &mark;
+
+        rc = pcre_exec(re->code, &extra, (const char *) s->data, s->len,
+                       0, 0, NULL, 0);
+
+        if (rc == PCRE_ERROR_NOMATCH) {
+            continue;
+        }
+
+        if (rc < 0) {
+            return rc;
+        }
+
+        if (mark == NULL) {
+            return PCRE_ERROR_INTERNAL;
+        }
+
+        n = ngx_atoi(mark, ngx_strlen(mark));
+
+        if (n == NGX_ERROR) {
+            return PCRE_ERROR_INTERNAL;
+        }
+
+        return k * NGX_REGEX_SET_PART + n;
+    }
+
+    return NGX_REGEX_NO_MATCHED;
+
+#else
+
+    return PCRE_ERROR_INTERNAL;
+
+#endif
+}
+
+
+#ifdef PCRE_EXTRA_MARK
+
+static ngx_uint_t
+ngx_regex_set_combinable(u_char *p)
+{
+    for ( /* void */ ; *p; p++) {
+
+        if (*p == '\\') {
+
+            p++;
+
+            /* backreferences and literal quoting */
+
+            if ((*p >= '1' && *p <= '9')
+                || *p == 'g' || *p == 'k' || *p == 'Q')
+            {
+                return 0;
+            }
+
+            if (*p == '\0') {
+                return 0;
+            }
+
+            continue;
+        }
+
+        if (*p != '(') {
+            continue;
+        }
+
+        /* verbs */
+
+        if (p[1] == '*') {
+            return 0;
+        }
+
+        if (p[1] != '?') {
+            continue;
+        }
+
+        /* recursion, subroutine calls, and conditions */
+
+        switch (p[2]) {
+
+        case 'P':
+            if (p[3] == '=' || p[3] == '>') {
+                return 0;
+            }
+
+            break;
+
+        case 'R':
+        case '&':
+        case '(':
+        case '+':
+            return 0;
+
+        case '-':
+            if (p[3] >= '0' && p[3] <= '9') {
+                return 0;
+            }
+
+            break;
+
+        default:
+            if (p[2] >= '0' && p[2] <= '9') {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+#endif
+
+
 static void * ngx_libc_cdecl
 ngx_regex_malloc(size_t size)
 {
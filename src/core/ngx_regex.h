@@ -46,6 +46,15 @@ typedef struct {
 } ngx_regex_elt_t;
 
 
+#define NGX_REGEX_SET_PART    64
+
+typedef struct {
+    ngx_uint_t     nelts;
+    ngx_uint_t     nparts;
+    ngx_regex_t  **parts;
+} ngx_regex_set_t;
+
+
 void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
@@ -56,5 +65,13 @@ ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
+ngx_regex_set_t *ngx_regex_compile_set(ngx_regex_compile_t *rc,
+    ngx_regex_elt_t *elts, ngx_uint_t n);
+ngx_int_t ngx_regex_exec_set(ngx_regex_set_t *set, ngx_str_t *s);
+#define ngx_regex_exec_set_n  "pcre_exec()"
+
+#define ngx_regex_set_limit(rc)                                              \
+    ((rc) == PCRE_ERROR_MATCHLIMIT || (rc) == PCRE_ERROR_RECURSIONLIMIT)
+
 
 #endif /* _NGX_REGEX_H_INCLUDED_ */
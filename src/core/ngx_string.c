@@ -8,6 +8,10 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+#if (NGX_HAVE_SSE42)
+#include <nmmintrin.h>
+#endif
+
 
 static u_char *ngx_sprintf_num(u_char *buf, u_char *last, uint64_t ui64,
     u_char zero, ngx_uint_t hexadecimal, ngx_uint_t width);
@@ -15,6 +19,23 @@ static void ngx_encode_base64_internal(ngx_str_t *dst, ngx_str_t *src,
     const u_char *basis, ngx_uint_t padding);
 static ngx_int_t ngx_decode_base64_internal(ngx_str_t *dst, ngx_str_t *src,
     const u_char *basis);
+static uintptr_t ngx_escape_uri_generic(u_char *dst, u_char *src, size_t size,
+    uint32_t *escape);
+static uintptr_t ngx_escape_html_generic(u_char *dst, u_char *src,
+    size_t size);
+static uintptr_t ngx_escape_json_generic(u_char *dst, u_char *src,
+    size_t size);
+
+#if (NGX_HAVE_SSE42)
+static uintptr_t ngx_escape_uri_sse42(u_char *dst, u_char *src, size_t size,
+    uint32_t *escape, ngx_uint_t type);
+static uintptr_t ngx_escape_html_sse42(u_char *dst, u_char *src,
+    size_t size);
+static uintptr_t ngx_escape_json_sse42(u_char *dst, u_char *src,
+    size_t size);
+static size_t ngx_unescape_uri_sse42(u_char *dst, u_char *src, size_t size,
+    ngx_uint_t type);
+#endif
 
 
 void
@@ -1424,9 +1445,7 @@ ngx_utf8_cpystrn(u_char *dst, u_char *src, size_t n, size_t len)
 uintptr_t
 ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
 {
-    ngx_uint_t      n;
-    uint32_t       *escape;
-    static u_char   hex[] = "0123456789ABCDEF";
+    uint32_t  *escape;
 
                     /* " ", "#", "%", "?", %00-%1F, %7F-%FF */
 
@@ -1556,6 +1575,25 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
 
     escape = map[type];
 
+#if (NGX_HAVE_SSE42)
+
+    if (size >= 16 && (ngx_cpu_features & NGX_CPU_SSE42)) {
+        return ngx_escape_uri_sse42(dst, src, size, escape, type);
+    }
+
+#endif
+
+    return ngx_escape_uri_generic(dst, src, size, escape);
+}
+
+
+static uintptr_t
+ngx_escape_uri_generic(u_char *dst, u_char *src, size_t size,
+    uint32_t *escape)
+{
+    ngx_uint_t      n;
+    static u_char   hex[] = "0123456789ABCDEF";
+
     if (dst == NULL) {
 
         /* find the number of the characters to be escaped */
@@ -1594,6 +1632,9 @@ void
 ngx_unescape_uri(u_char **dst, u_char **src, size_t size, ngx_uint_t type)
 {
     u_char  *d, *s, ch, c, decoded;
+#if (NGX_HAVE_SSE42)
+    size_t   n;
+#endif
     enum {
         sw_usual = 0,
         sw_quoted,
@@ -1608,6 +1649,20 @@ ngx_unescape_uri(u_char **dst, u_char **src, size_t size, ngx_uint_t type)
 
     while (size--) {
 
+#if (NGX_HAVE_SSE42)
+
+        if (state == sw_usual && size >= 16
+            && (ngx_cpu_features & NGX_CPU_SSE42))
+        {
+            n = ngx_unescape_uri_sse42(d, s, size + 1, type);
+
+            d += n;
+            s += n;
+            size -= n;
+        }
+
+#endif
+
         ch = *s++;
 
         switch (state) {
@@ -1722,6 +1777,21 @@ done:
 
 uintptr_t
 ngx_escape_html(u_char *dst, u_char *src, size_t size)
+{
+#if (NGX_HAVE_SSE42)
+
+    if (size >= 16 && (ngx_cpu_features & NGX_CPU_SSE42)) {
+        return ngx_escape_html_sse42(dst, src, size);
+    }
+
+#endif
+
+    return ngx_escape_html_generic(dst, src, size);
+}
+
+
+static uintptr_t
+ngx_escape_html_generic(u_char *dst, u_char *src, size_t size)
 {
     u_char      ch;
     ngx_uint_t  len;
@@ -1794,6 +1864,21 @@ ngx_escape_html(u_char *dst, u_char *src, size_t size)
 
 uintptr_t
 ngx_escape_json(u_char *dst, u_char *src, size_t size)
+{
+#if (NGX_HAVE_SSE42)
+
+    if (size >= 16 && (ngx_cpu_features & NGX_CPU_SSE42)) {
+        return ngx_escape_json_sse42(dst, src, size);
+    }
+
+#endif
+
+    return ngx_escape_json_generic(dst, src, size);
+}
+
+
+static uintptr_t
+ngx_escape_json_generic(u_char *dst, u_char *src, size_t size)
 {
     u_char      ch;
     ngx_uint_t  len;
@@ -1881,6 +1966,267 @@ ngx_escape_json(u_char *dst, u_char *src, size_t size)
 }
 
 
+#if (NGX_HAVE_SSE42)
+
+/*
+ * the vectorized escaping tests 16 bytes at once: the blocks without
+ * the bytes to be escaped are copied as is, the other blocks and the tail
+ * of the data are left to the generic code
+ */
+
+__attribute__((target("sse4.2")))
+static uintptr_t
+ngx_escape_uri_sse42(u_char *dst, u_char *src, size_t size, uint32_t *escape,
+    ngx_uint_t type)
+{
+    u_char      *last, *t;
+    uint32_t     mask;
+    ngx_uint_t   c, n;
+    __m128i      lo, hi, bits, b, i, r;
+
+    static u_char  bit[] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+                             0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
+
+    /*
+     * the escape bitmap as two tables indexed by the low nibble of a byte,
+     * with the bits of its high nibble, for bytes below and above 0x80
+     */
+
+    static u_char  tables[NGX_ESCAPE_MAIL_AUTH + 1][32];
+    static u_char  ready[NGX_ESCAPE_MAIL_AUTH + 1];
+
+    t = tables[type];
+
+    if (!ready[type]) {
+        for (c = 0; c < 256; c++) {
+            if (escape[c >> 5] & (1U << (c & 0x1f))) {
+                t[(c >> 7) * 16 + (c & 0xf)] |= (u_char) (1 << ((c >> 4) & 7));
+            }
+        }
+
+        ready[type] = 1;
+    }
+
+    lo = _mm_loadu_si128((const __m128i *) t);
+    hi = _mm_loadu_si128((const __m128i *) (t + 16));
+    bits = _mm_loadu_si128((const __m128i *) bit);
+
+    last = src + size;
+    n = 0;
+
+    while (last - src >= 16) {
+        b = _mm_loadu_si128((const __m128i *) src);
+
+        /* the index has the high bit set for the table not to be used */
+
+        i = _mm_and_si128(b, _mm_set1_epi8((char) 0x8f));
+
+        r = _mm_or_si128(_mm_shuffle_epi8(lo, i),
+                         _mm_shuffle_epi8(hi, _mm_xor_si128(i,
+                                                 _mm_set1_epi8((char) 0x80))));
+
+        r = _mm_and_si128(r, _mm_shuffle_epi8(bits,
+                               _mm_and_si128(_mm_srli_epi16(b, 4),
+                                             _mm_set1_epi8(0x0f))));
+
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(r, _mm_setzero_si128()))
+               ^ 0xffff;
+
+        if (dst == NULL) {
+            n += __builtin_popcount(mask);
+            src += 16;
+            continue;
+        }
+
+        /* the output has room for at least as many bytes as the input */
+
+        _mm_storeu_si128((__m128i *) dst, b);
+
+        if (mask == 0) {
+            dst += 16;
+            src += 16;
+            continue;
+        }
+
+        c = __builtin_ctz(mask);
+
+        dst = (u_char *) ngx_escape_uri_generic(dst + c, src + c, 16 - c,
+                                                escape);
+        src += 16;
+    }
+
+    if (dst == NULL) {
+        return n + ngx_escape_uri_generic(NULL, src, last - src, escape);
+    }
+
+    return ngx_escape_uri_generic(dst, src, last - src, escape);
+}
+
+
+__attribute__((target("sse4.2")))
+static uintptr_t
+ngx_escape_html_sse42(u_char *dst, u_char *src, size_t size)
+{
+    u_char      *last;
+    uint32_t     mask;
+    ngx_uint_t   c, n;
+    __m128i      b, m;
+
+    last = src + size;
+    n = 0;
+
+    while (last - src >= 16) {
+        b = _mm_loadu_si128((const __m128i *) src);
+
+        m = _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8('<')),
+                         _mm_cmpeq_epi8(b, _mm_set1_epi8('>')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8('&')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8('"')));
+
+        mask = _mm_movemask_epi8(m);
+
+        if (dst == NULL) {
+            if (mask) {
+                n += ngx_escape_html_generic(NULL, src, 16);
+            }
+
+            src += 16;
+            continue;
+        }
+
+        _mm_storeu_si128((__m128i *) dst, b);
+
+        if (mask == 0) {
+            dst += 16;
+            src += 16;
+            continue;
+        }
+
+        c = __builtin_ctz(mask);
+
+        dst = (u_char *) ngx_escape_html_generic(dst + c, src + c, 16 - c);
+        src += 16;
+    }
+
+    if (dst == NULL) {
+        return n + ngx_escape_html_generic(NULL, src, last - src);
+    }
+
+    return ngx_escape_html_generic(dst, src, last - src);
+}
+
+
+__attribute__((target("sse4.2")))
+static uintptr_t
+ngx_escape_json_sse42(u_char *dst, u_char *src, size_t size)
+{
+    u_char      *last;
+    uint32_t     mask;
+    ngx_uint_t   c, n;
+    __m128i      b, m;
+
+    last = src + size;
+    n = 0;
+
+    while (last - src >= 16) {
+        b = _mm_loadu_si128((const __m128i *) src);
+
+        /* the control characters are the bytes not above 0x1f */
+
+        m = _mm_cmpeq_epi8(_mm_min_epu8(b, _mm_set1_epi8(0x1f)), b);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8('\\')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(b, _mm_set1_epi8('"')));
+
+        mask = _mm_movemask_epi8(m);
+
+        if (dst == NULL) {
+            if (mask) {
+                n += ngx_escape_json_generic(NULL, src, 16);
+            }
+
+            src += 16;
+            continue;
+        }
+
+        _mm_storeu_si128((__m128i *) dst, b);
+
+        if (mask == 0) {
+            dst += 16;
+            src += 16;
+            continue;
+        }
+
+        c = __builtin_ctz(mask);
+
+        dst = (u_char *) ngx_escape_json_generic(dst + c, src + c, 16 - c);
+        src += 16;
+    }
+
+    if (dst == NULL) {
+        return n + ngx_escape_json_generic(NULL, src, last - src);
+    }
+
+    return ngx_escape_json_generic(dst, src, last - src);
+}
+
+
+/*
+ * copies the bytes without the escapes in blocks of 16 bytes, stops
+ * at "%", or at "?" if it ends the path, and leaves at least one byte;
+ * the source and the destination may be the same buffer
+ */
+
+__attribute__((target("sse4.2")))
+static size_t
+ngx_unescape_uri_sse42(u_char *dst, u_char *src, size_t size,
+    ngx_uint_t type)
+{
+    u_char    *last, *start;
+    size_t     n;
+    uint32_t   mask;
+    __m128i    b, m, q;
+
+    start = src;
+    last = src + size;
+
+    q = (type & (NGX_UNESCAPE_URI|NGX_UNESCAPE_REDIRECT))
+        ? _mm_set1_epi8('?') : _mm_set1_epi8('%');
+
+    while (last - src > 16) {
+        b = _mm_loadu_si128((const __m128i *) src);
+
+        m = _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8('%')),
+                         _mm_cmpeq_epi8(b, q));
+
+        mask = _mm_movemask_epi8(m);
+
+        if (mask) {
+            n = __builtin_ctz(mask);
+
+            if (dst != src) {
+                ngx_memmove(dst, src, n);
+            }
+
+            src += n;
+            break;
+        }
+
+        /* the block is loaded before the store that may overlap it */
+
+        if (dst != src) {
+            _mm_storeu_si128((__m128i *) dst, b);
+        }
+
+        dst += 16;
+        src += 16;
+    }
+
+    return src - start;
+}
+
+#endif
+
+
 void
 ngx_str_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
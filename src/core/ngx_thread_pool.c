@@ -26,17 +26,37 @@ typedef struct {
     (q)->last = &(q)->first
 
 
+/* the counters are shared by all worker processes */
+
+typedef struct {
+    ngx_atomic_t              submitted;
+    ngx_atomic_t              completed;
+    ngx_atomic_t              rejected;
+    ngx_atomic_t              waiting;
+    ngx_atomic_t              wait_time;
+    ngx_atomic_t              run_time;
+    ngx_atomic_t              wait_hist[NGX_THREAD_POOL_HIST_LEN];
+    ngx_atomic_t              run_hist[NGX_THREAD_POOL_HIST_LEN];
+} ngx_thread_pool_sh_t;
+
+
 struct ngx_thread_pool_s {
     ngx_thread_mutex_t        mtx;
     ngx_thread_pool_queue_t   queue;
-    ngx_int_t                 waiting;
+    ngx_uint_t                waiting;
+    ngx_uint_t                idle;
     ngx_thread_cond_t         cond;
 
+    ngx_uint_t                max_waiting;
+
+    ngx_thread_pool_sh_t     *sh;
+
     ngx_log_t                *log;
 
     ngx_str_t                 name;
     ngx_uint_t                threads;
     ngx_int_t                 max_queue;
+    ngx_uint_t                manager;     /* unsigned  manager:1; */
 
     u_char                   *file;
     ngx_uint_t                line;
@@ -49,13 +69,19 @@ static void ngx_thread_pool_destroy(ngx_thread_pool_t *tp);
 static void ngx_thread_pool_exit_handler(void *data, ngx_log_t *log);
 
 static void *ngx_thread_pool_cycle(void *data);
+static ngx_uint_t ngx_thread_pool_done_push(ngx_thread_task_t *task);
 static void ngx_thread_pool_handler(ngx_event_t *ev);
+static void ngx_thread_pool_account(ngx_atomic_t *total, ngx_atomic_t *hist,
+    uint64_t usec);
+static ngx_int_t ngx_thread_pool_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
 
 static char *ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 static void *ngx_thread_pool_create_conf(ngx_cycle_t *cycle);
 static char *ngx_thread_pool_init_conf(ngx_cycle_t *cycle, void *conf);
 
+static ngx_uint_t ngx_thread_pool_started(ngx_thread_pool_t *tp);
 static ngx_int_t ngx_thread_pool_init_worker(ngx_cycle_t *cycle);
 static void ngx_thread_pool_exit_worker(ngx_cycle_t *cycle);
 
@@ -99,8 +125,37 @@ ngx_module_t  ngx_thread_pool_module = {
 static ngx_str_t  ngx_thread_pool_default = ngx_string("default");
 
 static ngx_uint_t               ngx_thread_pool_task_id;
-static ngx_atomic_t             ngx_thread_pool_done_lock;
-static ngx_thread_pool_queue_t  ngx_thread_pool_done;
+
+/*
+ * the list of completed tasks, pushed by pool threads
+ * and taken as a whole by the worker, in LIFO order
+ */
+
+static ngx_atomic_t             ngx_thread_pool_done;
+
+/* set if the worker could not be notified about completed tasks */
+
+static ngx_atomic_t             ngx_thread_pool_unnotified;
+
+
+static ngx_inline uint64_t
+ngx_thread_pool_usec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static ngx_inline uint64_t
+ngx_thread_pool_elapsed(uint64_t start, uint64_t end)
+{
+    /* the system time may be changed */
+
+    return (end > start) ? end - start : 0;
+}
 
 
 static ngx_int_t
@@ -240,12 +295,16 @@ ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
         return NGX_ERROR;
     }
 
-    if (tp->waiting >= tp->max_queue) {
+    /* tasks to be taken by idle threads are not counted as waiting */
+
+    if (tp->waiting >= tp->idle + tp->max_queue) {
         (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
 
+        (void) ngx_atomic_fetch_add(&tp->sh->rejected, 1);
+
         ngx_log_error(NGX_LOG_ERR, tp->log, 0,
                       "thread pool \"%V\" queue overflow: %i tasks waiting",
-                      &tp->name, tp->waiting);
+                      &tp->name, tp->waiting - tp->idle);
         return NGX_ERROR;
     }
 
@@ -253,8 +312,11 @@ ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 
     task->id = ngx_thread_pool_task_id++;
     task->next = NULL;
+    task->start = ngx_thread_pool_usec();
 
-    if (ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
+    /* busy threads take the next task without waiting on the condition */
+
+    if (tp->idle && ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
         (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
         return NGX_ERROR;
     }
@@ -264,8 +326,25 @@ ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 
     tp->waiting++;
 
+    if (tp->waiting > tp->max_waiting) {
+        tp->max_waiting = tp->waiting;
+    }
+
+    /*
+     * the shared counter is incremented before the task can be taken
+     * by a thread, which decrements it, so it never goes below zero
+     */
+
+    (void) ngx_atomic_fetch_add(&tp->sh->waiting, 1);
+
     (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
 
+    /* the tasks stopping threads on exit are not accounted */
+
+    if (task->handler != ngx_thread_pool_exit_handler) {
+        (void) ngx_atomic_fetch_add(&tp->sh->submitted, 1);
+    }
+
     ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
                    "task #%ui added to thread pool \"%V\"",
                    task->id, &tp->name);
@@ -280,6 +359,7 @@ ngx_thread_pool_cycle(void *data)
     ngx_thread_pool_t *tp = data;
 
     int                 err;
+    uint64_t            now;
     sigset_t            set;
     ngx_thread_task_t  *task;
 
@@ -308,13 +388,14 @@ ngx_thread_pool_cycle(void *data)
             return NULL;
         }
 
-        /* the number may become negative */
-        tp->waiting--;
-
         while (tp->queue.first == NULL) {
-            if (ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log)
-                != NGX_OK)
-            {
+            tp->idle++;
+
+            err = ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log);
+
+            tp->idle--;
+
+            if (err != NGX_OK) {
                 (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
                 return NULL;
             }
@@ -327,10 +408,19 @@ ngx_thread_pool_cycle(void *data)
             tp->queue.last = &tp->queue.first;
         }
 
+        tp->waiting--;
+
         if (ngx_thread_mutex_unlock(&tp->mtx, tp->log) != NGX_OK) {
             return NULL;
         }
 
+        now = ngx_thread_pool_usec();
+
+        (void) ngx_atomic_fetch_add(&tp->sh->waiting, -1);
+
+        ngx_thread_pool_account(&tp->sh->wait_time, tp->sh->wait_hist,
+                                ngx_thread_pool_elapsed(task->start, now));
+
 #if 0
         ngx_time_update();
 #endif
@@ -341,23 +431,74 @@ ngx_thread_pool_cycle(void *data)
 
         task->handler(task->ctx, tp->log);
 
+        ngx_thread_pool_account(&tp->sh->run_time, tp->sh->run_hist,
+                                ngx_thread_pool_elapsed(now,
+                                                    ngx_thread_pool_usec()));
+
+        (void) ngx_atomic_fetch_add(&tp->sh->completed, 1);
+
         ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
                        "complete task #%ui in thread pool \"%V\"",
                        task->id, &tp->name);
 
-        task->next = NULL;
+        /*
+         * the worker is notified only if the list was empty,
+         * otherwise the notification is already pending;
+         * a failed notification is retried on the next completion
+         */
+
+        if (ngx_thread_pool_done_push(task)
+            || ngx_atomic_cmp_set(&ngx_thread_pool_unnotified, 1, 0))
+        {
+            if (ngx_notify(ngx_thread_pool_handler) != NGX_OK) {
+                ngx_log_error(NGX_LOG_ALERT, tp->log, 0,
+                              "thread pool \"%V\" notification failed",
+                              &tp->name);
+
+                ngx_thread_pool_unnotified = 1;
+            }
+        }
+    }
+}
+
+
+static ngx_uint_t
+ngx_thread_pool_done_push(ngx_thread_task_t *task)
+{
+    ngx_atomic_uint_t  head;
+
+    /*
+     * there is no ABA problem as the only consumer
+     * always takes the whole list
+     */
 
-        ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
+    do {
+        head = ngx_thread_pool_done;
+        task->next = (ngx_thread_task_t *) head;
 
-        *ngx_thread_pool_done.last = task;
-        ngx_thread_pool_done.last = &task->next;
+    } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, head,
+                                 (ngx_atomic_uint_t) task));
 
-        ngx_memory_barrier();
+    return (head == 0);
+}
 
-        ngx_unlock(&ngx_thread_pool_done_lock);
 
-        (void) ngx_notify(ngx_thread_pool_handler);
+static void
+ngx_thread_pool_account(ngx_atomic_t *total, ngx_atomic_t *hist,
+    uint64_t usec)
+{
+    uint64_t    v;
+    ngx_uint_t  n;
+
+    (void) ngx_atomic_fetch_add(total, (ngx_atomic_int_t) usec);
+
+    /* the n-th bucket counts times less than 2^n microseconds */
+
+    for (n = 0, v = usec; v && n < NGX_THREAD_POOL_HIST_LEN - 1; n++) {
+        v >>= 1;
     }
+
+    (void) ngx_atomic_fetch_add(&hist[n], 1);
 }
 
 
@@ -365,19 +506,27 @@ static void
 ngx_thread_pool_handler(ngx_event_t *ev)
 {
     ngx_event_t        *event;
-    ngx_thread_task_t  *task;
+    ngx_atomic_uint_t   head;
+    ngx_thread_task_t  *task, *next, *done;
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "thread pool handler");
 
-    ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
+    do {
+        head = ngx_thread_pool_done;
+
+    } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, head, 0));
 
-    task = ngx_thread_pool_done.first;
-    ngx_thread_pool_done.first = NULL;
-    ngx_thread_pool_done.last = &ngx_thread_pool_done.first;
+    /* restore the order of completion */
 
-    ngx_memory_barrier();
+    done = NULL;
 
-    ngx_unlock(&ngx_thread_pool_done_lock);
+    for (task = (ngx_thread_task_t *) head; task; task = next) {
+        next = task->next;
+        task->next = done;
+        done = task;
+    }
+
+    task = done;
 
     while (task) {
         ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
@@ -394,6 +543,92 @@ ngx_thread_pool_handler(ngx_event_t *ev)
 }
 
 
+ngx_thread_pool_t *
+ngx_thread_pool_at(ngx_cycle_t *cycle, ngx_uint_t n)
+{
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_conf_t   *tcf;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    if (tcf == NULL || n >= tcf->pools.nelts) {
+        return NULL;
+    }
+
+    tpp = tcf->pools.elts;
+
+    return tpp[n];
+}
+
+
+void
+ngx_thread_pool_stats(ngx_thread_pool_t *tp, ngx_thread_pool_stats_t *stats)
+{
+    ngx_uint_t             i;
+    ngx_thread_pool_sh_t  *sh;
+
+    stats->name = tp->name;
+    stats->threads = tp->threads;
+
+    sh = tp->sh;
+
+    stats->submitted = sh->submitted;
+    stats->completed = sh->completed;
+    stats->rejected = sh->rejected;
+    stats->waiting = sh->waiting;
+    stats->wait_time = sh->wait_time;
+    stats->run_time = sh->run_time;
+
+    for (i = 0; i < NGX_THREAD_POOL_HIST_LEN; i++) {
+        stats->wait_hist[i] = sh->wait_hist[i];
+        stats->run_hist[i] = sh->run_hist[i];
+    }
+
+    if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
+        return;
+    }
+
+    stats->idle = tp->idle;
+    stats->max_waiting = tp->max_waiting;
+
+    (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+}
+
+
+static ngx_int_t
+ngx_thread_pool_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_thread_pool_t  *otp = data;
+
+    ngx_slab_pool_t    *shpool;
+    ngx_thread_pool_t  *tp;
+
+    tp = shm_zone->data;
+
+    if (otp) {
+        tp->sh = otp->sh;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        tp->sh = shpool->data;
+        return NGX_OK;
+    }
+
+    tp->sh = ngx_slab_calloc(shpool, sizeof(ngx_thread_pool_sh_t));
+    if (tp->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = tp->sh;
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_thread_pool_create_conf(ngx_cycle_t *cycle)
 {
@@ -518,6 +753,8 @@ ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 ngx_thread_pool_t *
 ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name)
 {
+    ngx_str_t                zone;
+    ngx_shm_zone_t          *shm_zone;
     ngx_thread_pool_t       *tp, **tpp;
     ngx_thread_pool_conf_t  *tcf;
 
@@ -540,6 +777,23 @@ ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name)
     tp->file = cf->conf_file->file.name.data;
     tp->line = cf->conf_file->line;
 
+    zone.len = sizeof("thread_pool:") - 1 + name->len;
+    zone.data = ngx_pnalloc(cf->pool, zone.len);
+    if (zone.data == NULL) {
+        return NULL;
+    }
+
+    ngx_sprintf(zone.data, "thread_pool:%V", name);
+
+    shm_zone = ngx_shared_memory_add(cf, &zone, 8 * ngx_pagesize,
+                                     &ngx_thread_pool_module);
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
+    shm_zone->init = ngx_thread_pool_init_zone;
+    shm_zone->data = tp;
+
     tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
                                                   ngx_thread_pool_module);
 
@@ -579,6 +833,29 @@ ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name)
 }
 
 
+void
+ngx_thread_pool_use_manager(ngx_thread_pool_t *tp)
+{
+    tp->manager = 1;
+}
+
+
+static ngx_uint_t
+ngx_thread_pool_started(ngx_thread_pool_t *tp)
+{
+    /*
+     * helper processes only run the pools used by caches for removal
+     * of files, and only in the cache manager
+     */
+
+    if (ngx_process == NGX_PROCESS_HELPER) {
+        return ngx_cache_manager && tp->manager;
+    }
+
+    return 1;
+}
+
+
 static ngx_int_t
 ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
 {
@@ -587,7 +864,8 @@ ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
     ngx_thread_pool_conf_t   *tcf;
 
     if (ngx_process != NGX_PROCESS_WORKER
-        && ngx_process != NGX_PROCESS_SINGLE)
+        && ngx_process != NGX_PROCESS_SINGLE
+        && ngx_process != NGX_PROCESS_HELPER)
     {
         return NGX_OK;
     }
@@ -599,11 +877,17 @@ ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
         return NGX_OK;
     }
 
-    ngx_thread_pool_queue_init(&ngx_thread_pool_done);
+    ngx_thread_pool_done = 0;
+    ngx_thread_pool_unnotified = 0;
 
     tpp = tcf->pools.elts;
 
     for (i = 0; i < tcf->pools.nelts; i++) {
+
+        if (!ngx_thread_pool_started(tpp[i])) {
+            continue;
+        }
+
         if (ngx_thread_pool_init(tpp[i], cycle->log, cycle->pool) != NGX_OK) {
             return NGX_ERROR;
         }
@@ -621,7 +905,8 @@ ngx_thread_pool_exit_worker(ngx_cycle_t *cycle)
     ngx_thread_pool_conf_t   *tcf;
 
     if (ngx_process != NGX_PROCESS_WORKER
-        && ngx_process != NGX_PROCESS_SINGLE)
+        && ngx_process != NGX_PROCESS_SINGLE
+        && ngx_process != NGX_PROCESS_HELPER)
     {
         return;
     }
@@ -636,6 +921,8 @@ ngx_thread_pool_exit_worker(ngx_cycle_t *cycle)
     tpp = tcf->pools.elts;
 
     for (i = 0; i < tcf->pools.nelts; i++) {
-        ngx_thread_pool_destroy(tpp[i]);
+        if (ngx_thread_pool_started(tpp[i])) {
+            ngx_thread_pool_destroy(tpp[i]);
+        }
     }
 }
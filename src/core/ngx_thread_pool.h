@@ -17,6 +17,7 @@
 struct ngx_thread_task_s {
     ngx_thread_task_t   *next;
     ngx_uint_t           id;
+    uint64_t             start;
     void                *ctx;
     void               (*handler)(void *data, ngx_log_t *log);
     ngx_event_t          event;
@@ -26,11 +27,41 @@ struct ngx_thread_task_s {
 typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
 
 
+#define NGX_THREAD_POOL_HIST_LEN  24
+
+
+typedef struct {
+    ngx_str_t            name;
+    ngx_uint_t           threads;
+
+    /* the current worker process */
+    ngx_uint_t           idle;
+    ngx_uint_t           max_waiting;
+
+    /* all worker processes */
+    ngx_atomic_uint_t    submitted;
+    ngx_atomic_uint_t    completed;
+    ngx_atomic_uint_t    rejected;
+    ngx_atomic_uint_t    waiting;
+    ngx_atomic_uint_t    wait_time;   /* in microseconds */
+    ngx_atomic_uint_t    run_time;    /* in microseconds */
+
+    /* the n-th bucket counts times less than 2^n microseconds */
+    ngx_atomic_uint_t    wait_hist[NGX_THREAD_POOL_HIST_LEN];
+    ngx_atomic_uint_t    run_hist[NGX_THREAD_POOL_HIST_LEN];
+} ngx_thread_pool_stats_t;
+
+
 ngx_thread_pool_t *ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name);
 ngx_thread_pool_t *ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name);
+void ngx_thread_pool_use_manager(ngx_thread_pool_t *tp);
 
 ngx_thread_task_t *ngx_thread_task_alloc(ngx_pool_t *pool, size_t size);
 ngx_int_t ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task);
 
+ngx_thread_pool_t *ngx_thread_pool_at(ngx_cycle_t *cycle, ngx_uint_t n);
+void ngx_thread_pool_stats(ngx_thread_pool_t *tp,
+    ngx_thread_pool_stats_t *stats);
+
 
 #endif /* _NGX_THREAD_POOL_H_INCLUDED_ */
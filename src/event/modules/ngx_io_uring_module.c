@@ -0,0 +1,983 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The module uses io_uring as a readiness notification mechanism:
+ * connections are watched by multishot IORING_OP_POLL_ADD requests
+ * for both directions, which behave like EPOLLET, and listening sockets
+ * are watched by one-shot requests re-armed on completion, which behave
+ * like level-triggered events.  There is no add_conn() method, so a request
+ * is armed when the first event of a connection is added.
+ * All poll changes made during an event loop iteration are submitted
+ * in a batch by the same io_uring_enter() that waits for completions.
+ * File AIO reads are submitted to the ring as IORING_OP_READ.
+ *
+ * Multishot poll requires Linux 5.13, IORING_ENTER_EXT_ARG requires 5.11.
+ */
+
+
+#define NGX_IO_URING_AIO           2
+
+#define NGX_IO_URING_READ_EVENT    (POLLIN|POLLRDHUP)
+#define NGX_IO_URING_WRITE_EVENT   POLLOUT
+
+
+typedef struct {
+    ngx_uint_t               entries;
+} ngx_io_uring_conf_t;
+
+
+typedef struct {
+    unsigned                *head;
+    unsigned                *tail;
+    unsigned                *mask;
+    unsigned                *entries;
+    unsigned                *array;
+    struct io_uring_sqe     *sqes;
+    unsigned                 sqe_tail;
+} ngx_io_uring_sq_t;
+
+
+typedef struct {
+    unsigned                *head;
+    unsigned                *tail;
+    unsigned                *mask;
+    struct io_uring_cqe     *cqes;
+} ngx_io_uring_cq_t;
+
+
+static ngx_int_t ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_io_uring_setup_ring(ngx_cycle_t *cycle,
+    ngx_io_uring_conf_t *urcf);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify_init(ngx_log_t *log);
+static void ngx_io_uring_notify_handler(ngx_event_t *ev);
+#endif
+static void ngx_io_uring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_del_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify(ngx_event_handler_pt handler);
+#endif
+static ngx_int_t ngx_io_uring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+
+static ngx_int_t ngx_io_uring_poll_add(ngx_connection_t *c, uint32_t events,
+    ngx_uint_t multishot);
+static ngx_int_t ngx_io_uring_poll_remove(ngx_connection_t *c);
+static struct io_uring_sqe *ngx_io_uring_get_sqe(ngx_log_t *log);
+static ngx_int_t ngx_io_uring_submit(ngx_log_t *log);
+
+static void *ngx_io_uring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+static int                  ring = -1;
+static void                *sq_ring;
+static size_t               sq_ring_size;
+static void                *cq_ring;
+static size_t               cq_ring_size;
+static void                *sqes;
+static size_t               sqes_size;
+
+static ngx_io_uring_sq_t    sq;
+static ngx_io_uring_cq_t    cq;
+
+#if (NGX_HAVE_EVENTFD)
+static int                  notify_fd = -1;
+static ngx_event_t          notify_event;
+static ngx_connection_t     notify_conn;
+#endif
+
+
+static ngx_str_t      io_uring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_io_uring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, entries),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_event_module_t  ngx_io_uring_module_ctx = {
+    &io_uring_name,
+    ngx_io_uring_create_conf,            /* create configuration */
+    ngx_io_uring_init_conf,              /* init configuration */
+
+    {
+        ngx_io_uring_add_event,          /* add an event */
+        ngx_io_uring_del_event,          /* delete an event */
+        ngx_io_uring_add_event,          /* enable an event */
+        ngx_io_uring_del_event,          /* disable an event */
+        NULL,                            /* add an connection */
+        ngx_io_uring_del_connection,     /* delete an connection */
+#if (NGX_HAVE_EVENTFD)
+        ngx_io_uring_notify,             /* trigger a notify */
+#else
+        NULL,                            /* trigger a notify */
+#endif
+        ngx_io_uring_process_events,     /* process the events */
+        ngx_io_uring_init,               /* init the events */
+        ngx_io_uring_done,               /* done the events */
+    }
+};
+
+ngx_module_t  ngx_io_uring_module = {
+    NGX_MODULE_V1,
+    &ngx_io_uring_module_ctx,            /* module context */
+    ngx_io_uring_commands,               /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() directly as syscalls
+ * instead of liburing usage, the same way as the Linux AIO is used.
+ */
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags, void *arg, size_t argsz)
+{
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, argsz);
+}
+
+
+static ngx_inline unsigned
+ngx_io_uring_load_acquire(unsigned *p)
+{
+    unsigned  v;
+
+    v = *(volatile unsigned *) p;
+    ngx_memory_barrier();
+
+    return v;
+}
+
+
+static ngx_inline void
+ngx_io_uring_store_release(unsigned *p, unsigned v)
+{
+    ngx_memory_barrier();
+    *(volatile unsigned *) p = v;
+}
+
+
+static ngx_int_t
+ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_io_uring_conf_t  *urcf;
+
+    urcf = ngx_event_get_conf(cycle->conf_ctx, ngx_io_uring_module);
+
+    if (ring == -1) {
+        if (ngx_io_uring_setup_ring(cycle, urcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+#if (NGX_HAVE_EVENTFD)
+        if (ngx_io_uring_notify_init(cycle->log) != NGX_OK) {
+            ngx_io_uring_module_ctx.actions.notify = NULL;
+        }
+#endif
+    }
+
+    ngx_io = ngx_os_io;
+
+    ngx_event_actions = ngx_io_uring_module_ctx.actions;
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_IO_URING_EVENT;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_setup_ring(ngx_cycle_t *cycle, ngx_io_uring_conf_t *urcf)
+{
+    struct io_uring_params  p;
+
+    ngx_memzero(&p, sizeof(struct io_uring_params));
+
+    /* multishot poll requests may post many completions each */
+
+    p.flags = IORING_SETUP_CQSIZE|IORING_SETUP_CLAMP;
+    p.cq_entries = urcf->entries * 4;
+
+    ring = io_uring_setup(urcf->entries, &p);
+
+    if (ring == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "io_uring_setup() failed");
+        return NGX_ERROR;
+    }
+
+    if ((p.features & IORING_FEAT_EXT_ARG) == 0
+        || (p.features & IORING_FEAT_NODROP) == 0
+        || (p.features & IORING_FEAT_RSRC_TAGS) == 0)
+    {
+        /* IORING_FEAT_RSRC_TAGS is used as a marker of Linux 5.13+ */
+
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "io_uring is not supported by the kernel, "
+                      "Linux 5.13 or newer is required");
+        goto failed;
+    }
+
+    sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_ring_size = ngx_max(sq_ring_size, cq_ring_size);
+        cq_ring_size = sq_ring_size;
+    }
+
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ|PROT_WRITE,
+                   MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+
+    if (sq_ring == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        sq_ring = NULL;
+        goto failed;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring = sq_ring;
+
+    } else {
+        cq_ring = mmap(NULL, cq_ring_size, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+
+        if (cq_ring == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_CQ_RING) failed");
+            cq_ring = NULL;
+            goto failed;
+        }
+    }
+
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    sqes = mmap(NULL, sqes_size, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQES);
+
+    if (sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        sqes = NULL;
+        goto failed;
+    }
+
+    sq.head = (unsigned *) ((u_char *) sq_ring + p.sq_off.head);
+    sq.tail = (unsigned *) ((u_char *) sq_ring + p.sq_off.tail);
+    sq.mask = (unsigned *) ((u_char *) sq_ring + p.sq_off.ring_mask);
+    sq.entries = (unsigned *) ((u_char *) sq_ring + p.sq_off.ring_entries);
+    sq.array = (unsigned *) ((u_char *) sq_ring + p.sq_off.array);
+    sq.sqes = sqes;
+    sq.sqe_tail = *sq.tail;
+
+    cq.head = (unsigned *) ((u_char *) cq_ring + p.cq_off.head);
+    cq.tail = (unsigned *) ((u_char *) cq_ring + p.cq_off.tail);
+    cq.mask = (unsigned *) ((u_char *) cq_ring + p.cq_off.ring_mask);
+    cq.cqes = (struct io_uring_cqe *) ((u_char *) cq_ring + p.cq_off.cqes);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d sq:%ud cq:%ud",
+                   ring, p.sq_entries, p.cq_entries);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_io_uring_done(cycle);
+
+    return NGX_ERROR;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify_init(ngx_log_t *log)
+{
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    notify_fd = eventfd(0, 0);
+#else
+    notify_fd = syscall(SYS_eventfd, 0);
+#endif
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    notify_event.handler = ngx_io_uring_notify_handler;
+    notify_event.log = log;
+    notify_event.active = 1;
+
+    notify_conn.fd = notify_fd;
+    notify_conn.read = &notify_event;
+    notify_conn.write = &notify_event;
+    notify_conn.log = log;
+
+    if (ngx_io_uring_poll_add(&notify_conn, POLLIN, 1) != NGX_OK) {
+
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t               n;
+    uint64_t              count;
+    ngx_err_t             err;
+    ngx_event_handler_pt  handler;
+
+    if (++ev->index == NGX_MAX_UINT32_VALUE) {
+        ev->index = 0;
+
+        n = read(notify_fd, &count, sizeof(uint64_t));
+
+        err = ngx_errno;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "read() eventfd %d: %z count:%uL", notify_fd, n, count);
+
+        if ((size_t) n != sizeof(uint64_t)) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                          "read() eventfd %d failed", notify_fd);
+        }
+    }
+
+    handler = ev->data;
+    handler(ev);
+}
+
+#endif
+
+
+static void
+ngx_io_uring_done(ngx_cycle_t *cycle)
+{
+    if (sqes && munmap(sqes, sqes_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_SQES) failed");
+    }
+
+    if (cq_ring && cq_ring != sq_ring && munmap(cq_ring, cq_ring_size) == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_CQ_RING) failed");
+    }
+
+    if (sq_ring && munmap(sq_ring, sq_ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_SQ_RING) failed");
+    }
+
+    sqes = NULL;
+    cq_ring = NULL;
+    sq_ring = NULL;
+
+    if (ring != -1 && close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+#if (NGX_HAVE_EVENTFD)
+
+    if (notify_fd != -1 && close(notify_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "eventfd close() failed");
+    }
+
+    notify_fd = -1;
+
+#endif
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    e = (event == NGX_READ_EVENT) ? c->write : c->read;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring add event: fd:%d ev:%i fl:%ui",
+                   c->fd, event, flags);
+
+    /*
+     * a multishot poll request of a connection watches both directions,
+     * events of an inactive direction are ignored
+     */
+
+    if (!e->active) {
+
+        if (flags & NGX_CLEAR_EVENT) {
+            c->read->oneshot = 0;
+
+            if (ngx_io_uring_poll_add(c, NGX_IO_URING_READ_EVENT
+                                         |NGX_IO_URING_WRITE_EVENT, 1)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+        } else {
+
+            /* level-triggered events are emulated by re-armed requests */
+
+            c->read->oneshot = 1;
+
+            if (ngx_io_uring_poll_add(c, (event == NGX_READ_EVENT)
+                                         ? NGX_IO_URING_READ_EVENT
+                                         : NGX_IO_URING_WRITE_EVENT, 0)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    ev->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    e = (event == NGX_READ_EVENT) ? c->write : c->read;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: fd:%d ev:%i fl:%ui",
+                   c->fd, event, flags);
+
+    ev->active = 0;
+
+    if (e->active) {
+        return NGX_OK;
+    }
+
+    /*
+     * unlike epoll, a poll request holds a reference to the file,
+     * so it must be removed even if the descriptor is being closed
+     */
+
+    return ngx_io_uring_poll_remove(c);
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring del connection: fd:%d", c->fd);
+
+    if (!c->read->active && !c->write->active) {
+        return NGX_OK;
+    }
+
+    c->read->active = 0;
+    c->write->active = 0;
+
+    return ngx_io_uring_poll_remove(c);
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_event.data = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_io_uring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                              n;
+    unsigned                         head, tail, to_submit, wait;
+    uint32_t                         revents, cflags;
+    uint64_t                         data;
+    ngx_int_t                        instance, res;
+    ngx_uint_t                       level, events;
+    ngx_err_t                        err;
+    ngx_event_t                     *rev, *wev;
+    ngx_queue_t                     *queue;
+    ngx_connection_t                *c;
+#if (NGX_HAVE_FILE_AIO)
+    ngx_event_t                     *e;
+    ngx_event_aio_t                 *aio;
+#endif
+    struct timespec                  ts;
+    struct io_uring_cqe             *cqe;
+    struct io_uring_getevents_arg    arg;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M", timer);
+
+    ngx_io_uring_store_release(sq.tail, sq.sqe_tail);
+
+    to_submit = sq.sqe_tail - ngx_io_uring_load_acquire(sq.head);
+
+    ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+    if (timer != NGX_TIMER_INFINITE) {
+        ts.tv_sec = timer / 1000;
+        ts.tv_nsec = (timer % 1000) * 1000000;
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+    }
+
+    wait = (timer == 0) ? 0 : 1;
+
+    n = io_uring_enter(ring, to_submit, wait,
+                       IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(struct io_uring_getevents_arg));
+
+    err = (n == -1) ? ngx_errno : 0;
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else if (err == ETIME || err == NGX_EAGAIN || err == NGX_EBUSY) {
+
+            /* timed out or completion queue overflow */
+
+            level = 0;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        if (level) {
+            ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring_enter: %d of %ud submitted", n, to_submit);
+
+    head = *cq.head;
+    tail = ngx_io_uring_load_acquire(cq.tail);
+
+    for (events = 0; head != tail; head++, events++) {
+
+        cqe = &cq.cqes[head & *cq.mask];
+
+        data = cqe->user_data;
+        res = cqe->res;
+        cflags = cqe->flags;
+
+        ngx_io_uring_store_release(cq.head, head + 1);
+
+        if (data == 0) {
+            /* completion of a poll removal */
+            continue;
+        }
+
+#if (NGX_HAVE_FILE_AIO)
+
+        if (data & NGX_IO_URING_AIO) {
+            e = (ngx_event_t *) (uintptr_t) (data & ~NGX_IO_URING_AIO);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring aio: %p res:%i", e, res);
+
+            e->complete = 1;
+            e->active = 0;
+            e->ready = 1;
+
+            aio = e->data;
+            aio->res = res;
+
+            ngx_post_event(e, &ngx_posted_events);
+
+            continue;
+        }
+
+#endif
+
+        c = (ngx_connection_t *) (uintptr_t) data;
+
+        instance = (uintptr_t) c & 1;
+        c = (ngx_connection_t *) ((uintptr_t) c & (uintptr_t) ~1);
+
+        rev = c->read;
+
+        if (c->fd == -1 || rev->instance != instance) {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed in this iteration
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+            continue;
+        }
+
+        if (res == -NGX_ECANCELED) {
+            /* the request was removed */
+            continue;
+        }
+
+        wev = c->write;
+
+        if (!(cflags & IORING_CQE_F_MORE) && (rev->active || wev->active)) {
+
+            /*
+             * a one-shot request has completed, or a multishot one
+             * was terminated by the kernel, e.g., on overflow
+             */
+
+            if (rev->oneshot) {
+                revents = (rev->active ? NGX_IO_URING_READ_EVENT : 0)
+                          | (wev->active ? NGX_IO_URING_WRITE_EVENT : 0);
+
+            } else if (c == &notify_conn) {
+                revents = POLLIN;
+
+            } else {
+                revents = NGX_IO_URING_READ_EVENT|NGX_IO_URING_WRITE_EVENT;
+            }
+
+            if (ngx_io_uring_poll_add(c, revents, !rev->oneshot) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        if (res < 0) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, -res,
+                           "io_uring poll error on fd:%d d:%p", c->fd, c);
+
+            revents = POLLERR;
+
+        } else {
+            revents = (uint32_t) res;
+        }
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d ev:%04XD d:%p", c->fd, revents, c);
+
+        if (revents & (POLLERR|POLLHUP)) {
+
+            /*
+             * if the error events were returned, add POLLIN and POLLOUT
+             * to handle the events at least in one active handler
+             */
+
+            revents |= POLLIN|POLLOUT;
+        }
+
+        if ((revents & POLLIN) && rev->active) {
+
+            if (revents & POLLRDHUP) {
+                rev->pending_eof = 1;
+            }
+
+            rev->ready = 1;
+
+            if (flags & NGX_POST_EVENTS) {
+                queue = rev->accept ? &ngx_posted_accept_events
+                                    : &ngx_posted_events;
+
+                ngx_post_event(rev, queue);
+
+            } else {
+                rev->handler(rev);
+            }
+        }
+
+        if ((revents & POLLOUT) && wev->active) {
+
+            if (c->fd == -1 || wev->instance != instance) {
+
+                /*
+                 * the stale event from a file descriptor
+                 * that was just closed in this iteration
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                               "io_uring: stale event %p", c);
+                continue;
+            }
+
+            wev->ready = 1;
+#if (NGX_THREADS)
+            wev->complete = 1;
+#endif
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_post_event(wev, &ngx_posted_events);
+
+            } else {
+                wev->handler(wev);
+            }
+        }
+    }
+
+    if (events == 0 && timer == NGX_TIMER_INFINITE && !err && to_submit == 0)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "io_uring_enter() returned no events without timeout");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_FILE_AIO)
+
+ngx_int_t
+ngx_io_uring_read(ngx_event_t *ev, ngx_fd_t fd, u_char *buf, size_t size,
+    off_t offset)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(ev->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t) ((uintptr_t) ev | NGX_IO_URING_AIO);
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_io_uring_poll_add(ngx_connection_t *c, uint32_t events,
+    ngx_uint_t multishot)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring poll add: fd:%d ev:%04XD multi:%ui",
+                   c->fd, events, multishot);
+
+    sqe = ngx_io_uring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+#if !(NGX_HAVE_LITTLE_ENDIAN)
+    events = (events << 16) | (events >> 16);
+#endif
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->poll32_events = events;
+    sqe->user_data = (uint64_t) ((uintptr_t) c | c->read->instance);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_poll_remove(ngx_connection_t *c)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring poll remove: fd:%d", c->fd);
+
+    sqe = ngx_io_uring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) ((uintptr_t) c | c->read->instance);
+    sqe->user_data = 0;
+
+    return NGX_OK;
+}
+
+
+static struct io_uring_sqe *
+ngx_io_uring_get_sqe(ngx_log_t *log)
+{
+    unsigned              index;
+    struct io_uring_sqe  *sqe;
+
+    if (sq.sqe_tail - ngx_io_uring_load_acquire(sq.head) >= *sq.entries) {
+
+        /* the submission queue is full, submit it without waiting */
+
+        if (ngx_io_uring_submit(log) != NGX_OK) {
+            return NULL;
+        }
+
+        if (sq.sqe_tail - ngx_io_uring_load_acquire(sq.head) >= *sq.entries) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission queue overflow");
+            return NULL;
+        }
+    }
+
+    index = sq.sqe_tail & *sq.mask;
+
+    sqe = &sq.sqes[index];
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    sq.array[index] = index;
+    sq.sqe_tail++;
+
+    return sqe;
+}
+
+
+static ngx_int_t
+ngx_io_uring_submit(ngx_log_t *log)
+{
+    int       n;
+    unsigned  to_submit;
+
+    ngx_io_uring_store_release(sq.tail, sq.sqe_tail);
+
+    to_submit = sq.sqe_tail - ngx_io_uring_load_acquire(sq.head);
+
+    n = io_uring_enter(ring, to_submit, 0, 0, NULL, 0);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring_enter: %d of %ud submitted", n, to_submit);
+
+    if (n == -1 && ngx_errno != NGX_EINTR && ngx_errno != NGX_EAGAIN
+        && ngx_errno != NGX_EBUSY)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_io_uring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_io_uring_conf_t  *urcf;
+
+    urcf = ngx_palloc(cycle->pool, sizeof(ngx_io_uring_conf_t));
+    if (urcf == NULL) {
+        return NULL;
+    }
+
+    urcf->entries = NGX_CONF_UNSET;
+
+    return urcf;
+}
+
+
+static char *
+ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_io_uring_conf_t *urcf = conf;
+
+    ngx_conf_init_uint_value(urcf->entries, 1024);
+
+    return NGX_CONF_OK;
+}
@@ -281,6 +281,11 @@ extern ngx_uint_t            ngx_use_epoll_rdhup;
  */
 #define NGX_USE_VNODE_EVENT      0x00002000
 
+/*
+ * The event filter is io_uring.
+ */
+#define NGX_USE_IO_URING_EVENT   0x00004000
+
 
 /*
  * The event filter is deleted just before the closing file.
@@ -527,6 +532,12 @@ u_char *ngx_acceptex_log_error(ngx_log_t *log, u_char *buf, size_t len);
 #endif
 
 
+#if (NGX_HAVE_IO_URING)
+ngx_int_t ngx_io_uring_read(ngx_event_t *ev, ngx_fd_t fd, u_char *buf,
+    size_t size, off_t offset);
+#endif
+
+
 ngx_int_t ngx_send_lowat(ngx_connection_t *c, size_t lowat);
 
 
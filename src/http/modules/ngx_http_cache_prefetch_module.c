@@ -0,0 +1,520 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    ngx_uint_t                      concurrency;
+} ngx_http_cache_prefetch_loc_conf_t;
+
+
+typedef struct {
+    ngx_array_t                     uris;
+    ngx_uint_t                      next;
+    ngx_uint_t                      active;
+
+    ngx_uint_t                      fresh;
+    ngx_uint_t                      fetched;
+    ngx_uint_t                      failed;
+
+    ngx_http_request_body_t        *body;
+    ngx_http_post_subrequest_t      ps;
+} ngx_http_cache_prefetch_ctx_t;
+
+
+static ngx_int_t ngx_http_cache_prefetch_handler(ngx_http_request_t *r);
+static void ngx_http_cache_prefetch_body_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_cache_prefetch_parse(ngx_http_request_t *r,
+    ngx_http_cache_prefetch_ctx_t *ctx);
+static void ngx_http_cache_prefetch_start(ngx_http_request_t *r,
+    ngx_http_cache_prefetch_ctx_t *ctx);
+static ngx_int_t ngx_http_cache_prefetch_subrequest(ngx_http_request_t *r,
+    ngx_http_cache_prefetch_ctx_t *ctx, ngx_str_t *line);
+static ngx_int_t ngx_http_cache_prefetch_done(ngx_http_request_t *r,
+    void *data, ngx_int_t rc);
+static void ngx_http_cache_prefetch_finish(ngx_http_request_t *r);
+static ngx_int_t ngx_http_cache_prefetch_send(ngx_http_request_t *r,
+    ngx_http_cache_prefetch_ctx_t *ctx);
+
+static void *ngx_http_cache_prefetch_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_cache_prefetch_merge_loc_conf(ngx_conf_t *cf,
+    void *parent, void *child);
+static char *ngx_http_cache_prefetch(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_conf_num_bounds_t  ngx_http_cache_prefetch_concurrency_bounds = {
+    ngx_conf_check_num_bounds, 1, 1000
+};
+
+
+static ngx_command_t  ngx_http_cache_prefetch_commands[] = {
+
+    { ngx_string("cache_prefetch"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_cache_prefetch,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("cache_prefetch_concurrency"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cache_prefetch_loc_conf_t, concurrency),
+      &ngx_http_cache_prefetch_concurrency_bounds },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_cache_prefetch_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_cache_prefetch_create_loc_conf, /* create location configuration */
+    ngx_http_cache_prefetch_merge_loc_conf   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_cache_prefetch_module = {
+    NGX_MODULE_V1,
+    &ngx_http_cache_prefetch_module_ctx,   /* module context */
+    ngx_http_cache_prefetch_commands,      /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_cache_prefetch_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                       rc;
+    ngx_http_cache_prefetch_ctx_t  *ctx;
+
+    if (r->method != NGX_HTTP_POST) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_prefetch_ctx_t));
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_http_set_ctx(r, ctx, ngx_http_cache_prefetch_module);
+
+    r->request_body_in_single_buf = 1;
+
+    rc = ngx_http_read_client_request_body(r,
+                                        ngx_http_cache_prefetch_body_handler);
+
+    if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+        return rc;
+    }
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_cache_prefetch_body_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                       rc;
+    ngx_http_cache_prefetch_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_prefetch_module);
+
+    rc = ngx_http_cache_prefetch_parse(r, ctx);
+
+    if (rc != NGX_OK) {
+        ngx_http_finalize_request(r, rc);
+        return;
+    }
+
+    /*
+     * a fake request body is used by subrequests to avoid sending
+     * the list to upstream servers
+     */
+
+    ctx->body = ngx_pcalloc(r->pool, sizeof(ngx_http_request_body_t));
+    if (ctx->body == NULL) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    ctx->ps.handler = ngx_http_cache_prefetch_done;
+    ctx->ps.data = ctx;
+
+    /* the response is sent when the last subrequest is done */
+
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    ngx_http_cache_prefetch_start(r, ctx);
+
+    if (ctx->active == 0) {
+        ngx_http_finalize_request(r, ngx_http_cache_prefetch_send(r, ctx));
+    }
+}
+
+
+static ngx_int_t
+ngx_http_cache_prefetch_parse(ngx_http_request_t *r,
+    ngx_http_cache_prefetch_ctx_t *ctx)
+{
+    off_t         size;
+    u_char       *p, *last, *start, *end;
+    ssize_t       n;
+    ngx_str_t    *uri;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    if (ngx_array_init(&ctx->uris, r->pool, 16, sizeof(ngx_str_t))
+        != NGX_OK)
+    {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (r->request_body == NULL || r->request_body->bufs == NULL) {
+        return NGX_OK;
+    }
+
+    size = 0;
+
+    for (cl = r->request_body->bufs; cl; cl = cl->next) {
+        size += ngx_buf_size(cl->buf);
+    }
+
+    if (size == 0) {
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, size);
+    if (p == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    last = p;
+
+    for (cl = r->request_body->bufs; cl; cl = cl->next) {
+        b = cl->buf;
+
+        if (b->in_file) {
+            n = ngx_read_file(b->file, last, b->file_last - b->file_pos,
+                              b->file_pos);
+
+            if (n != b->file_last - b->file_pos) {
+                if (n != NGX_ERROR) {
+                    ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                                  ngx_read_file_n " returned "
+                                  "only %z bytes instead of %O",
+                                  n, b->file_last - b->file_pos);
+                }
+
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            last += n;
+
+        } else {
+            last = ngx_cpymem(last, b->pos, b->last - b->pos);
+        }
+    }
+
+    /* one URI per line, empty lines and lines starting with "#" are ignored */
+
+    while (p < last) {
+
+        start = p;
+
+        end = ngx_strlchr(p, last, LF);
+        if (end == NULL) {
+            end = last;
+        }
+
+        p = end + 1;
+
+        while (start < end && (*start == ' ' || *start == '\t')) {
+            start++;
+        }
+
+        while (end > start
+               && (end[-1] == CR || end[-1] == ' ' || end[-1] == '\t'))
+        {
+            end--;
+        }
+
+        if (start == end || *start == '#') {
+            continue;
+        }
+
+        uri = ngx_array_push(&ctx->uris);
+        if (uri == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        uri->len = end - start;
+        uri->data = start;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "cache prefetch uris: %ui", ctx->uris.nelts);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_cache_prefetch_start(ngx_http_request_t *r,
+    ngx_http_cache_prefetch_ctx_t *ctx)
+{
+    ngx_str_t                           *uri;
+    ngx_http_cache_prefetch_loc_conf_t  *plcf;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_prefetch_module);
+
+    uri = ctx->uris.elts;
+
+    while (ctx->active < plcf->concurrency && ctx->next < ctx->uris.nelts) {
+
+        if (ngx_http_cache_prefetch_subrequest(r, ctx, &uri[ctx->next++])
+            != NGX_OK)
+        {
+            ctx->failed++;
+            continue;
+        }
+
+        ctx->active++;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_cache_prefetch_subrequest(ngx_http_request_t *r,
+    ngx_http_cache_prefetch_ctx_t *ctx, ngx_str_t *line)
+{
+    ngx_str_t                   uri, args;
+    ngx_uint_t                  flags;
+    ngx_http_request_t         *sr;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    uri = *line;
+    ngx_str_null(&args);
+    flags = NGX_HTTP_LOG_UNSAFE;
+
+    if (uri.data[0] != '/'
+        || ngx_http_parse_unsafe_uri(r, &uri, &args, &flags) != NGX_OK)
+    {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "invalid prefetch URI \"%V\"", line);
+        return NGX_DECLINED;
+    }
+
+    if (ngx_http_subrequest(r, &uri, &args, &sr, &ctx->ps,
+                            NGX_HTTP_SUBREQUEST_BACKGROUND)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    /*
+     * the cache key is usually built from $request_uri, so each
+     * subrequest gets its own URI and its own variables
+     */
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    sr->variables = ngx_pcalloc(r->pool, cmcf->variables.nelts
+                                        * sizeof(ngx_http_variable_value_t));
+    if (sr->variables == NULL) {
+        return NGX_ERROR;
+    }
+
+    sr->unparsed_uri = *line;
+
+    sr->request_body = ctx->body;
+    sr->headers_in.content_length = NULL;
+    sr->headers_in.content_length_n = -1;
+    sr->headers_in.transfer_encoding = NULL;
+    sr->headers_in.chunked = 0;
+
+    sr->header_only = 1;
+    sr->cache_prefetch = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_cache_prefetch_done(ngx_http_request_t *r, void *data, ngx_int_t rc)
+{
+    ngx_http_cache_prefetch_ctx_t *ctx = data;
+
+    ngx_http_request_t  *pr;
+
+    /* the handler is called on each finalization of a subrequest */
+
+    r->post_subrequest = NULL;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "cache prefetch done: \"%V\" rc:%i s:%ui",
+                   &r->uri, rc, r->headers_out.status);
+
+    if (r->upstream && r->upstream->cache_status == NGX_HTTP_CACHE_HIT
+        && (rc == NGX_OK || rc == NGX_HTTP_NO_CONTENT))
+    {
+        ctx->fresh++;
+
+    } else if (r->upstream && rc != NGX_ERROR
+               && rc < NGX_HTTP_SPECIAL_RESPONSE
+               && r->headers_out.status < NGX_HTTP_SPECIAL_RESPONSE)
+    {
+        ctx->fetched++;
+
+    } else {
+        ctx->failed++;
+    }
+
+    ctx->active--;
+
+    pr = r->main;
+
+    ngx_http_cache_prefetch_start(pr, ctx);
+
+    if (ctx->active == 0) {
+        pr->write_event_handler = ngx_http_cache_prefetch_finish;
+
+        if (ngx_http_post_request(pr, NULL) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    /*
+     * a failed subrequest must not terminate the main request,
+     * the upstream is already finalized at this point
+     */
+
+    if (rc == NGX_ERROR) {
+        return NGX_OK;
+    }
+
+    return rc;
+}
+
+
+static void
+ngx_http_cache_prefetch_finish(ngx_http_request_t *r)
+{
+    ngx_http_cache_prefetch_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_prefetch_module);
+
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    ngx_http_finalize_request(r, ngx_http_cache_prefetch_send(r, ctx));
+}
+
+
+static ngx_int_t
+ngx_http_cache_prefetch_send(ngx_http_request_t *r,
+    ngx_http_cache_prefetch_ctx_t *ctx)
+{
+    size_t        size;
+    ngx_int_t     rc;
+    ngx_buf_t    *b;
+    ngx_chain_t   out;
+
+    size = sizeof("{\"uris\":,\"fresh\":,\"fetched\":,\"failed\":}" CRLF) - 1
+           + 4 * NGX_INT_T_LEN;
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_sprintf(b->last,
+                          "{\"uris\":%ui,\"fresh\":%ui,\"fetched\":%ui,"
+                          "\"failed\":%ui}" CRLF,
+                          ctx->uris.nelts, ctx->fresh, ctx->fetched,
+                          ctx->failed);
+
+    r->headers_out.content_type_len = sizeof("application/json") - 1;
+    ngx_str_set(&r->headers_out.content_type, "application/json");
+    r->headers_out.content_type_lowcase = NULL;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static void *
+ngx_http_cache_prefetch_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_cache_prefetch_loc_conf_t  *conf;
+
+    conf = ngx_palloc(cf->pool, sizeof(ngx_http_cache_prefetch_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->concurrency = NGX_CONF_UNSET_UINT;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_cache_prefetch_merge_loc_conf(ngx_conf_t *cf, void *parent,
+    void *child)
+{
+    ngx_http_cache_prefetch_loc_conf_t *prev = parent;
+    ngx_http_cache_prefetch_loc_conf_t *conf = child;
+
+    ngx_conf_merge_uint_value(conf->concurrency, prev->concurrency, 4);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_cache_prefetch(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_cache_prefetch_handler;
+
+    return NGX_CONF_OK;
+}
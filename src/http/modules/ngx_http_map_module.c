@@ -353,8 +353,28 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #if (NGX_PCRE)
 
     if (ctx.regexes.nelts) {
+        ngx_uint_t             i;
+        ngx_regex_elt_t       *elts;
+        ngx_http_map_regex_t  *reg;
+
         map->map.regex = ctx.regexes.elts;
         map->map.nregex = ctx.regexes.nelts;
+
+        elts = ngx_palloc(pool, ctx.regexes.nelts * sizeof(ngx_regex_elt_t));
+        if (elts == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+
+        reg = ctx.regexes.elts;
+
+        for (i = 0; i < ctx.regexes.nelts; i++) {
+            elts[i].regex = reg[i].regex->regex;
+            elts[i].name = reg[i].regex->name.data;
+        }
+
+        map->map.regex_set = ngx_http_regex_compile_set(cf, elts,
+                                                        ctx.regexes.nelts);
     }
 
 #endif
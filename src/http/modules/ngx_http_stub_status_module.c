@@ -10,12 +10,79 @@
 #include <ngx_http.h>
 
 
+typedef struct ngx_http_status_node_s  ngx_http_status_node_t;
+
+struct ngx_http_status_node_s {
+    ngx_atomic_t                 requests;
+    ngx_atomic_t                 responses[5];
+    ngx_atomic_t                 received;
+    ngx_atomic_t                 sent;
+
+    ngx_http_status_node_t      *next;
+    ngx_str_t                    name;
+};
+
+
+typedef struct {
+    ngx_http_status_node_t      *nodes;
+} ngx_http_status_shctx_t;
+
+
+typedef struct {
+    ngx_str_t                    name;
+    ngx_http_status_node_t      *node;
+} ngx_http_status_zone_t;
+
+
+typedef struct {
+    ngx_array_t                  zones;       /* ngx_http_status_zone_t */
+    ngx_uint_t                   json;        /* unsigned  json:1; */
+
+    ngx_http_status_shctx_t     *sh;
+    ngx_slab_pool_t             *shpool;
+} ngx_http_stub_status_main_conf_t;
+
+
+typedef struct {
+    ngx_uint_t                   zone;
+} ngx_http_stub_status_srv_conf_t;
+
+
 static ngx_int_t ngx_http_stub_status_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_stub_status_json_handler(ngx_http_request_t *r);
+static ngx_chain_t *ngx_http_stub_status_json_zones(ngx_http_request_t *r);
+#if (NGX_HTTP_UPSTREAM_ZONE)
+static ngx_chain_t *ngx_http_stub_status_json_upstream(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_uint_t last);
+static u_char *ngx_http_stub_status_json_peer(u_char *p,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t backup);
+static void ngx_http_stub_status_log_upstream(ngx_http_request_t *r);
+#endif
+static u_char *ngx_http_stub_status_json_str(u_char *p, ngx_str_t *str);
+static ngx_int_t ngx_http_stub_status_log_handler(ngx_http_request_t *r);
+static ngx_uint_t ngx_http_stub_status_class(ngx_uint_t status);
+static ngx_int_t ngx_http_stub_status_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
 static ngx_int_t ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_stub_status_add_variables(ngx_conf_t *cf);
 static char *ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_status_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+static void *ngx_http_stub_status_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_stub_status_init_main_conf(ngx_conf_t *cf, void *conf);
+static void *ngx_http_stub_status_create_srv_conf(ngx_conf_t *cf);
+static ngx_int_t ngx_http_stub_status_init(ngx_conf_t *cf);
+
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_thread_pool_status_handler(ngx_http_request_t *r);
+static u_char *ngx_http_thread_pool_status_hist(u_char *p, u_char *name,
+    ngx_atomic_uint_t total, ngx_atomic_uint_t *hist);
+static char *ngx_http_set_thread_pool_status(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+#endif
 
 
 static ngx_command_t  ngx_http_status_commands[] = {
@@ -27,18 +94,36 @@ static ngx_command_t  ngx_http_status_commands[] = {
       0,
       NULL },
 
+    { ngx_string("status_zone"),
+      NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_http_status_zone,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+#if (NGX_THREADS)
+
+    { ngx_string("thread_pool_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_set_thread_pool_status,
+      0,
+      0,
+      NULL },
+
+#endif
+
       ngx_null_command
 };
 
 
 static ngx_http_module_t  ngx_http_stub_status_module_ctx = {
     ngx_http_stub_status_add_variables,    /* preconfiguration */
-    NULL,                                  /* postconfiguration */
+    ngx_http_stub_status_init,             /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
-    NULL,                                  /* init main configuration */
+    ngx_http_stub_status_create_main_conf, /* create main configuration */
+    ngx_http_stub_status_init_main_conf,   /* init main configuration */
 
-    NULL,                                  /* create server configuration */
+    ngx_http_stub_status_create_srv_conf,  /* create server configuration */
     NULL,                                  /* merge server configuration */
 
     NULL,                                  /* create location configuration */
@@ -160,6 +245,705 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
 }
 
 
+static ngx_int_t
+ngx_http_stub_status_json_handler(ngx_http_request_t *r)
+{
+    size_t                          size;
+    ngx_int_t                       rc;
+    ngx_buf_t                      *b;
+    ngx_chain_t                    *out, **ll;
+    ngx_atomic_int_t                ap, hn, ac, rq, rd, wr, wa;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                      i, n;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+#endif
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r->headers_out.content_type_len = sizeof("application/json") - 1;
+    ngx_str_set(&r->headers_out.content_type, "application/json");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    size = sizeof("{\"connections\":{\"accepted\":,\"handled\":,"
+                  "\"active\":,\"reading\":,\"writing\":,\"waiting\":},"
+                  "\"requests\":,") - 1
+           + 7 * NGX_ATOMIC_T_LEN;
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out = ngx_alloc_chain_link(r->pool);
+    if (out == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out->buf = b;
+
+    ap = *ngx_stat_accepted;
+    hn = *ngx_stat_handled;
+    ac = *ngx_stat_active;
+    rq = *ngx_stat_requests;
+    rd = *ngx_stat_reading;
+    wr = *ngx_stat_writing;
+    wa = *ngx_stat_waiting;
+
+    b->last = ngx_sprintf(b->last, "{\"connections\":{\"accepted\":%uA,"
+                          "\"handled\":%uA,\"active\":%uA,\"reading\":%uA,"
+                          "\"writing\":%uA,\"waiting\":%uA},"
+                          "\"requests\":%uA,",
+                          ap, hn, ac, rd, wr, wa, rq);
+
+    out->next = ngx_http_stub_status_json_zones(r);
+    if (out->next == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ll = &out->next->next;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0, n = 0; i < umcf->upstreams.nelts; i++) {
+        if (uscfp[i]->shm_zone) {
+            n++;
+        }
+    }
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->shm_zone == NULL) {
+            continue;
+        }
+
+        *ll = ngx_http_stub_status_json_upstream(r, uscfp[i], --n == 0);
+        if (*ll == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ll = &(*ll)->next;
+    }
+
+#endif
+
+    *ll = ngx_alloc_chain_link(r->pool);
+    if (*ll == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->pos = (u_char *) "}}\n";
+    b->last = b->pos + sizeof("}}\n") - 1;
+    b->memory = 1;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    (*ll)->buf = b;
+    (*ll)->next = NULL;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = 0;
+
+    for (ll = &out; *ll; ll = &(*ll)->next) {
+        r->headers_out.content_length_n += ngx_buf_size((*ll)->buf);
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, out);
+}
+
+
+static ngx_chain_t *
+ngx_http_stub_status_json_zones(ngx_http_request_t *r)
+{
+    size_t                             size;
+    ngx_buf_t                         *b;
+    ngx_uint_t                         i, j;
+    ngx_chain_t                       *cl;
+    ngx_http_status_node_t            *node;
+    ngx_http_status_zone_t            *zone;
+    ngx_http_stub_status_main_conf_t  *smcf;
+#if (NGX_HTTP_CACHE)
+    off_t                              csize, tier_size, max_size;
+    ngx_str_t                         *name;
+    ngx_uint_t                         count, n;
+    ngx_path_t                       **path;
+    ngx_http_file_cache_t             *cache, *shard;
+#endif
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_stub_status_module);
+
+    zone = smcf->zones.elts;
+
+    size = sizeof("\"server_zones\":{},\"caches\":{},\"upstreams\":{") - 1;
+
+    for (i = 0; i < smcf->zones.nelts; i++) {
+        size += sizeof("\"\":{\"requests\":,\"responses\":{\"1xx\":,"
+                       "\"2xx\":,\"3xx\":,\"4xx\":,\"5xx\":,\"total\":},"
+                       "\"received\":,\"sent\":},") - 1
+                + zone[i].name.len
+                + ngx_escape_json(NULL, zone[i].name.data, zone[i].name.len)
+                + 9 * NGX_ATOMIC_T_LEN;
+    }
+
+#if (NGX_HTTP_CACHE)
+
+    path = ngx_cycle->paths.elts;
+
+    for (i = 0; i < ngx_cycle->paths.nelts; i++) {
+        cache = ngx_http_file_cache_path_cache(path[i]);
+
+        if (cache == NULL) {
+            continue;
+        }
+
+        name = &cache->shm_zone->shm.name;
+
+        size += sizeof("\"\":{\"size\":,\"tier_size\":,\"max_size\":,"
+                       "\"entries\":,\"cold\":false,\"manager\":{"
+                       "\"backlog\":,\"unlink_time\":,\"deleted\":}},") - 1
+                + name->len + ngx_escape_json(NULL, name->data, name->len)
+                + 3 * NGX_OFF_T_LEN + 4 * NGX_INT_T_LEN;
+    }
+
+#endif
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->last = ngx_cpymem(b->last, "\"server_zones\":{",
+                         sizeof("\"server_zones\":{") - 1);
+
+    for (i = 0; i < smcf->zones.nelts; i++) {
+        node = zone[i].node;
+
+        if (i) {
+            *b->last++ = ',';
+        }
+
+        b->last = ngx_http_stub_status_json_str(b->last, &zone[i].name);
+
+        b->last = ngx_sprintf(b->last, ":{\"requests\":%uA,\"responses\":{",
+                              node->requests);
+
+        for (j = 0; j < 5; j++) {
+            b->last = ngx_sprintf(b->last, "\"%uixx\":%uA,",
+                                  j + 1, node->responses[j]);
+        }
+
+        b->last = ngx_sprintf(b->last, "\"total\":%uA},\"received\":%uA,"
+                              "\"sent\":%uA}",
+                              node->responses[0] + node->responses[1]
+                              + node->responses[2] + node->responses[3]
+                              + node->responses[4],
+                              node->received, node->sent);
+    }
+
+    b->last = ngx_cpymem(b->last, "},\"caches\":{",
+                         sizeof("},\"caches\":{") - 1);
+
+#if (NGX_HTTP_CACHE)
+
+    for (i = 0, j = 0; i < ngx_cycle->paths.nelts; i++) {
+        cache = ngx_http_file_cache_path_cache(path[i]);
+
+        if (cache == NULL) {
+            continue;
+        }
+
+        if (j++) {
+            *b->last++ = ',';
+        }
+
+        csize = 0;
+        tier_size = 0;
+        count = 0;
+        max_size = 0;
+
+        for (n = 0; n < (cache->shards ? cache->nshards : 1); n++) {
+            shard = cache->shards ? cache->shards[n] : cache;
+
+            csize += shard->sh->size * shard->bsize;
+            tier_size += shard->sh->tier_size * shard->bsize;
+            count += shard->sh->count;
+            max_size += shard->max_size * shard->bsize;
+        }
+
+        b->last = ngx_http_stub_status_json_str(b->last,
+                                                &cache->shm_zone->shm.name);
+
+        b->last = ngx_sprintf(b->last, ":{\"size\":%O,\"tier_size\":%O,"
+                              "\"max_size\":%O,\"entries\":%ui,\"cold\":%s,"
+                              "\"manager\":{\"backlog\":%ui,"
+                              "\"unlink_time\":%ui,\"deleted\":%ui}}",
+                              csize, tier_size, max_size, count,
+                              cache->sh->cold ? "true" : "false",
+                              cache->sh->manager_backlog,
+                              cache->sh->manager_unlink_time,
+                              cache->sh->manager_deleted);
+    }
+
+#endif
+
+    b->last = ngx_cpymem(b->last, "},\"upstreams\":{",
+                         sizeof("},\"upstreams\":{") - 1);
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NULL;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    return cl;
+}
+
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_chain_t *
+ngx_http_stub_status_json_upstream(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_uint_t last)
+{
+    size_t                         size;
+    ngx_buf_t                     *b;
+    ngx_uint_t                     n;
+    ngx_chain_t                   *cl;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers, *backup;
+
+    peers = uscf->peer.data;
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NULL;
+    }
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    size = sizeof("\"\":{\"peers\":[]},") - 1
+           + uscf->host.len
+           + ngx_escape_json(NULL, uscf->host.data, uscf->host.len);
+
+    for (backup = peers; backup; backup = backup->next) {
+        for (peer = backup->peer; peer; peer = peer->next) {
+            size += sizeof("{\"server\":\"\",\"name\":\"\","
+                           "\"backup\":false,\"state\":\"unhealthy\","
+                           "\"active\":,\"requests\":,\"responses\":{"
+                           "\"1xx\":,\"2xx\":,\"3xx\":,\"4xx\":,"
+                           "\"5xx\":,\"total\":},\"received\":,"
+                           "\"response_time\":,\"fails\":},") - 1
+                    + peer->server.len
+                    + ngx_escape_json(NULL, peer->server.data,
+                                      peer->server.len)
+                    + peer->name.len
+                    + ngx_escape_json(NULL, peer->name.data, peer->name.len)
+                    + NGX_INT_T_LEN + 10 * NGX_ATOMIC_T_LEN;
+        }
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return NULL;
+    }
+
+    b->last = ngx_http_stub_status_json_str(b->last, &uscf->host);
+    b->last = ngx_cpymem(b->last, ":{\"peers\":[",
+                         sizeof(":{\"peers\":[") - 1);
+
+    n = 0;
+
+    for (backup = peers; backup; backup = backup->next) {
+        for (peer = backup->peer; peer; peer = peer->next) {
+
+            if (peer->down & NGX_HTTP_UPSTREAM_RR_REMOVED) {
+                continue;
+            }
+
+            if (n++) {
+                *b->last++ = ',';
+            }
+
+            b->last = ngx_http_stub_status_json_peer(b->last, peer,
+                                                     backup != peers);
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    b->last = ngx_cpymem(b->last, "]}", 2);
+
+    if (!last) {
+        *b->last++ = ',';
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    return cl;
+}
+
+
+static u_char *
+ngx_http_stub_status_json_peer(u_char *p, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t backup)
+{
+    char                               *state;
+    ngx_uint_t                          j;
+    ngx_atomic_uint_t                   total;
+    ngx_http_upstream_rr_peer_stats_t  *stats;
+
+    stats = &peer->stats;
+
+    if (peer->down & NGX_HTTP_UPSTREAM_RR_UNHEALTHY) {
+        state = "unhealthy";
+
+    } else if (peer->down & NGX_HTTP_UPSTREAM_RR_DRAINING) {
+        state = "draining";
+
+    } else if (peer->down) {
+        state = "down";
+
+    } else if (peer->max_fails
+               && peer->fails >= peer->max_fails
+               && ngx_time() - peer->checked <= peer->fail_timeout)
+    {
+        state = "unavail";
+
+    } else {
+        state = "up";
+    }
+
+    p = ngx_cpymem(p, "{\"server\":", sizeof("{\"server\":") - 1);
+    p = ngx_http_stub_status_json_str(p, &peer->server);
+    p = ngx_cpymem(p, ",\"name\":", sizeof(",\"name\":") - 1);
+    p = ngx_http_stub_status_json_str(p, &peer->name);
+
+    p = ngx_sprintf(p, ",\"backup\":%s,\"state\":\"%s\",\"active\":%ui,"
+                    "\"requests\":%uA,\"responses\":{",
+                    backup ? "true" : "false", state, peer->conns,
+                    stats->requests);
+
+    total = 0;
+
+    for (j = 0; j < 5; j++) {
+        p = ngx_sprintf(p, "\"%uixx\":%uA,", j + 1, stats->responses[j]);
+        total += stats->responses[j];
+    }
+
+    return ngx_sprintf(p, "\"total\":%uA},\"received\":%uA,"
+                       "\"response_time\":%uA,\"fails\":%uA}",
+                       total, stats->received, stats->response_time,
+                       stats->fails);
+}
+
+#endif
+
+
+static u_char *
+ngx_http_stub_status_json_str(u_char *p, ngx_str_t *str)
+{
+    *p++ = '"';
+    p = (u_char *) ngx_escape_json(p, str->data, str->len);
+    *p++ = '"';
+
+    return p;
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_log_handler(ngx_http_request_t *r)
+{
+    ngx_uint_t                          n;
+    ngx_http_status_node_t             *node;
+    ngx_http_status_zone_t             *zone;
+    ngx_http_stub_status_srv_conf_t    *sscf;
+    ngx_http_stub_status_main_conf_t   *smcf;
+
+    sscf = ngx_http_get_module_srv_conf(r, ngx_http_stub_status_module);
+
+    if (sscf->zone != NGX_CONF_UNSET_UINT) {
+        smcf = ngx_http_get_module_main_conf(r, ngx_http_stub_status_module);
+
+        zone = smcf->zones.elts;
+        node = zone[sscf->zone].node;
+
+        (void) ngx_atomic_fetch_add(&node->requests, 1);
+
+        if (r->err_status) {
+            n = ngx_http_stub_status_class(r->err_status);
+
+        } else {
+            n = ngx_http_stub_status_class(r->headers_out.status);
+        }
+
+        if (n) {
+            (void) ngx_atomic_fetch_add(&node->responses[n - 1], 1);
+        }
+
+        (void) ngx_atomic_fetch_add(&node->received, r->request_length);
+        (void) ngx_atomic_fetch_add(&node->sent, r->connection->sent);
+    }
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_stub_status_module);
+
+    if (smcf->json) {
+        ngx_http_stub_status_log_upstream(r);
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static void
+ngx_http_stub_status_log_upstream(ngx_http_request_t *r)
+{
+    u_char                             *p;
+    ngx_uint_t                          i, n;
+    ngx_slab_pool_t                    *shpool;
+    ngx_http_upstream_t                *u;
+    ngx_http_upstream_state_t          *state;
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_rr_peer_stats_t  *stats;
+
+    u = r->upstream;
+
+    if (u == NULL
+        || u->upstream == NULL
+        || u->upstream->shm_zone == NULL
+        || r->upstream_states == NULL)
+    {
+        return;
+    }
+
+    peers = u->upstream->peer.data;
+    shpool = peers->shpool;
+    state = r->upstream_states->elts;
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    for (i = 0; i < r->upstream_states->nelts; i++) {
+
+        /*
+         * the state of each try references the name of the peer chosen,
+         * which is embedded in the peer; names outside of the zone belong
+         * to peers not balanced by round robin
+         */
+
+        p = (u_char *) state[i].peer;
+
+        if (p == NULL || p < (u_char *) shpool || p >= shpool->end) {
+            continue;
+        }
+
+        peer = (ngx_http_upstream_rr_peer_t *)
+                   (p - offsetof(ngx_http_upstream_rr_peer_t, name));
+
+        stats = &peer->stats;
+
+        (void) ngx_atomic_fetch_add(&stats->requests, 1);
+
+        n = ngx_http_stub_status_class(state[i].status);
+
+        if (n) {
+            (void) ngx_atomic_fetch_add(&stats->responses[n - 1], 1);
+        }
+
+        (void) ngx_atomic_fetch_add(&stats->received,
+                                    state[i].bytes_received);
+        (void) ngx_atomic_fetch_add(&stats->response_time,
+                                    state[i].response_time);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+}
+
+#endif
+
+
+static ngx_uint_t
+ngx_http_stub_status_class(ngx_uint_t status)
+{
+    if (status < 100 || status > 599) {
+        return 0;
+    }
+
+    return status / 100;
+}
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_thread_pool_status_handler(ngx_http_request_t *r)
+{
+    size_t                    size;
+    ngx_int_t                 rc;
+    ngx_buf_t                *b;
+    ngx_uint_t                i;
+    ngx_chain_t               out;
+    ngx_cycle_t              *cycle;
+    ngx_thread_pool_t        *tp;
+    ngx_thread_pool_stats_t   stats;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    cycle = (ngx_cycle_t *) ngx_cycle;
+
+    size = 0;
+
+    for (i = 0; (tp = ngx_thread_pool_at(cycle, i)); i++) {
+        ngx_thread_pool_stats(tp, &stats);
+
+        size += sizeof("Thread pool \"\" threads:  idle: \n") - 1
+                + stats.name.len + 2 * NGX_INT_T_LEN
+                + sizeof("submitted completed rejected waiting\n") - 1
+                + sizeof("    \n") - 1 + 4 * NGX_ATOMIC_T_LEN
+                + 2 * (sizeof("Wait usec:  log2:\n") - 1 + NGX_ATOMIC_T_LEN
+                       + NGX_THREAD_POOL_HIST_LEN * (1 + NGX_ATOMIC_T_LEN));
+    }
+
+    if (size == 0) {
+        size = 1;
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    for (i = 0; (tp = ngx_thread_pool_at(cycle, i)); i++) {
+        ngx_thread_pool_stats(tp, &stats);
+
+        b->last = ngx_sprintf(b->last,
+                              "Thread pool \"%V\" threads: %ui idle: %ui\n",
+                              &stats.name, stats.threads, stats.idle);
+
+        b->last = ngx_cpymem(b->last,
+                             "submitted completed rejected waiting\n",
+                             sizeof("submitted completed rejected waiting\n")
+                             - 1);
+
+        b->last = ngx_sprintf(b->last, " %uA %uA %uA %uA \n",
+                              stats.submitted, stats.completed,
+                              stats.rejected, stats.waiting);
+
+        b->last = ngx_http_thread_pool_status_hist(b->last,
+                                                   (u_char *) "Wait",
+                                                   stats.wait_time,
+                                                   stats.wait_hist);
+
+        b->last = ngx_http_thread_pool_status_hist(b->last,
+                                                   (u_char *) "Run",
+                                                   stats.run_time,
+                                                   stats.run_hist);
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static u_char *
+ngx_http_thread_pool_status_hist(u_char *p, u_char *name,
+    ngx_atomic_uint_t total, ngx_atomic_uint_t *hist)
+{
+    ngx_uint_t  i;
+
+    p = ngx_sprintf(p, "%s usec: %uA log2:", name, total);
+
+    for (i = 0; i < NGX_THREAD_POOL_HIST_LEN; i++) {
+        p = ngx_sprintf(p, " %uA", hist[i]);
+    }
+
+    *p++ = LF;
+
+    return p;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -227,10 +1011,267 @@ ngx_http_stub_status_add_variables(ngx_conf_t *cf)
 static char *
 ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_str_t                         *value;
+    ngx_http_core_loc_conf_t          *clcf;
+    ngx_http_stub_status_main_conf_t  *smcf;
 
     clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
     clcf->handler = ngx_http_stub_status_handler;
 
+    value = cf->args->elts;
+
+    /* any other parameter is ignored for compatibility */
+
+    if (cf->args->nelts == 2
+        && value[1].len == 4
+        && ngx_strncmp(value[1].data, "json", 4) == 0)
+    {
+        clcf->handler = ngx_http_stub_status_json_handler;
+
+        smcf = ngx_http_conf_get_module_main_conf(cf,
+                                                  ngx_http_stub_status_module);
+        smcf->json = 1;
+    }
+
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_http_status_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_stub_status_srv_conf_t *sscf = conf;
+
+    ngx_str_t                         *value;
+    ngx_uint_t                         i;
+    ngx_http_status_zone_t            *zone;
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    if (sscf->zone != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_stub_status_module);
+
+    zone = smcf->zones.elts;
+
+    /* servers with the same zone name share the counters */
+
+    for (i = 0; i < smcf->zones.nelts; i++) {
+        if (zone[i].name.len == value[1].len
+            && ngx_strncmp(zone[i].name.data, value[1].data, value[1].len)
+               == 0)
+        {
+            sscf->zone = i;
+            return NGX_CONF_OK;
+        }
+    }
+
+    zone = ngx_array_push(&smcf->zones);
+    if (zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    zone->name = value[1];
+    zone->node = NULL;
+
+    sscf->zone = smcf->zones.nelts - 1;
+
+    return NGX_CONF_OK;
+}
+
+
+static void *
+ngx_http_stub_status_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    smcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_stub_status_main_conf_t));
+    if (smcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     smcf->json = 0;
+     *     smcf->sh = NULL;
+     *     smcf->shpool = NULL;
+     */
+
+    if (ngx_array_init(&smcf->zones, cf->pool, 4,
+                       sizeof(ngx_http_status_zone_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return smcf;
+}
+
+
+static char *
+ngx_http_stub_status_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_stub_status_main_conf_t *smcf = conf;
+
+    size_t           size;
+    ngx_str_t        name;
+    ngx_shm_zone_t  *shm_zone;
+
+    if (smcf->zones.nelts == 0) {
+        return NGX_CONF_OK;
+    }
+
+    /* the zone is reused on reload while the number of zones is the same */
+
+    size = 8 * ngx_pagesize
+           + ngx_align(smcf->zones.nelts * 256, ngx_pagesize);
+
+    ngx_str_set(&name, "ngx_http_status_zone");
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_stub_status_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_stub_status_init_zone;
+    shm_zone->data = smcf;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_stub_status_main_conf_t  *osmcf = data;
+
+    size_t                             len;
+    ngx_uint_t                         i;
+    ngx_http_status_node_t            *node;
+    ngx_http_status_zone_t            *zone;
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    smcf = shm_zone->data;
+
+    smcf->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (osmcf) {
+        smcf->sh = osmcf->sh;
+
+    } else if (shm_zone->shm.exists) {
+        smcf->sh = smcf->shpool->data;
+
+    } else {
+        smcf->sh = ngx_slab_calloc(smcf->shpool,
+                                   sizeof(ngx_http_status_shctx_t));
+        if (smcf->sh == NULL) {
+            return NGX_ERROR;
+        }
+
+        smcf->shpool->data = smcf->sh;
+    }
+
+    zone = smcf->zones.elts;
+
+    for (i = 0; i < smcf->zones.nelts; i++) {
+
+        for (node = smcf->sh->nodes; node; node = node->next) {
+            if (node->name.len == zone[i].name.len
+                && ngx_strncmp(node->name.data, zone[i].name.data,
+                               zone[i].name.len)
+                   == 0)
+            {
+                break;
+            }
+        }
+
+        if (node == NULL) {
+            len = sizeof(ngx_http_status_node_t) + zone[i].name.len;
+
+            node = ngx_slab_calloc(smcf->shpool, len);
+            if (node == NULL) {
+                ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                              "could not allocate status zone \"%V\"",
+                              &zone[i].name);
+                return NGX_ERROR;
+            }
+
+            node->name.len = zone[i].name.len;
+            node->name.data = (u_char *) (node + 1);
+            ngx_memcpy(node->name.data, zone[i].name.data, zone[i].name.len);
+
+            node->next = smcf->sh->nodes;
+            smcf->sh->nodes = node;
+        }
+
+        zone[i].node = node;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_stub_status_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_stub_status_srv_conf_t  *sscf;
+
+    sscf = ngx_palloc(cf->pool, sizeof(ngx_http_stub_status_srv_conf_t));
+    if (sscf == NULL) {
+        return NULL;
+    }
+
+    sscf->zone = NGX_CONF_UNSET_UINT;
+
+    return sscf;
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_init(ngx_conf_t *cf)
+{
+    ngx_http_handler_pt               *h;
+    ngx_http_core_main_conf_t         *cmcf;
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_stub_status_module);
+
+    /* requests are only accounted if there is a zone or a json report */
+
+    if (smcf->zones.nelts == 0 && !smcf->json) {
+        return NGX_OK;
+    }
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_stub_status_log_handler;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_THREADS)
+
+static char *
+ngx_http_set_thread_pool_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_thread_pool_status_handler;
+
+    return NGX_CONF_OK;
+}
+
+#endif
@@ -0,0 +1,692 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    ngx_str_t                       upstream;
+    ngx_addr_t                      addr;
+
+    ngx_int_t                       weight;
+    ngx_int_t                       max_conns;
+    ngx_int_t                       max_fails;
+    time_t                          fail_timeout;
+    ngx_msec_t                      slow_start;
+
+    unsigned                        add:1;
+    unsigned                        remove:1;
+    unsigned                        drain:1;
+    unsigned                        up:1;
+    unsigned                        down:1;
+    unsigned                        backup:1;
+    unsigned                        server:1;
+} ngx_http_upstream_conf_op_t;
+
+
+static ngx_int_t ngx_http_upstream_conf_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_upstream_conf_local(ngx_http_request_t *r);
+static ngx_int_t ngx_http_upstream_conf_parse(ngx_http_request_t *r,
+    ngx_http_upstream_conf_op_t *op);
+static ngx_int_t ngx_http_upstream_conf_parse_number(ngx_http_request_t *r,
+    char *name, ngx_int_t *n);
+static ngx_int_t ngx_http_upstream_conf_parse_time(ngx_http_request_t *r,
+    char *name, ngx_uint_t is_sec, ngx_int_t *t);
+static ngx_http_upstream_srv_conf_t *ngx_http_upstream_conf_find_upstream(
+    ngx_http_request_t *r, ngx_str_t *name);
+static ngx_http_upstream_rr_peer_t *ngx_http_upstream_conf_find_peer(
+    ngx_http_upstream_rr_peers_t *peers, ngx_addr_t *addr,
+    ngx_http_upstream_rr_peers_t **list);
+static ngx_int_t ngx_http_upstream_conf_add(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_conf_op_t *op);
+static ngx_int_t ngx_http_upstream_conf_modify(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_conf_op_t *op);
+static ngx_int_t ngx_http_upstream_conf_send(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers);
+
+static char *ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_conf_commands[] = {
+
+    { ngx_string("upstream_conf"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_conf,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_conf_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_conf_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_conf_module_ctx,    /* module context */
+    ngx_http_upstream_conf_commands,       /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_conf_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                      rc;
+    ngx_http_upstream_rr_peers_t  *peers;
+    ngx_http_upstream_srv_conf_t  *uscf;
+    ngx_http_upstream_conf_op_t    op;
+
+    rc = ngx_http_upstream_conf_local(r);
+
+    if (rc == NGX_ERROR) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (rc == NGX_DECLINED) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "upstream configuration is only available "
+                      "on loopback addresses");
+        return NGX_HTTP_FORBIDDEN;
+    }
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD|NGX_HTTP_POST))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    rc = ngx_http_upstream_conf_parse(r, &op);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    /* the servers are only changed by POST requests */
+
+    if ((op.add || op.server) && r->method != NGX_HTTP_POST) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "upstream servers can only be changed by POST");
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    uscf = ngx_http_upstream_conf_find_upstream(r, &op.upstream);
+
+    if (uscf == NULL) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "upstream \"%V\" not found in a shared memory zone",
+                      &op.upstream);
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    peers = uscf->peer.data;
+
+    if (op.add) {
+        if (!op.server) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        rc = ngx_http_upstream_conf_add(r, peers, &op);
+
+    } else if (op.server) {
+        rc = ngx_http_upstream_conf_modify(r, peers, &op);
+
+    } else if (op.remove || op.drain || op.up || op.down
+               || op.weight != NGX_CONF_UNSET)
+    {
+        return NGX_HTTP_BAD_REQUEST;
+
+    } else {
+        rc = NGX_OK;
+    }
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    return ngx_http_upstream_conf_send(r, peers);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_local(ngx_http_request_t *r)
+{
+    struct sockaddr      *sa;
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
+
+    /*
+     * the address a request was received on is checked, as
+     * the client address may be changed by the realip module
+     */
+
+    if (ngx_connection_local_sockaddr(r->connection, NULL, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    sa = r->connection->local_sockaddr;
+
+    switch (sa->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) sa;
+
+        if (IN6_IS_ADDR_LOOPBACK(&sin6->sin6_addr)) {
+            return NGX_OK;
+        }
+
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)
+            && sin6->sin6_addr.s6_addr[12] == 127)
+        {
+            return NGX_OK;
+        }
+
+        return NGX_DECLINED;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        return NGX_OK;
+#endif
+
+    case AF_INET:
+        sin = (struct sockaddr_in *) sa;
+
+        if ((ntohl(sin->sin_addr.s_addr) >> 24) == 127) {
+            return NGX_OK;
+        }
+
+        return NGX_DECLINED;
+
+    default:
+        return NGX_DECLINED;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_parse(ngx_http_request_t *r,
+    ngx_http_upstream_conf_op_t *op)
+{
+    u_char     *dst, *src;
+    ngx_int_t   rc, n;
+    ngx_str_t   value;
+
+    ngx_memzero(op, sizeof(ngx_http_upstream_conf_op_t));
+
+    op->weight = NGX_CONF_UNSET;
+    op->max_conns = NGX_CONF_UNSET;
+    op->max_fails = NGX_CONF_UNSET;
+    op->fail_timeout = NGX_CONF_UNSET;
+    op->slow_start = NGX_CONF_UNSET_MSEC;
+
+    if (ngx_http_arg(r, (u_char *) "upstream", 8, &op->upstream) != NGX_OK
+        || op->upstream.len == 0)
+    {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "no upstream specified");
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    op->add = (ngx_http_arg(r, (u_char *) "add", 3, &value) == NGX_OK);
+    op->remove = (ngx_http_arg(r, (u_char *) "remove", 6, &value) == NGX_OK);
+    op->drain = (ngx_http_arg(r, (u_char *) "drain", 5, &value) == NGX_OK);
+    op->up = (ngx_http_arg(r, (u_char *) "up", 2, &value) == NGX_OK);
+    op->down = (ngx_http_arg(r, (u_char *) "down", 4, &value) == NGX_OK);
+    op->backup = (ngx_http_arg(r, (u_char *) "backup", 6, &value) == NGX_OK);
+
+    if (op->add + op->remove + op->drain + op->up + (op->down && !op->add)
+        > 1)
+    {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "conflicting upstream operations");
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "server", 6, &value) == NGX_OK) {
+
+        /* "[::1]:80" may come escaped */
+
+        dst = ngx_pnalloc(r->pool, value.len);
+        if (dst == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        src = value.data;
+        value.data = dst;
+
+        ngx_unescape_uri(&dst, &src, value.len, 0);
+
+        value.len = dst - value.data;
+
+        rc = ngx_parse_addr_port(r->pool, &op->addr, value.data, value.len);
+
+        if (rc != NGX_OK) {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "invalid server address \"%V\"", &value);
+            return rc == NGX_ERROR ? NGX_HTTP_INTERNAL_SERVER_ERROR
+                                   : NGX_HTTP_BAD_REQUEST;
+        }
+
+        if (ngx_inet_get_port(op->addr.sockaddr) == 0) {
+            ngx_inet_set_port(op->addr.sockaddr, 80);
+        }
+
+        op->server = 1;
+    }
+
+    if (ngx_http_upstream_conf_parse_number(r, "weight", &op->weight)
+        != NGX_OK
+        || op->weight == 0
+        || ngx_http_upstream_conf_parse_number(r, "max_conns", &op->max_conns)
+           != NGX_OK
+        || ngx_http_upstream_conf_parse_number(r, "max_fails", &op->max_fails)
+           != NGX_OK
+        || ngx_http_upstream_conf_parse_time(r, "fail_timeout", 1, &n)
+           != NGX_OK)
+    {
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    op->fail_timeout = n;
+
+    if (ngx_http_upstream_conf_parse_time(r, "slow_start", 0, &n) != NGX_OK) {
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    op->slow_start = (n == NGX_CONF_UNSET) ? NGX_CONF_UNSET_MSEC
+                                           : (ngx_msec_t) n;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_parse_number(ngx_http_request_t *r, char *name,
+    ngx_int_t *n)
+{
+    ngx_str_t  value;
+
+    if (ngx_http_arg(r, (u_char *) name, ngx_strlen(name), &value) != NGX_OK) {
+        return NGX_OK;
+    }
+
+    *n = ngx_atoi(value.data, value.len);
+
+    if (*n == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "invalid \"%s\" value \"%V\"", name, &value);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_parse_time(ngx_http_request_t *r, char *name,
+    ngx_uint_t is_sec, ngx_int_t *t)
+{
+    ngx_str_t  value;
+
+    *t = NGX_CONF_UNSET;
+
+    if (ngx_http_arg(r, (u_char *) name, ngx_strlen(name), &value) != NGX_OK) {
+        return NGX_OK;
+    }
+
+    *t = ngx_parse_time(&value, is_sec);
+
+    if (*t == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "invalid \"%s\" value \"%V\"", name, &value);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_http_upstream_srv_conf_t *
+ngx_http_upstream_conf_find_upstream(ngx_http_request_t *r, ngx_str_t *name)
+{
+    ngx_uint_t                      i;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->shm_zone == NULL
+            || !(uscfp[i]->flags & NGX_HTTP_UPSTREAM_CREATE)
+            || uscfp[i]->host.len != name->len
+            || ngx_strncasecmp(uscfp[i]->host.data, name->data, name->len)
+               != 0)
+        {
+            continue;
+        }
+
+        return uscfp[i];
+    }
+
+    return NULL;
+}
+
+
+static ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_conf_find_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_addr_t *addr, ngx_http_upstream_rr_peers_t **list)
+{
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *backup;
+
+    for (backup = peers; backup; backup = backup->next) {
+        for (peer = backup->peer; peer; peer = peer->next) {
+
+            if (peer->down & NGX_HTTP_UPSTREAM_RR_REMOVED) {
+                continue;
+            }
+
+            if (ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                 addr->sockaddr, addr->socklen, 1)
+                == NGX_OK)
+            {
+                if (list) {
+                    *list = backup;
+                }
+
+                return peer;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_add(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_conf_op_t *op)
+{
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    if (ngx_http_upstream_conf_find_peer(peers, &op->addr, NULL)) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return NGX_HTTP_CONFLICT;
+    }
+
+    peer = ngx_http_upstream_zone_add_peer(peers, op->backup,
+                                           op->addr.sockaddr,
+                                           op->addr.socklen, NULL);
+    if (peer == NULL) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "could not allocate server in upstream \"%V\"",
+                      peers->name);
+
+        return NGX_HTTP_INSUFFICIENT_STORAGE;
+    }
+
+    peer->weight = (op->weight == NGX_CONF_UNSET) ? 1 : op->weight;
+    peer->effective_weight = peer->weight;
+
+    peer->max_conns = (op->max_conns == NGX_CONF_UNSET) ? 0 : op->max_conns;
+    peer->max_fails = (op->max_fails == NGX_CONF_UNSET) ? 1 : op->max_fails;
+    peer->fail_timeout = (op->fail_timeout == NGX_CONF_UNSET)
+                         ? 10 : op->fail_timeout;
+    peer->slow_start = (op->slow_start == NGX_CONF_UNSET_MSEC)
+                       ? 0 : op->slow_start;
+
+    peer->start_time = peer->slow_start ? ngx_current_msec : 0;
+
+    peer->down = op->down ? NGX_HTTP_UPSTREAM_RR_DOWN : 0;
+
+    ngx_http_upstream_zone_update_weights(peers);
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                  "upstream server %V added to upstream \"%V\"",
+                  &peer->name, peers->name);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_modify(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_conf_op_t *op)
+{
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    peer = ngx_http_upstream_conf_find_peer(peers, &op->addr, &list);
+
+    if (peer == NULL) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    if (op->remove) {
+
+        /*
+         * the peer stays in the list, as its index is used by requests,
+         * but its weight is no longer counted in total
+         */
+
+        peer->down |= NGX_HTTP_UPSTREAM_RR_REMOVED;
+
+        ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                      "upstream server %V removed from upstream \"%V\"",
+                      &peer->name, peers->name);
+    }
+
+    if (op->drain) {
+        peer->down |= NGX_HTTP_UPSTREAM_RR_DRAINING;
+    }
+
+    if (op->down) {
+        peer->down |= NGX_HTTP_UPSTREAM_RR_DOWN;
+    }
+
+    if (op->up) {
+        peer->down &= ~(NGX_HTTP_UPSTREAM_RR_DOWN
+                        |NGX_HTTP_UPSTREAM_RR_DRAINING);
+
+        if (peer->slow_start) {
+            peer->start_time = ngx_current_msec;
+        }
+    }
+
+    if (op->weight != NGX_CONF_UNSET) {
+        peer->weight = op->weight;
+        peer->effective_weight = op->weight;
+        peer->current_weight = 0;
+    }
+
+    if (op->max_conns != NGX_CONF_UNSET) {
+        peer->max_conns = op->max_conns;
+    }
+
+    if (op->max_fails != NGX_CONF_UNSET) {
+        peer->max_fails = op->max_fails;
+    }
+
+    if (op->fail_timeout != NGX_CONF_UNSET) {
+        peer->fail_timeout = op->fail_timeout;
+    }
+
+    if (op->slow_start != NGX_CONF_UNSET_MSEC) {
+        peer->slow_start = op->slow_start;
+    }
+
+    ngx_http_upstream_zone_update_weights(peers);
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_send(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    size_t                         size;
+    ngx_int_t                      rc;
+    ngx_buf_t                     *b;
+    ngx_chain_t                    out;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    size = 0;
+
+    for (list = peers; list; list = list->next) {
+        for (peer = list->peer; peer; peer = peer->next) {
+            size += sizeof("server  weight= max_conns= max_fails="
+                           " fail_timeout=s slow_start=ms"
+                           " backup down drain;" CRLF) - 1
+                    + peer->name.len + 5 * NGX_INT_T_LEN;
+        }
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    for (list = peers; list; list = list->next) {
+        for (peer = list->peer; peer; peer = peer->next) {
+
+            if (peer->down & NGX_HTTP_UPSTREAM_RR_REMOVED) {
+                continue;
+            }
+
+            b->last = ngx_sprintf(b->last, "server %V weight=%i",
+                                  &peer->name, peer->weight);
+
+            if (peer->max_conns) {
+                b->last = ngx_sprintf(b->last, " max_conns=%ui",
+                                      peer->max_conns);
+            }
+
+            b->last = ngx_sprintf(b->last, " max_fails=%ui fail_timeout=%Ts",
+                                  peer->max_fails, peer->fail_timeout);
+
+            if (peer->slow_start) {
+                b->last = ngx_sprintf(b->last, " slow_start=%Mms",
+                                      peer->slow_start);
+            }
+
+            if (list != peers) {
+                b->last = ngx_cpymem(b->last, " backup", 7);
+            }
+
+            if (peer->down & NGX_HTTP_UPSTREAM_RR_DOWN) {
+                b->last = ngx_cpymem(b->last, " down", 5);
+            }
+
+            if (peer->down & NGX_HTTP_UPSTREAM_RR_DRAINING) {
+                b->last = ngx_cpymem(b->last, " drain", 6);
+            }
+
+            *b->last++ = ';';
+            *b->last++ = CR; *b->last++ = LF;
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    if (b->last == b->pos) {
+        b->sync = 1;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static char *
+ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_upstream_conf_handler;
+
+    return NGX_CONF_OK;
+}
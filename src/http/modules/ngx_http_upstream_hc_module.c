@@ -0,0 +1,848 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_HC_BUFFER_SIZE  256
+
+
+typedef struct {
+    ngx_msec_t                       interval;
+    ngx_msec_t                       timeout;
+    ngx_uint_t                       fails;
+    ngx_uint_t                       passes;
+    in_port_t                        port;
+    ngx_uint_t                       status_min;
+    ngx_uint_t                       status_max;
+    ngx_str_t                        uri;
+    ngx_str_t                        request;
+
+    ngx_event_t                      event;
+
+    ngx_http_upstream_srv_conf_t    *upstream;
+} ngx_http_upstream_hc_srv_conf_t;
+
+
+typedef struct {
+    ngx_array_t                      checks;
+                                  /* ngx_http_upstream_hc_srv_conf_t * */
+} ngx_http_upstream_hc_main_conf_t;
+
+
+typedef struct {
+    ngx_http_upstream_hc_srv_conf_t *conf;
+    ngx_http_upstream_rr_peer_t     *peer;
+    ngx_msec_t                       start;
+
+    ngx_peer_connection_t            pc;
+    ngx_sockaddr_t                   sockaddr;
+    ngx_str_t                        name;
+    u_char                           addr[NGX_SOCKADDR_STRLEN];
+
+    size_t                           sent;
+    u_char                          *last;
+    u_char                           buffer[NGX_HTTP_UPSTREAM_HC_BUFFER_SIZE];
+} ngx_http_upstream_hc_probe_t;
+
+
+static void ngx_http_upstream_hc_handler(ngx_event_t *ev);
+static void ngx_http_upstream_hc_connect(ngx_http_upstream_hc_probe_t *probe,
+    ngx_log_t *log);
+static void ngx_http_upstream_hc_send_handler(ngx_event_t *wev);
+static void ngx_http_upstream_hc_recv_handler(ngx_event_t *rev);
+static ngx_int_t ngx_http_upstream_hc_parse(
+    ngx_http_upstream_hc_probe_t *probe);
+static void ngx_http_upstream_hc_finalize(ngx_http_upstream_hc_probe_t *probe,
+    ngx_uint_t ok);
+static void ngx_http_upstream_hc_update(ngx_http_upstream_hc_srv_conf_t *hcf,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t ok, ngx_log_t *log);
+static void ngx_http_upstream_hc_dummy_handler(ngx_event_t *ev);
+
+static char *ngx_http_upstream_hc(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static void *ngx_http_upstream_hc_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_hc_init_main_conf(ngx_conf_t *cf, void *conf);
+static void *ngx_http_upstream_hc_create_srv_conf(ngx_conf_t *cf);
+static ngx_int_t ngx_http_upstream_hc_init_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_upstream_hc_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_hc,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_hc_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_http_upstream_hc_create_main_conf, /* create main configuration */
+    ngx_http_upstream_hc_init_main_conf,   /* init main configuration */
+
+    ngx_http_upstream_hc_create_srv_conf,  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_hc_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_hc_module_ctx,      /* module context */
+    ngx_http_upstream_hc_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_hc_init_process,     /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static void
+ngx_http_upstream_hc_handler(ngx_event_t *ev)
+{
+    ngx_uint_t                        i, n;
+    ngx_http_upstream_hc_probe_t    **probes;
+    ngx_http_upstream_rr_peer_t      *peer;
+    ngx_http_upstream_rr_peers_t     *peers, *backup;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    hcf = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "health check of upstream \"%V\"", &hcf->upstream->host);
+
+    peers = hcf->upstream->peer.data;
+
+    /*
+     * the probes are started after the peers are unlocked, as a probe
+     * may complete immediately and update its peer under the write lock
+     */
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    n = 0;
+
+    for (backup = peers; backup; backup = backup->next) {
+        n += backup->number;
+    }
+
+    probes = ngx_alloc(n * sizeof(ngx_http_upstream_hc_probe_t *), ev->log);
+    if (probes == NULL) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        goto next;
+    }
+
+    n = 0;
+
+    for (backup = peers; backup; backup = backup->next) {
+        for (peer = backup->peer; peer; peer = peer->next) {
+
+            if (peer->down & ~NGX_HTTP_UPSTREAM_RR_UNHEALTHY) {
+                continue;
+            }
+
+            /*
+             * a probe takes at most two timeouts; the mark of a probe
+             * which was lost, e.g. with an exited worker, expires then
+             */
+
+            if (peer->hc_checking
+                && (ngx_msec_int_t) (ngx_current_msec - peer->hc_checking)
+                   < (ngx_msec_int_t) (2 * hcf->timeout))
+            {
+                continue;
+            }
+
+            probes[n] = ngx_calloc(sizeof(ngx_http_upstream_hc_probe_t),
+                                   ev->log);
+            if (probes[n] == NULL) {
+                break;
+            }
+
+            probes[n]->conf = hcf;
+            probes[n]->peer = peer;
+            probes[n]->start = ngx_current_msec;
+
+            ngx_memcpy(&probes[n]->sockaddr, peer->sockaddr, peer->socklen);
+
+            probes[n]->pc.sockaddr = &probes[n]->sockaddr.sockaddr;
+            probes[n]->pc.socklen = peer->socklen;
+
+            if (hcf->port) {
+                ngx_inet_set_port(probes[n]->pc.sockaddr, hcf->port);
+            }
+
+            peer->hc_checking = ngx_current_msec;
+
+            n++;
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    for (i = 0; i < n; i++) {
+        ngx_http_upstream_hc_connect(probes[i], ev->log);
+    }
+
+    ngx_free(probes);
+
+next:
+
+    ngx_add_timer(ev, hcf->interval);
+}
+
+
+static void
+ngx_http_upstream_hc_connect(ngx_http_upstream_hc_probe_t *probe,
+    ngx_log_t *log)
+{
+    ngx_int_t          rc;
+    ngx_connection_t  *c;
+
+    probe->name.data = probe->addr;
+    probe->name.len = ngx_sock_ntop(probe->pc.sockaddr, probe->pc.socklen,
+                                    probe->addr, NGX_SOCKADDR_STRLEN, 1);
+
+    probe->pc.name = &probe->name;
+    probe->pc.get = ngx_event_get_peer;
+    probe->pc.log = log;
+    probe->pc.log_error = NGX_ERROR_ERR;
+
+    rc = ngx_event_connect_peer(&probe->pc);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "health check connect to %V: %i", &probe->name, rc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_http_upstream_hc_finalize(probe, 0);
+        return;
+    }
+
+    c = probe->pc.connection;
+
+    c->data = probe;
+    c->log = log;
+    c->read->log = log;
+    c->write->log = log;
+
+    c->read->handler = ngx_http_upstream_hc_recv_handler;
+    c->write->handler = ngx_http_upstream_hc_send_handler;
+
+    /* the probe must not delay a graceful shutdown */
+
+    c->read->cancelable = 1;
+    c->write->cancelable = 1;
+
+    ngx_add_timer(c->write, probe->conf->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_hc_send_handler(c->write);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_send_handler(ngx_event_t *wev)
+{
+    ssize_t                        n;
+    ngx_str_t                     *request;
+    ngx_connection_t              *c;
+    ngx_http_upstream_hc_probe_t  *probe;
+
+    c = wev->data;
+    probe = c->data;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, wev->log, NGX_ETIMEDOUT,
+                      "health check of %V timed out", &probe->name);
+        ngx_http_upstream_hc_finalize(probe, 0);
+        return;
+    }
+
+    request = &probe->conf->request;
+
+    while (probe->sent < request->len) {
+
+        n = c->send(c, request->data + probe->sent,
+                    request->len - probe->sent);
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_hc_finalize(probe, 0);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_http_upstream_hc_finalize(probe, 0);
+            }
+
+            return;
+        }
+
+        probe->sent += n;
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    wev->handler = ngx_http_upstream_hc_dummy_handler;
+
+    probe->last = probe->buffer;
+
+    ngx_add_timer(c->read, probe->conf->timeout);
+
+    if (c->read->ready) {
+        ngx_http_upstream_hc_recv_handler(c->read);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_recv_handler(ngx_event_t *rev)
+{
+    ssize_t                        n;
+    ngx_int_t                      rc;
+    ngx_connection_t              *c;
+    ngx_http_upstream_hc_probe_t  *probe;
+
+    c = rev->data;
+    probe = c->data;
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, NGX_ETIMEDOUT,
+                      "health check of %V timed out", &probe->name);
+        ngx_http_upstream_hc_finalize(probe, 0);
+        return;
+    }
+
+    if (probe->last == NULL) {
+        /* the request is not sent yet */
+        return;
+    }
+
+    for ( ;; ) {
+        n = c->recv(c, probe->last,
+                    probe->buffer + NGX_HTTP_UPSTREAM_HC_BUFFER_SIZE
+                    - probe->last);
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_upstream_hc_finalize(probe, 0);
+            }
+
+            return;
+        }
+
+        if (n > 0) {
+            probe->last += n;
+        }
+
+        rc = ngx_http_upstream_hc_parse(probe);
+
+        if (rc != NGX_AGAIN) {
+            break;
+        }
+
+        if (n == NGX_ERROR || n == 0
+            || probe->last
+               == probe->buffer + NGX_HTTP_UPSTREAM_HC_BUFFER_SIZE)
+        {
+            rc = NGX_ERROR;
+            break;
+        }
+    }
+
+    if (rc == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                      "health check of %V: invalid response", &probe->name);
+    }
+
+    ngx_http_upstream_hc_finalize(probe, rc == NGX_OK);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_parse(ngx_http_upstream_hc_probe_t *probe)
+{
+    u_char      *p;
+    ngx_int_t    status;
+    ngx_uint_t   i;
+
+    /* "HTTP/1.x NNN" */
+
+    p = probe->buffer;
+
+    if (probe->last - p < 12) {
+        return NGX_AGAIN;
+    }
+
+    if (ngx_strncmp(p, "HTTP/", 5) != 0) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_strlchr(p + 5, probe->last, ' ');
+
+    if (p == NULL || probe->last - p < 4) {
+        return NGX_AGAIN;
+    }
+
+    p++;
+
+    for (i = 0; i < 3; i++) {
+        if (p[i] < '0' || p[i] > '9') {
+            return NGX_ERROR;
+        }
+    }
+
+    status = ngx_atoi(p, 3);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, probe->pc.log, 0,
+                   "health check of %V: status %i", &probe->name, status);
+
+    if ((ngx_uint_t) status < probe->conf->status_min
+        || (ngx_uint_t) status > probe->conf->status_max)
+    {
+        ngx_log_error(NGX_LOG_ERR, probe->pc.log, 0,
+                      "health check of %V: unexpected status %i",
+                      &probe->name, status);
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_hc_finalize(ngx_http_upstream_hc_probe_t *probe,
+    ngx_uint_t ok)
+{
+    ngx_log_t                     *log;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers, *backup;
+
+    log = probe->pc.log;
+
+    if (probe->pc.connection) {
+        ngx_close_connection(probe->pc.connection);
+        probe->pc.connection = NULL;
+    }
+
+    peers = probe->conf->upstream->peer.data;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    /*
+     * the peer is looked up as it may have been removed meanwhile;
+     * its slot may also have been reused for another server, or the
+     * mark of the probe expired, then the result is not applied
+     */
+
+    for (backup = peers; backup; backup = backup->next) {
+        for (peer = backup->peer; peer; peer = peer->next) {
+            if (peer == probe->peer) {
+                if (peer->hc_checking == probe->start) {
+                    ngx_http_upstream_hc_update(probe->conf, peer, ok, log);
+                }
+
+                goto done;
+            }
+        }
+    }
+
+done:
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    ngx_free(probe);
+}
+
+
+static void
+ngx_http_upstream_hc_update(ngx_http_upstream_hc_srv_conf_t *hcf,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t ok, ngx_log_t *log)
+{
+    peer->hc_checking = 0;
+
+    if (ok) {
+        peer->hc_fails = 0;
+
+        if (++peer->hc_passes >= hcf->passes
+            && (peer->down & NGX_HTTP_UPSTREAM_RR_UNHEALTHY))
+        {
+            peer->down &= ~NGX_HTTP_UPSTREAM_RR_UNHEALTHY;
+
+            /* the passive failures are forgotten as well */
+
+            peer->fails = 0;
+
+            if (peer->slow_start) {
+                peer->start_time = ngx_current_msec;
+            }
+
+            ngx_log_error(NGX_LOG_WARN, log, 0,
+                          "upstream server %V in upstream \"%V\" "
+                          "is healthy", &peer->name, &hcf->upstream->host);
+        }
+
+        return;
+    }
+
+    peer->hc_passes = 0;
+
+    if (++peer->hc_fails >= hcf->fails
+        && !(peer->down & NGX_HTTP_UPSTREAM_RR_UNHEALTHY))
+    {
+        peer->down |= NGX_HTTP_UPSTREAM_RR_UNHEALTHY;
+
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "upstream server %V in upstream \"%V\" "
+                      "is unhealthy", &peer->name, &hcf->upstream->host);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "health check dummy handler");
+}
+
+
+static char *
+ngx_http_upstream_hc(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_hc_srv_conf_t *hcf = conf;
+
+    u_char                             *p;
+    ngx_int_t                           n;
+    ngx_str_t                          *value, s;
+    ngx_uint_t                          i;
+    ngx_http_upstream_hc_srv_conf_t   **hcfp;
+    ngx_http_upstream_hc_main_conf_t   *hmcf;
+
+    if (hcf->upstream) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = &value[i].data[9];
+
+            hcf->interval = ngx_parse_time(&s, 0);
+
+            if (hcf->interval == (ngx_msec_t) NGX_ERROR
+                || hcf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            hcf->timeout = ngx_parse_time(&s, 0);
+
+            if (hcf->timeout == (ngx_msec_t) NGX_ERROR
+                || hcf->timeout == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "port=", 5) == 0) {
+
+            n = ngx_atoi(&value[i].data[5], value[i].len - 5);
+
+            if (n == NGX_ERROR || n < 1 || n > 65535) {
+                goto invalid;
+            }
+
+            hcf->port = (in_port_t) n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "uri=", 4) == 0) {
+
+            hcf->uri.len = value[i].len - 4;
+            hcf->uri.data = &value[i].data[4];
+
+            if (hcf->uri.len == 0 || hcf->uri.data[0] != '/') {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "status=", 7) == 0) {
+
+            s.len = value[i].len - 7;
+            s.data = &value[i].data[7];
+
+            p = ngx_strlchr(s.data, s.data + s.len, '-');
+
+            if (p == NULL) {
+                n = ngx_atoi(s.data, s.len);
+                hcf->status_min = n;
+                hcf->status_max = n;
+
+            } else {
+                n = ngx_atoi(s.data, p - s.data);
+                hcf->status_min = n;
+
+                n = ngx_atoi(p + 1, s.data + s.len - p - 1);
+                hcf->status_max = n;
+            }
+
+            if (hcf->status_min == (ngx_uint_t) NGX_ERROR
+                || hcf->status_max == (ngx_uint_t) NGX_ERROR
+                || hcf->status_min < 100
+                || hcf->status_max > 599
+                || hcf->status_min > hcf->status_max)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    hcf->upstream = ngx_http_conf_get_module_srv_conf(cf,
+                                                      ngx_http_upstream_module);
+
+    hmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_hc_module);
+
+    hcfp = ngx_array_push(&hmcf->checks);
+    if (hcfp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *hcfp = hcf;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static void *
+ngx_http_upstream_hc_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_hc_main_conf_t  *hmcf;
+
+    hmcf = ngx_palloc(cf->pool, sizeof(ngx_http_upstream_hc_main_conf_t));
+    if (hmcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&hmcf->checks, cf->pool, 4,
+                       sizeof(ngx_http_upstream_hc_srv_conf_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return hmcf;
+}
+
+
+static char *
+ngx_http_upstream_hc_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_upstream_hc_main_conf_t *hmcf = conf;
+
+    size_t                             len;
+    ngx_uint_t                         i;
+    ngx_http_upstream_srv_conf_t      *uscf;
+    ngx_http_upstream_hc_srv_conf_t  **hcfp, *hcf;
+
+    hcfp = hmcf->checks.elts;
+
+    for (i = 0; i < hmcf->checks.nelts; i++) {
+        hcf = hcfp[i];
+        uscf = hcf->upstream;
+
+        if (uscf->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "health check requires upstream \"%V\" "
+                          "in %s:%ui to reside in shared memory",
+                          &uscf->host, uscf->file_name, uscf->line);
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_conf_init_msec_value(hcf->interval, 5000);
+        ngx_conf_init_msec_value(hcf->timeout, 5000);
+        ngx_conf_init_uint_value(hcf->fails, 1);
+        ngx_conf_init_uint_value(hcf->passes, 1);
+
+        if (hcf->status_min == NGX_CONF_UNSET_UINT) {
+            hcf->status_min = 200;
+            hcf->status_max = 399;
+        }
+
+        if (hcf->uri.data == NULL) {
+            ngx_str_set(&hcf->uri, "/");
+        }
+
+        len = sizeof("GET  HTTP/1.0" CRLF) - 1 + hcf->uri.len
+              + sizeof("Host: " CRLF) - 1 + uscf->host.len
+              + sizeof("User-Agent: nginx health check" CRLF) - 1
+              + sizeof("Connection: close" CRLF CRLF) - 1;
+
+        hcf->request.data = ngx_pnalloc(cf->pool, len);
+        if (hcf->request.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        hcf->request.len = ngx_sprintf(hcf->request.data,
+                                       "GET %V HTTP/1.0" CRLF
+                                       "Host: %V" CRLF
+                                       "User-Agent: nginx health check" CRLF
+                                       "Connection: close" CRLF CRLF,
+                                       &hcf->uri, &uscf->host)
+                           - hcf->request.data;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static void *
+ngx_http_upstream_hc_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    hcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_hc_srv_conf_t));
+    if (hcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     hcf->port = 0;
+     *     hcf->uri = { 0, NULL };
+     *     hcf->request = { 0, NULL };
+     *     hcf->event = { 0 };
+     *     hcf->upstream = NULL;
+     */
+
+    hcf->interval = NGX_CONF_UNSET_MSEC;
+    hcf->timeout = NGX_CONF_UNSET_MSEC;
+    hcf->fails = NGX_CONF_UNSET_UINT;
+    hcf->passes = NGX_CONF_UNSET_UINT;
+    hcf->status_min = NGX_CONF_UNSET_UINT;
+    hcf->status_max = NGX_CONF_UNSET_UINT;
+
+    return hcf;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                          i;
+    ngx_http_upstream_hc_srv_conf_t   **hcfp, *hcf;
+    ngx_http_upstream_hc_main_conf_t   *hmcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    /* the checks are run by the first worker process only */
+
+    if (ngx_worker != 0) {
+        return NGX_OK;
+    }
+
+    hmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_upstream_hc_module);
+    if (hmcf == NULL) {
+        return NGX_OK;
+    }
+
+    hcfp = hmcf->checks.elts;
+
+    for (i = 0; i < hmcf->checks.nelts; i++) {
+        hcf = hcfp[i];
+
+        hcf->event.handler = ngx_http_upstream_hc_handler;
+        hcf->event.data = hcf;
+        hcf->event.log = cycle->log;
+        hcf->event.cancelable = 1;
+
+        /* the first checks of upstreams are spread over the interval */
+
+        ngx_add_timer(&hcf->event, ngx_random() % hcf->interval + 1);
+    }
+
+    return NGX_OK;
+}
@@ -163,7 +163,14 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(iphp->rrp.peers);
 
-    if (iphp->tries > 20 || iphp->rrp.peers->single) {
+    if (ngx_http_upstream_rr_update_tried(&iphp->rrp) != NGX_OK) {
+        ngx_http_upstream_rr_peers_unlock(iphp->rrp.peers);
+        return NGX_ERROR;
+    }
+
+    if (iphp->tries > 20 || iphp->rrp.peers->single
+        || iphp->rrp.peers->total_weight == 0)
+    {
         ngx_http_upstream_rr_peers_unlock(iphp->rrp.peers);
         return iphp->get_rr_peer(pc, &iphp->rrp);
     }
@@ -185,8 +192,15 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
         peer = iphp->rrp.peers->peer;
         p = 0;
 
-        while (w >= peer->weight) {
-            w -= peer->weight;
+        /* removed peers are not counted in the total weight */
+
+        while (w >= peer->weight
+               || (peer->down & NGX_HTTP_UPSTREAM_RR_REMOVED))
+        {
+            if (!(peer->down & NGX_HTTP_UPSTREAM_RR_REMOVED)) {
+                w -= peer->weight;
+            }
+
             peer = peer->next;
             p++;
         }
@@ -103,7 +103,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
     time_t                         now;
     uintptr_t                      m;
-    ngx_int_t                      rc, total;
+    ngx_int_t                      rc, total, weight, best_weight, ew;
     ngx_uint_t                     i, n, p, many;
     ngx_http_upstream_rr_peer_t   *peer, *best;
     ngx_http_upstream_rr_peers_t  *peers;
@@ -124,12 +124,18 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(peers);
 
+    if (ngx_http_upstream_rr_update_tried(rrp) != NGX_OK) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return NGX_ERROR;
+    }
+
     best = NULL;
     total = 0;
 
 #if (NGX_SUPPRESS_WARN)
     many = 0;
     p = 0;
+    best_weight = 0;
 #endif
 
     for (peer = peers->peer, i = 0;
@@ -164,14 +170,17 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
          * based on round-robin
          */
 
+        weight = ngx_http_upstream_rr_peer_weight(peer, peer->weight);
+
         if (best == NULL
-            || peer->conns * best->weight < best->conns * peer->weight)
+            || peer->conns * best_weight < best->conns * weight)
         {
             best = peer;
+            best_weight = weight;
             many = 0;
             p = i;
 
-        } else if (peer->conns * best->weight == best->conns * peer->weight) {
+        } else if (peer->conns * best_weight == best->conns * weight) {
             many = 1;
         }
     }
@@ -202,7 +211,9 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
-            if (peer->conns * best->weight != best->conns * peer->weight) {
+            weight = ngx_http_upstream_rr_peer_weight(peer, peer->weight);
+
+            if (peer->conns * best_weight != best->conns * weight) {
                 continue;
             }
 
@@ -217,8 +228,10 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
-            peer->current_weight += peer->effective_weight;
-            total += peer->effective_weight;
+            ew = ngx_http_upstream_rr_peer_weight(peer, peer->effective_weight);
+
+            peer->current_weight += ew;
+            total += ew;
 
             if (peer->effective_weight < peer->weight) {
                 peer->effective_weight++;
@@ -226,6 +239,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
             if (peer->current_weight > best->current_weight) {
                 best = peer;
+                best_weight = weight;
                 p = i;
             }
         }
@@ -308,7 +322,8 @@ ngx_http_upstream_least_conn(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                   |NGX_HTTP_UPSTREAM_MAX_FAILS
                   |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
                   |NGX_HTTP_UPSTREAM_DOWN
-                  |NGX_HTTP_UPSTREAM_BACKUP;
+                  |NGX_HTTP_UPSTREAM_BACKUP
+                  |NGX_HTTP_UPSTREAM_SLOW_START;
 
     return NGX_CONF_OK;
 }
@@ -0,0 +1,542 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_P2C_CONNS  0
+#define NGX_HTTP_UPSTREAM_P2C_EWMA   1
+
+
+typedef struct {
+    ngx_uint_t                          metric;
+    ngx_msec_t                          decay;
+
+    /* per-process index of primary peers, rebuilt on changes */
+    ngx_http_upstream_rr_peer_t       **index;
+    ngx_uint_t                          number;
+} ngx_http_upstream_p2c_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t    rrp;
+    ngx_http_upstream_p2c_srv_conf_t   *conf;
+    ngx_http_request_t                 *request;
+    ngx_uint_t                          tries;
+} ngx_http_upstream_p2c_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_p2c(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_init_p2c_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_p2c_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_free_p2c_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_int_t ngx_http_upstream_p2c_index(
+    ngx_http_upstream_p2c_srv_conf_t *pcf, ngx_http_upstream_rr_peers_t *peers,
+    ngx_log_t *log);
+static ngx_uint_t ngx_http_upstream_p2c_available(
+    ngx_http_upstream_rr_peer_data_t *rrp, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t i, time_t now);
+static ngx_int_t ngx_http_upstream_p2c_cmp(
+    ngx_http_upstream_p2c_srv_conf_t *pcf, ngx_http_upstream_rr_peer_t *one,
+    ngx_http_upstream_rr_peer_t *two);
+static uint64_t ngx_http_upstream_p2c_ewma(
+    ngx_http_upstream_p2c_srv_conf_t *pcf, ngx_http_upstream_rr_peer_t *peer);
+
+static void *ngx_http_upstream_p2c_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_p2c(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_p2c_commands[] = {
+
+    { ngx_string("p2c"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE12,
+      ngx_http_upstream_p2c,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_p2c_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_p2c_create_conf,     /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_p2c_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_p2c_module_ctx,     /* module context */
+    ngx_http_upstream_p2c_commands,        /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_p2c(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0, "init p2c");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_p2c_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_p2c_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_p2c_peer_data_t  *pp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init p2c peer");
+
+    pp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_p2c_peer_data_t));
+    if (pp == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &pp->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_p2c_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_p2c_peer;
+
+    pp->conf = ngx_http_conf_upstream_srv_conf(us,
+                                               ngx_http_upstream_p2c_module);
+    pp->request = r;
+    pp->tries = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_p2c_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_p2c_peer_data_t  *pp = data;
+
+    time_t                             now;
+    uintptr_t                          m;
+    ngx_uint_t                         i, j, n, p;
+    ngx_http_upstream_rr_peer_t       *peer, *one, *two;
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_p2c_srv_conf_t  *pcf;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get p2c peer, try: %ui", pc->tries);
+
+    pcf = pp->conf;
+    peers = pp->rrp.peers;
+
+    /*
+     * the peers are only read-locked: the choice is made between
+     * two random peers, and only the chosen peer is locked to account
+     * for the new connection
+     */
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    if (ngx_http_upstream_rr_update_tried(&pp->rrp) != NGX_OK) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return NGX_ERROR;
+    }
+
+    if (pp->tries > 20 || peers->single || peers->number < 2
+        || ngx_http_upstream_p2c_index(pcf, peers, pc->log) != NGX_OK)
+    {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return ngx_http_upstream_get_round_robin_peer(pc, &pp->rrp);
+    }
+
+    now = ngx_time();
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    for ( ;; ) {
+
+        i = ngx_random() % peers->number;
+        j = ngx_random() % (peers->number - 1);
+
+        if (j >= i) {
+            j++;
+        }
+
+        one = pcf->index[i];
+        two = pcf->index[j];
+
+        if (!ngx_http_upstream_p2c_available(&pp->rrp, one, i, now)) {
+            one = NULL;
+        }
+
+        if (!ngx_http_upstream_p2c_available(&pp->rrp, two, j, now)) {
+            two = NULL;
+        }
+
+        if (one && two) {
+            if (ngx_http_upstream_p2c_cmp(pcf, two, one) < 0) {
+                peer = two;
+                p = j;
+
+            } else {
+                peer = one;
+                p = i;
+            }
+
+        } else if (one) {
+            peer = one;
+            p = i;
+
+        } else if (two) {
+            peer = two;
+            p = j;
+
+        } else {
+            goto next;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get p2c peer, choice:%ui,%ui", i, j);
+
+        ngx_http_upstream_rr_peer_lock(peers, peer);
+
+        /* the peer might have been taken by others meanwhile */
+
+        if (peer->max_conns && peer->conns >= peer->max_conns) {
+            ngx_http_upstream_rr_peer_unlock(peers, peer);
+            goto next;
+        }
+
+        break;
+
+    next:
+
+        if (++pp->tries > 20) {
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return ngx_http_upstream_get_round_robin_peer(pc, &pp->rrp);
+        }
+    }
+
+    pp->rrp.current = peer;
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    peer->conns++;
+
+    if (now - peer->checked > peer->fail_timeout) {
+        peer->checked = now;
+    }
+
+    ngx_http_upstream_rr_peer_unlock(peers, peer);
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    pp->rrp.tried[n] |= m;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_free_p2c_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_p2c_peer_data_t  *pp = data;
+
+    ngx_msec_t                    elapsed;
+    ngx_uint_t                    rt;
+    ngx_http_upstream_t          *u;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    u = pp->request->upstream;
+
+    if (pp->conf->metric != NGX_HTTP_UPSTREAM_P2C_EWMA
+        || (state & NGX_PEER_FAILED)
+        || u->state == NULL
+        || u->state->header_time == (ngx_msec_t) -1
+        || pp->rrp.peers->single)
+    {
+        goto done;
+    }
+
+    /* the time to the response header is the latency of a peer, in usec */
+
+    rt = u->state->header_time * 1000;
+
+    peer = pp->rrp.current;
+
+    ngx_http_upstream_rr_peers_rlock(pp->rrp.peers);
+    ngx_http_upstream_rr_peer_lock(pp->rrp.peers, peer);
+
+    if (peer->ewma_time == 0) {
+        peer->ewma = rt;
+
+    } else {
+
+        /*
+         * the previous value decays while the peer is idle,
+         * then the new sample is added with the weight of 1/8
+         */
+
+        elapsed = ngx_current_msec - peer->ewma_time;
+
+        peer->ewma = (uint64_t) peer->ewma * pp->conf->decay
+                     / (pp->conf->decay + elapsed);
+
+        peer->ewma = peer->ewma - peer->ewma / 8 + rt / 8;
+    }
+
+    peer->ewma_time = ngx_current_msec;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free p2c peer %p ewma:%uius", peer, peer->ewma);
+
+    ngx_http_upstream_rr_peer_unlock(pp->rrp.peers, peer);
+    ngx_http_upstream_rr_peers_unlock(pp->rrp.peers);
+
+done:
+
+    ngx_http_upstream_free_round_robin_peer(pc, &pp->rrp, state);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_p2c_index(ngx_http_upstream_p2c_srv_conf_t *pcf,
+    ngx_http_upstream_rr_peers_t *peers, ngx_log_t *log)
+{
+    ngx_uint_t                    i;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    if (pcf->index && pcf->number == peers->number
+        && pcf->index[0] == peers->peer)
+    {
+        return NGX_OK;
+    }
+
+    if (pcf->index) {
+        ngx_free(pcf->index);
+    }
+
+    pcf->index = ngx_alloc(peers->number
+                           * sizeof(ngx_http_upstream_rr_peer_t *), log);
+    if (pcf->index == NULL) {
+        pcf->number = 0;
+        return NGX_ERROR;
+    }
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+        pcf->index[i] = peer;
+    }
+
+    pcf->number = peers->number;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_p2c_available(ngx_http_upstream_rr_peer_data_t *rrp,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t i, time_t now)
+{
+    uintptr_t   m;
+    ngx_uint_t  n;
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    if (rrp->tried[n] & m) {
+        return 0;
+    }
+
+    if (peer->down) {
+        return 0;
+    }
+
+    if (peer->max_fails
+        && peer->fails >= peer->max_fails
+        && now - peer->checked <= peer->fail_timeout)
+    {
+        return 0;
+    }
+
+    if (peer->max_conns && peer->conns >= peer->max_conns) {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_p2c_cmp(ngx_http_upstream_p2c_srv_conf_t *pcf,
+    ngx_http_upstream_rr_peer_t *one, ngx_http_upstream_rr_peer_t *two)
+{
+    uint64_t  c1, c2;
+
+    /*
+     * the costs are compared as c1 / w1 and c2 / w2, where
+     * the cost is the number of connections, including the new one,
+     * optionally multiplied by the expected latency
+     */
+
+    c1 = (uint64_t) (one->conns + 1)
+         * ngx_http_upstream_rr_peer_weight(two, two->weight);
+    c2 = (uint64_t) (two->conns + 1)
+         * ngx_http_upstream_rr_peer_weight(one, one->weight);
+
+    if (pcf->metric == NGX_HTTP_UPSTREAM_P2C_EWMA) {
+        c1 *= ngx_http_upstream_p2c_ewma(pcf, one) + 1;
+        c2 *= ngx_http_upstream_p2c_ewma(pcf, two) + 1;
+    }
+
+    return (c1 < c2) ? -1 : (c1 > c2) ? 1 : 0;
+}
+
+
+static uint64_t
+ngx_http_upstream_p2c_ewma(ngx_http_upstream_p2c_srv_conf_t *pcf,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_msec_t  elapsed;
+
+    /* a peer not used for a while is gradually given another chance */
+
+    elapsed = ngx_current_msec - peer->ewma_time;
+
+    return (uint64_t) peer->ewma * pcf->decay / (pcf->decay + elapsed);
+}
+
+
+static void *
+ngx_http_upstream_p2c_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_p2c_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_p2c_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->metric = NGX_HTTP_UPSTREAM_P2C_CONNS;
+     *     conf->index = NULL;
+     *     conf->number = 0;
+     */
+
+    conf->decay = 10000;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_p2c(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_p2c_srv_conf_t  *pcf = conf;
+
+    ngx_str_t                     *value, s;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strcmp(value[i].data, "least_conn") == 0) {
+            pcf->metric = NGX_HTTP_UPSTREAM_P2C_CONNS;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "ewma") == 0) {
+            pcf->metric = NGX_HTTP_UPSTREAM_P2C_EWMA;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "decay=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = &value[i].data[6];
+
+            pcf->decay = ngx_parse_time(&s, 0);
+
+            if (pcf->decay == (ngx_msec_t) NGX_ERROR || pcf->decay == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_p2c;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_CONNS
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_BACKUP
+                  |NGX_HTTP_UPSTREAM_SLOW_START;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
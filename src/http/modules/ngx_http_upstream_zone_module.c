@@ -10,12 +10,22 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_http_upstream_srv_conf_t   *uscf;
+    ngx_http_upstream_server_t     *server;
+    ngx_event_t                     event;
+} ngx_http_upstream_zone_resolve_t;
+
+
 static char *ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
     void *data);
 static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_http_upstream_srv_conf_t *uscf);
+static ngx_int_t ngx_http_upstream_zone_init_worker(ngx_cycle_t *cycle);
+static void ngx_http_upstream_zone_resolve_timer(ngx_event_t *event);
+static void ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx);
 
 
 static ngx_command_t  ngx_http_upstream_zone_commands[] = {
@@ -53,7 +63,7 @@ ngx_module_t  ngx_http_upstream_zone_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_zone_init_worker,    /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -197,6 +207,11 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
     peers->shpool = shpool;
 
+    peers->config = ngx_slab_calloc(shpool, sizeof(ngx_uint_t));
+    if (peers->config == NULL) {
+        return NULL;
+    }
+
     for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
         /* pool is unlocked */
         peer = ngx_slab_calloc_locked(shpool,
@@ -222,6 +237,7 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     ngx_memcpy(backup, peers->next, sizeof(ngx_http_upstream_rr_peers_t));
 
     backup->shpool = shpool;
+    backup->config = peers->config;
 
     for (peerp = &backup->peer; *peerp; peerp = &peer->next) {
         /* pool is unlocked */
@@ -244,3 +260,399 @@ done:
 
     return peers;
 }
+
+
+ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_zone_add_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t backup, struct sockaddr *sockaddr, socklen_t socklen,
+    ngx_str_t *server)
+{
+    size_t                         size;
+    ngx_http_upstream_rr_peer_t   *peer, **peerp;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    /* peers are write locked */
+
+    if (backup && peers->next == NULL) {
+
+        list = ngx_slab_calloc(peers->shpool,
+                               sizeof(ngx_http_upstream_rr_peers_t));
+        if (list == NULL) {
+            return NULL;
+        }
+
+        list->shpool = peers->shpool;
+        list->config = peers->config;
+        list->name = peers->name;
+
+        peers->next = list;
+        peers->single = 0;
+    }
+
+    list = backup ? peers->next : peers;
+
+    /*
+     * removed peers are never freed or changed as their addresses and
+     * names may still be referenced by requests and logs; a removed peer
+     * is only brought back if the same address is added again
+     */
+
+    for (peerp = &list->peer; *peerp; peerp = &(*peerp)->next) {
+        peer = *peerp;
+
+        if ((peer->down & NGX_HTTP_UPSTREAM_RR_REMOVED)
+            && ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                sockaddr, socklen, 1)
+               == NGX_OK)
+        {
+            goto found;
+        }
+    }
+
+    size = sizeof(ngx_http_upstream_rr_peer_t) + sizeof(ngx_sockaddr_t)
+           + NGX_SOCKADDR_STRLEN;
+
+    peer = ngx_slab_calloc(peers->shpool, size);
+    if (peer == NULL) {
+        return NULL;
+    }
+
+    peer->sockaddr = (struct sockaddr *) &peer[1];
+    peer->name.data = (u_char *) peer->sockaddr + sizeof(ngx_sockaddr_t);
+
+    *peerp = peer;
+
+    list->number++;
+
+    /* the request data of other requests became stale */
+
+    (*peers->config)++;
+
+    ngx_memcpy(peer->sockaddr, sockaddr, socklen);
+    peer->socklen = socklen;
+
+    peer->name.len = ngx_sock_ntop(peer->sockaddr, peer->socklen,
+                                   peer->name.data, NGX_SOCKADDR_STRLEN, 1);
+
+found:
+
+    peer->server = server ? *server : peer->name;
+
+    peer->current_weight = 0;
+
+    peer->fails = 0;
+    peer->accessed = 0;
+    peer->checked = 0;
+
+    peer->down = 0;
+
+#if (NGX_HTTP_UPSTREAM_P2C)
+    peer->ewma = 0;
+    peer->ewma_time = 0;
+#endif
+
+#if (NGX_HTTP_UPSTREAM_HC)
+    peer->hc_fails = 0;
+    peer->hc_passes = 0;
+    peer->hc_checking = 0;
+#endif
+
+#if (NGX_STAT_STUB)
+    ngx_memzero(&peer->stats, sizeof(ngx_http_upstream_rr_peer_stats_t));
+#endif
+
+    return peer;
+}
+
+
+void
+ngx_http_upstream_zone_update_weights(ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_uint_t                     w, n, single;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    single = 0;
+
+    for (list = peers; list; list = list->next) {
+        w = 0;
+        n = 0;
+
+        for (peer = list->peer; peer; peer = peer->next) {
+
+            if (peer->down & NGX_HTTP_UPSTREAM_RR_REMOVED) {
+                continue;
+            }
+
+            w += peer->weight;
+            n++;
+        }
+
+        list->total_weight = w;
+        list->weighted = (w != n);
+
+        /*
+         * the numbers of peers include removed ones; a single peer
+         * is the only live one, the first in the list, without backups
+         */
+
+        if (list == peers) {
+            single = (n == 1
+                      && !(peers->peer->down & NGX_HTTP_UPSTREAM_RR_REMOVED));
+
+        } else if (n) {
+            single = 0;
+        }
+    }
+
+    peers->single = single;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                         i, j;
+    ngx_http_upstream_server_t        *server;
+    ngx_http_upstream_srv_conf_t     **uscfp, *uscf;
+    ngx_http_upstream_main_conf_t     *umcf;
+    ngx_http_upstream_zone_resolve_t  *zr;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    /* names are resolved by the first worker process only */
+
+    if (ngx_worker != 0) {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone == NULL || uscf->servers == NULL) {
+            continue;
+        }
+
+        server = uscf->servers->elts;
+
+        for (j = 0; j < uscf->servers->nelts; j++) {
+            if (!server[j].resolve) {
+                continue;
+            }
+
+            zr = ngx_pcalloc(cycle->pool,
+                             sizeof(ngx_http_upstream_zone_resolve_t));
+            if (zr == NULL) {
+                return NGX_ERROR;
+            }
+
+            zr->uscf = uscf;
+            zr->server = &server[j];
+
+            zr->event.handler = ngx_http_upstream_zone_resolve_timer;
+            zr->event.data = zr;
+            zr->event.log = cycle->log;
+            zr->event.cancelable = 1;
+
+            ngx_add_timer(&zr->event, 1);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_timer(ngx_event_t *event)
+{
+    ngx_resolver_ctx_t                *ctx;
+    ngx_http_upstream_zone_resolve_t  *zr;
+
+    zr = event->data;
+
+    ctx = ngx_resolve_start(zr->uscf->resolver, NULL);
+
+    if (ctx == NULL) {
+        goto retry;
+    }
+
+    if (ctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "no resolver defined to resolve %V", &zr->server->host);
+        return;
+    }
+
+    ctx->name = zr->server->host;
+    ctx->service = zr->server->service;
+    ctx->handler = ngx_http_upstream_zone_resolve_handler;
+    ctx->data = zr;
+    ctx->timeout = zr->uscf->resolver_timeout;
+    ctx->cancelable = 1;
+
+    if (ngx_resolve_name(ctx) == NGX_OK) {
+        return;
+    }
+
+retry:
+
+    ngx_log_error(NGX_LOG_ALERT, event->log, 0,
+                  "could not start resolving %V in upstream \"%V\"",
+                  &zr->server->host, &zr->uscf->host);
+
+    ngx_add_timer(event, 10000);
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx)
+{
+    time_t                             now;
+    ngx_uint_t                         i, naddrs, changed;
+    ngx_resolver_addr_t               *addrs;
+    ngx_http_upstream_server_t        *server;
+    ngx_http_upstream_rr_peer_t       *peer;
+    ngx_http_upstream_rr_peers_t      *peers, *list;
+    ngx_http_upstream_zone_resolve_t  *zr;
+
+    zr = ctx->data;
+    server = zr->server;
+    peers = zr->uscf->peer.data;
+
+    naddrs = ctx->naddrs;
+    addrs = ctx->addrs;
+
+    if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, zr->event.log, 0,
+                      "%V could not be resolved (%i: %s) "
+                      "in upstream \"%V\"",
+                      &ctx->name, ctx->state,
+                      ngx_resolver_strerror(ctx->state), &zr->uscf->host);
+
+        /*
+         * the current peers are kept unless the name is known
+         * to no longer exist
+         */
+
+        if (ctx->state != NGX_RESOLVE_NXDOMAIN) {
+            goto done;
+        }
+
+        naddrs = 0;
+    }
+
+    if (server->service.len == 0) {
+        for (i = 0; i < naddrs; i++) {
+            ngx_inet_set_port(addrs[i].sockaddr, server->port);
+        }
+    }
+
+    changed = 0;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    list = server->backup ? peers->next : peers;
+
+    for (peer = list ? list->peer : NULL; peer; peer = peer->next) {
+
+        if (peer->server.data != server->name.data
+            || (peer->down & NGX_HTTP_UPSTREAM_RR_REMOVED))
+        {
+            continue;
+        }
+
+        for (i = 0; i < naddrs; i++) {
+            if (ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                 addrs[i].sockaddr, addrs[i].socklen, 1)
+                == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (i < naddrs) {
+            continue;
+        }
+
+        peer->down |= NGX_HTTP_UPSTREAM_RR_REMOVED;
+        changed = 1;
+
+        ngx_log_error(NGX_LOG_NOTICE, zr->event.log, 0,
+                      "upstream server %V of %V removed from upstream \"%V\"",
+                      &peer->name, &server->name, peers->name);
+    }
+
+    for (i = 0; i < naddrs; i++) {
+
+        for (peer = list ? list->peer : NULL; peer; peer = peer->next) {
+
+            if (peer->server.data == server->name.data
+                && !(peer->down & NGX_HTTP_UPSTREAM_RR_REMOVED)
+                && ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                    addrs[i].sockaddr, addrs[i].socklen, 1)
+                   == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (peer) {
+            continue;
+        }
+
+        peer = ngx_http_upstream_zone_add_peer(peers, server->backup,
+                                               addrs[i].sockaddr,
+                                               addrs[i].socklen,
+                                               &server->name);
+        if (peer == NULL) {
+            ngx_log_error(NGX_LOG_ERR, zr->event.log, 0,
+                          "could not allocate server %V in upstream \"%V\"",
+                          &server->name, peers->name);
+            break;
+        }
+
+        list = server->backup ? peers->next : peers;
+
+        peer->weight = server->weight;
+        peer->effective_weight = server->weight;
+        peer->max_conns = server->max_conns;
+        peer->max_fails = server->max_fails;
+        peer->fail_timeout = server->fail_timeout;
+        peer->slow_start = server->slow_start;
+        peer->start_time = server->slow_start ? ngx_current_msec : 0;
+        peer->down = server->down;
+
+        changed = 1;
+
+        ngx_log_error(NGX_LOG_NOTICE, zr->event.log, 0,
+                      "upstream server %V of %V added to upstream \"%V\"",
+                      &peer->name, &server->name, peers->name);
+    }
+
+    if (changed) {
+        ngx_http_upstream_zone_update_weights(peers);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+done:
+
+    /* the name is resolved again once its records expire */
+
+    now = ngx_time();
+
+    ngx_add_timer(&zr->event, ctx->valid > now
+                              ? (ngx_msec_t) (ctx->valid - now) * 1000 : 1000);
+
+    ngx_resolve_name_done(ctx);
+}
@@ -35,17 +35,21 @@ static char *ngx_http_merge_locations(ngx_conf_t *cf,
     ngx_uint_t ctx_index);
 static ngx_int_t ngx_http_init_locations(ngx_conf_t *cf,
     ngx_http_core_srv_conf_t *cscf, ngx_http_core_loc_conf_t *pclcf);
+#if (NGX_PCRE)
+static ngx_int_t ngx_http_init_regex_locations_set(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t *pclcf, ngx_uint_t n);
+#endif
 static ngx_int_t ngx_http_init_static_location_trees(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *pclcf);
 static ngx_int_t ngx_http_cmp_locations(const ngx_queue_t *one,
     const ngx_queue_t *two);
 static ngx_int_t ngx_http_join_exact_locations(ngx_conf_t *cf,
     ngx_queue_t *locations);
-static void ngx_http_create_locations_list(ngx_queue_t *locations,
-    ngx_queue_t *q);
 static ngx_http_location_tree_node_t *
-    ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
-    size_t prefix);
+    ngx_http_create_locations_tree(ngx_conf_t *cf,
+    ngx_http_location_queue_t **lqs, ngx_uint_t n, size_t prefix);
+static int ngx_libc_cdecl ngx_http_cmp_location_nodes(const void *one,
+    const void *two);
 
 static ngx_int_t ngx_http_optimize_servers(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf, ngx_array_t *ports);
@@ -337,6 +341,10 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    /* select the request parser scanners supported by the CPU */
+
+    ngx_http_parse_init();
+
     return NGX_CONF_OK;
 
 failed:
@@ -791,6 +799,10 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
         *clcfp = NULL;
 
         ngx_queue_split(locations, regex, &tail);
+
+        if (ngx_http_init_regex_locations_set(cf, pclcf, r) != NGX_OK) {
+            return NGX_ERROR;
+        }
     }
 
 #endif
@@ -799,13 +811,53 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 }
 
 
+#if (NGX_PCRE)
+
+static ngx_int_t
+ngx_http_init_regex_locations_set(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t *pclcf, ngx_uint_t n)
+{
+    ngx_uint_t                  i;
+    ngx_regex_elt_t            *elts;
+    ngx_http_regex_t           *re;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    /* regex locations are tested one by one unless "regex_set" is on */
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    if (cmcf->regex_set != 1 || n < NGX_HTTP_REGEX_SET_MIN) {
+        return NGX_OK;
+    }
+
+    elts = ngx_palloc(cf->temp_pool, n * sizeof(ngx_regex_elt_t));
+    if (elts == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        re = pclcf->regex_locations[i]->regex;
+
+        elts[i].regex = re->regex;
+        elts[i].name = re->name.data;
+    }
+
+    pclcf->regex_set = ngx_http_regex_compile_set(cf, elts, n);
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_init_static_location_trees(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *pclcf)
 {
+    ngx_uint_t                  n;
     ngx_queue_t                *q, *locations;
     ngx_http_core_loc_conf_t   *clcf;
-    ngx_http_location_queue_t  *lq;
+    ngx_http_location_queue_t  *lq, **lqs;
 
     locations = pclcf->locations;
 
@@ -834,9 +886,30 @@ ngx_http_init_static_location_trees(ngx_conf_t *cf,
         return NGX_ERROR;
     }
 
-    ngx_http_create_locations_list(locations, ngx_queue_head(locations));
+    n = 0;
+
+    for (q = ngx_queue_head(locations);
+         q != ngx_queue_sentinel(locations);
+         q = ngx_queue_next(q))
+    {
+        n++;
+    }
+
+    lqs = ngx_palloc(cf->temp_pool, n * sizeof(ngx_http_location_queue_t *));
+    if (lqs == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+
+    for (q = ngx_queue_head(locations);
+         q != ngx_queue_sentinel(locations);
+         q = ngx_queue_next(q))
+    {
+        lqs[n++] = (ngx_http_location_queue_t *) q;
+    }
 
-    pclcf->static_locations = ngx_http_create_locations_tree(cf, locations, 0);
+    pclcf->static_locations = ngx_http_create_locations_tree(cf, lqs, n, 0);
     if (pclcf->static_locations == NULL) {
         return NGX_ERROR;
     }
@@ -1006,143 +1079,151 @@ ngx_http_join_exact_locations(ngx_conf_t *cf, ngx_queue_t *locations)
 }
 
 
-static void
-ngx_http_create_locations_list(ngx_queue_t *locations, ngx_queue_t *q)
+/*
+ * the static locations of a level are kept in a radix tree: a node holds
+ * the longest common prefix of the names below it, the location whose name
+ * ends at the node, if any, and the children indexed by the next character;
+ * "lqs" is the part of the sorted locations list with the same "prefix"
+ */
+
+static ngx_http_location_tree_node_t *
+ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_http_location_queue_t **lqs,
+    ngx_uint_t n, size_t prefix)
 {
-    u_char                     *name;
-    size_t                      len;
-    ngx_queue_t                *x, tail;
-    ngx_http_location_queue_t  *lq, *lx;
+    u_char                          *first, *last;
+    size_t                           len;
+    ngx_uint_t                       i, j, k, nchildren;
+    ngx_http_location_queue_t       *lq;
+    ngx_http_location_tree_node_t   *node;
 
-    if (q == ngx_queue_last(locations)) {
-        return;
-    }
+    first = lqs[0]->name->data;
+    last = lqs[n - 1]->name->data;
 
-    lq = (ngx_http_location_queue_t *) q;
+    /* the names are sorted, so the first and the last ones are enough */
 
-    if (lq->inclusive == NULL) {
-        ngx_http_create_locations_list(locations, ngx_queue_next(q));
-        return;
-    }
+    len = prefix;
 
-    len = lq->name->len;
-    name = lq->name->data;
-
-    for (x = ngx_queue_next(q);
-         x != ngx_queue_sentinel(locations);
-         x = ngx_queue_next(x))
+    while (len < lqs[0]->name->len
+           && len < lqs[n - 1]->name->len
+           && ngx_http_location_key(first[len])
+              == ngx_http_location_key(last[len]))
     {
-        lx = (ngx_http_location_queue_t *) x;
-
-        if (len > lx->name->len
-            || ngx_filename_cmp(name, lx->name->data, len) != 0)
-        {
-            break;
-        }
+        len++;
     }
 
-    q = ngx_queue_next(q);
-
-    if (q == x) {
-        ngx_http_create_locations_list(locations, x);
-        return;
-    }
-
-    ngx_queue_split(locations, q, &tail);
-    ngx_queue_add(&lq->list, &tail);
-
-    if (x == ngx_queue_sentinel(locations)) {
-        ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
-        return;
+    node = ngx_palloc(cf->pool,
+                      offsetof(ngx_http_location_tree_node_t, name)
+                      + len - prefix);
+    if (node == NULL) {
+        return NULL;
     }
 
-    ngx_queue_split(&lq->list, x, &tail);
-    ngx_queue_add(locations, &tail);
+    node->children = NULL;
+    node->keys = NULL;
+    node->nchildren = 0;
+    node->exact = NULL;
+    node->inclusive = NULL;
+    node->auto_redirect = 0;
 
-    ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
+    node->len = len - prefix;
+    ngx_memcpy(node->name, &first[prefix], len - prefix);
 
-    ngx_http_create_locations_list(locations, x);
-}
+    i = 0;
 
+    if (lqs[0]->name->len == len) {
 
-/*
- * to keep cache locality for left leaf nodes, allocate nodes in following
- * order: node, left subtree, right subtree, inclusive subtree
- */
+        /* a name equal to the prefix is sorted first */
 
-static ngx_http_location_tree_node_t *
-ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
-    size_t prefix)
-{
-    size_t                          len;
-    ngx_queue_t                    *q, tail;
-    ngx_http_location_queue_t      *lq;
-    ngx_http_location_tree_node_t  *node;
+        lq = lqs[0];
 
-    q = ngx_queue_middle(locations);
+        node->exact = lq->exact;
+        node->inclusive = lq->inclusive;
 
-    lq = (ngx_http_location_queue_t *) q;
-    len = lq->name->len - prefix;
+        node->auto_redirect = (u_char) ((lq->exact && lq->exact->auto_redirect)
+                           || (lq->inclusive && lq->inclusive->auto_redirect));
 
-    node = ngx_palloc(cf->pool,
-                      offsetof(ngx_http_location_tree_node_t, name) + len);
-    if (node == NULL) {
-        return NULL;
+        i = 1;
     }
 
-    node->left = NULL;
-    node->right = NULL;
-    node->tree = NULL;
-    node->exact = lq->exact;
-    node->inclusive = lq->inclusive;
+    /* the names with the same next character make up a child */
 
-    node->auto_redirect = (u_char) ((lq->exact && lq->exact->auto_redirect)
-                           || (lq->inclusive && lq->inclusive->auto_redirect));
-
-    node->len = (u_char) len;
-    ngx_memcpy(node->name, &lq->name->data[prefix], len);
+    nchildren = 0;
 
-    ngx_queue_split(locations, q, &tail);
+    for (j = i; j < n; j = k) {
+        for (k = j + 1;
+             k < n && ngx_http_location_key(lqs[k]->name->data[len])
+                      == ngx_http_location_key(lqs[j]->name->data[len]);
+             k++)
+        {
+            /* void */
+        }
 
-    if (ngx_queue_empty(locations)) {
-        /*
-         * ngx_queue_split() insures that if left part is empty,
-         * then right one is empty too
-         */
-        goto inclusive;
+        nchildren++;
     }
 
-    node->left = ngx_http_create_locations_tree(cf, locations, prefix);
-    if (node->left == NULL) {
-        return NULL;
+    if (nchildren == 0) {
+        return node;
     }
 
-    ngx_queue_remove(q);
-
-    if (ngx_queue_empty(&tail)) {
-        goto inclusive;
+    node->children = ngx_palloc(cf->pool,
+                       nchildren * sizeof(ngx_http_location_tree_node_t *));
+    if (node->children == NULL) {
+        return NULL;
     }
 
-    node->right = ngx_http_create_locations_tree(cf, &tail, prefix);
-    if (node->right == NULL) {
+    node->keys = ngx_pnalloc(cf->pool, nchildren);
+    if (node->keys == NULL) {
         return NULL;
     }
 
-inclusive:
+    for (j = i; j < n; j = k) {
+        for (k = j + 1;
+             k < n && ngx_http_location_key(lqs[k]->name->data[len])
+                      == ngx_http_location_key(lqs[j]->name->data[len]);
+             k++)
+        {
+            /* void */
+        }
 
-    if (ngx_queue_empty(&lq->list)) {
-        return node;
+        node->children[node->nchildren] =
+                     ngx_http_create_locations_tree(cf, &lqs[j], k - j, len);
+        if (node->children[node->nchildren] == NULL) {
+            return NULL;
+        }
+
+        node->nchildren++;
     }
 
-    node->tree = ngx_http_create_locations_tree(cf, &lq->list, prefix + len);
-    if (node->tree == NULL) {
-        return NULL;
+    /*
+     * the locations order puts '/' first, while the children are looked up
+     * by the binary search on the character codes
+     */
+
+    ngx_qsort(node->children, node->nchildren,
+              sizeof(ngx_http_location_tree_node_t *),
+              ngx_http_cmp_location_nodes);
+
+    for (j = 0; j < node->nchildren; j++) {
+        node->keys[j] = ngx_http_location_key(node->children[j]->name[0]);
     }
 
     return node;
 }
 
 
+static int ngx_libc_cdecl
+ngx_http_cmp_location_nodes(const void *one, const void *two)
+{
+    ngx_http_location_tree_node_t  *first, *second;
+
+    first = *(ngx_http_location_tree_node_t **) one;
+    second = *(ngx_http_location_tree_node_t **) two;
+
+    return (int) ngx_http_location_key(first->name[0])
+           - (int) ngx_http_location_key(second->name[0]);
+}
+
+
 ngx_int_t
 ngx_http_add_listen(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_listen_opt_t *lsopt)
@@ -1330,6 +1411,7 @@ ngx_http_add_address(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 #if (NGX_PCRE)
     addr->nregex = 0;
     addr->regex = NULL;
+    addr->regex_set = NULL;
 #endif
     addr->default_server = cscf;
     addr->servers.elts = NULL;
@@ -1436,6 +1518,7 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
     ngx_http_core_srv_conf_t  **cscfp;
 #if (NGX_PCRE)
     ngx_uint_t                  regex, i;
+    ngx_regex_elt_t            *elts;
 
     regex = 0;
 #endif
@@ -1568,6 +1651,21 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
         }
     }
 
+    if (regex >= NGX_HTTP_REGEX_SET_MIN) {
+
+        elts = ngx_palloc(cf->temp_pool, regex * sizeof(ngx_regex_elt_t));
+        if (elts == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < regex; i++) {
+            elts[i].regex = addr->regex[i].regex->regex;
+            elts[i].name = addr->regex[i].regex->name.data;
+        }
+
+        addr->regex_set = ngx_http_regex_compile_set(cf, elts, regex);
+    }
+
 #endif
 
     return NGX_OK;
@@ -1838,6 +1936,7 @@ ngx_http_add_addrs(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_PCRE)
         vn->nregex = addr[i].nregex;
         vn->regex = addr[i].regex;
+        vn->regex_set = addr[i].regex_set;
 #endif
     }
 
@@ -1903,6 +2002,7 @@ ngx_http_add_addrs6(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_PCRE)
         vn->nregex = addr[i].nregex;
         vn->regex = addr[i].regex;
+        vn->regex_set = addr[i].regex_set;
 #endif
     }
 
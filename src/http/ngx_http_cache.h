@@ -28,6 +28,11 @@
 #define NGX_HTTP_CACHE_VARY_LEN      128
 
 #define NGX_HTTP_CACHE_VERSION       5
+#define NGX_HTTP_CACHE_INDEX_VERSION 3
+
+#define NGX_HTTP_CACHE_EVICT_LRU     0
+#define NGX_HTTP_CACHE_EVICT_GDSF    1
+#define NGX_HTTP_CACHE_EVICT_SLRU    2
 
 
 typedef struct {
@@ -36,6 +41,15 @@ typedef struct {
 } ngx_http_cache_valid_t;
 
 
+typedef struct ngx_http_file_cache_tag_link_s  ngx_http_file_cache_tag_link_t;
+
+
+typedef struct {
+    size_t                           len;
+    u_char                           data[1];
+} ngx_http_file_cache_text_t;
+
+
 typedef struct {
     ngx_rbtree_node_t                node;
     ngx_queue_t                      queue;
@@ -51,7 +65,9 @@ typedef struct {
     unsigned                         updating:1;
     unsigned                         deleting:1;
     unsigned                         purged:1;
-                                     /* 10 unused bits */
+    unsigned                         promoted:1;
+    unsigned                         tier:1;
+                                     /* 8 unused bits */
 
     ngx_file_uniq_t                  uniq;
     time_t                           expire;
@@ -59,9 +75,50 @@ typedef struct {
     size_t                           body_start;
     off_t                            fs_size;
     ngx_msec_t                       lock_time;
+
+    /* the temporary file being written, for read_while_write */
+    uint32_t                         temp_number;
+    off_t                            temp_offset;
+
+    ngx_http_file_cache_tag_link_t  *tags;
+
+    /* the key text, for purge_prefix */
+    ngx_http_file_cache_text_t      *text;
 } ngx_http_file_cache_node_t;
 
 
+/* the surrogate keys index: a tag lists the nodes it was attached to */
+
+typedef struct {
+    ngx_str_node_t                   sn;
+    ngx_queue_t                      links;
+    u_char                           data[1];
+} ngx_http_file_cache_tag_t;
+
+
+struct ngx_http_file_cache_tag_link_s {
+    ngx_queue_t                      queue;
+    ngx_http_file_cache_tag_t       *tag;
+    ngx_http_file_cache_node_t      *node;
+    ngx_http_file_cache_tag_link_t  *next;
+};
+
+
+/* the leading fields match ngx_http_file_cache_node_t */
+
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_queue_t                      queue;
+
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN
+                                         - sizeof(ngx_rbtree_key_t)];
+
+    ngx_file_uniq_t                  uniq;
+    size_t                           len;
+    u_char                           data[1];
+} ngx_http_file_cache_ram_node_t;
+
+
 struct ngx_http_cache_s {
     ngx_file_t                       file;
     ngx_array_t                      keys;
@@ -80,6 +137,8 @@ struct ngx_http_cache_s {
     ngx_str_t                        vary;
     u_char                           variant[NGX_HTTP_CACHE_KEY_LEN];
 
+    ngx_str_t                        tags;
+
     size_t                           header_start;
     size_t                           body_start;
     off_t                            length;
@@ -91,6 +150,7 @@ struct ngx_http_cache_s {
     ngx_uint_t                       vary_tag;
 
     ngx_buf_t                       *buf;
+    u_char                          *ram;
 
     ngx_http_file_cache_t           *file_cache;
     ngx_http_file_cache_node_t      *node;
@@ -104,6 +164,8 @@ struct ngx_http_cache_s {
     ngx_msec_t                       lock_time;
     ngx_msec_t                       wait_time;
 
+    uint32_t                         temp_number;
+
     ngx_event_t                      wait_event;
 
     unsigned                         lock:1;
@@ -114,6 +176,8 @@ struct ngx_http_cache_s {
     unsigned                         exists:1;
     unsigned                         temp_file:1;
     unsigned                         purged:1;
+    unsigned                         tier:1;
+    unsigned                         partial:1;
     unsigned                         reading:1;
     unsigned                         secondary:1;
     unsigned                         background:1;
@@ -142,18 +206,88 @@ typedef struct {
 } ngx_http_file_cache_header_t;
 
 
+typedef struct {
+    ngx_uint_t                       version;
+    size_t                           entry_size;
+    size_t                           bsize;
+    size_t                           level[NGX_MAX_PATH_LEVEL];
+    time_t                           time;
+    ngx_uint_t                       count;
+    uint32_t                         crc32;
+} ngx_http_file_cache_index_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_file_uniq_t                  uniq;
+    time_t                           expire;
+    off_t                            fs_size;
+    size_t                           body_start;
+    ngx_uint_t                       tier;
+} ngx_http_file_cache_index_entry_t;
+
+
+/*
+ * a count-min sketch of 4-bit counters with a doorkeeper bitmap,
+ * used to estimate how often a key was requested
+ */
+
+#define NGX_HTTP_CACHE_SKETCH_DEPTH     4
+
+/* the largest frequency estimated with 4-bit counters */
+
+#define NGX_HTTP_CACHE_SKETCH_MAX_USES  16
+
+typedef struct {
+    ngx_uint_t                       mask;
+    ngx_uint_t                       additions;
+    ngx_uint_t                       sample;
+    u_char                          *doorkeeper;
+    u_char                          *counters;
+} ngx_http_file_cache_sketch_t;
+
+
 typedef struct {
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
     ngx_queue_t                      queue;
+    ngx_queue_t                      promoted;
+    ngx_rbtree_t                     tags;
+    ngx_rbtree_node_t                tags_sentinel;
     ngx_atomic_t                     cold;
     ngx_atomic_t                     loading;
     off_t                            size;
+    off_t                            tier_size;
     ngx_uint_t                       count;
+    ngx_uint_t                       npromoted;
     ngx_uint_t                       watermark;
+    ngx_http_file_cache_sketch_t    *sketch;
+
+    /* the cache manager statistics, kept in the first shard */
+    ngx_uint_t                       manager_backlog;
+    ngx_uint_t                       manager_unlink_time;
+    ngx_uint_t                       manager_deleted;
 } ngx_http_file_cache_sh_t;
 
 
+typedef struct {
+    ngx_rbtree_t                     rbtree;
+    ngx_rbtree_node_t                sentinel;
+    ngx_queue_t                      queue;
+} ngx_http_file_cache_ram_sh_t;
+
+
+typedef struct {
+    ngx_http_file_cache_ram_sh_t    *sh;
+    ngx_slab_pool_t                 *shpool;
+
+    size_t                           max_object;
+    ngx_uint_t                       min_uses;
+
+    ngx_shm_zone_t                  *shm_zone;
+} ngx_http_file_cache_ram_t;
+
+
 struct ngx_http_file_cache_s {
     ngx_http_file_cache_sh_t        *sh;
     ngx_slab_pool_t                 *shpool;
@@ -176,11 +310,45 @@ struct ngx_http_file_cache_s {
     ngx_uint_t                       manager_files;
     ngx_msec_t                       manager_sleep;
     ngx_msec_t                       manager_threshold;
+    off_t                            manager_budget;
+    off_t                            manager_deleted;
+    ngx_uint_t                       manager_backlog;
+    ngx_uint_t                       unlink_time;
+
+#if (NGX_THREADS || NGX_COMPAT)
+    ngx_thread_pool_t               *manager_thread_pool;
+#endif
 
     ngx_shm_zone_t                  *shm_zone;
 
+    ngx_http_file_cache_ram_t       *ram;
+
+    size_t                           admission;
+    ngx_http_file_cache_sketch_t    *sketch;
+
+    ngx_uint_t                       eviction;
+
+    ngx_path_t                      *tier_path;
+    off_t                            tier_max_size;
+    ngx_uint_t                       tier_min_uses;
+
+    ngx_str_t                        index;
+    ngx_str_t                        index_temp;
+    ngx_msec_t                       index_interval;
+    ngx_msec_t                       index_last;
+    time_t                           index_valid;
+    ngx_uint_t                       index_orphans;
+                                     /* unsigned index_orphans:1 */
+
+    ngx_http_file_cache_t          **shards;
+    ngx_uint_t                       nshards;
+
     ngx_uint_t                       use_temp_path;
                                      /* unsigned use_temp_path:1 */
+    ngx_uint_t                       read_while_write;
+                                     /* unsigned read_while_write:1 */
+    ngx_uint_t                       purge_prefix;
+                                     /* unsigned purge_prefix:1 */
 };
 
 
@@ -188,12 +356,16 @@ ngx_int_t ngx_http_file_cache_new(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_create(ngx_http_request_t *r);
 void ngx_http_file_cache_create_key(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
+ngx_int_t ngx_http_file_cache_purge(ngx_http_request_t *r, ngx_str_t *tags);
+ngx_int_t ngx_http_file_cache_fresh(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
+void ngx_http_file_cache_publish(ngx_http_request_t *r, ngx_temp_file_t *tf);
 void ngx_http_file_cache_update_header(ngx_http_request_t *r);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
 time_t ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status);
+ngx_http_file_cache_t *ngx_http_file_cache_path_cache(ngx_path_t *path);
 
 char *ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -209,6 +209,17 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_main_conf_t, server_names_hash_bucket_size),
       NULL },
 
+#if (NGX_PCRE)
+
+    { ngx_string("regex_set"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_core_main_conf_t, regex_set),
+      NULL },
+
+#endif
+
     { ngx_string("server"),
       NGX_HTTP_MAIN_CONF|NGX_CONF_BLOCK|NGX_CONF_NOARGS,
       ngx_http_core_server,
@@ -1558,7 +1569,28 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
     if (noregex == 0 && pclcf->regex_locations) {
 
-        for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
+        clcfp = pclcf->regex_locations;
+
+        if (pclcf->regex_set) {
+
+            /* find the first matching location in one pass */
+
+            n = ngx_http_regex_exec_set(r, pclcf->regex_set, &r->uri);
+
+            if (n == NGX_DECLINED) {
+                return rc;
+            }
+
+            if (n == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            /* the location regex itself sets the captures */
+
+            clcfp += n;
+        }
+
+        for ( /* void */ ; *clcfp; clcfp++) {
 
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "test location: ~ \"%V\"", &(*clcfp)->name);
@@ -1599,79 +1631,100 @@ static ngx_int_t
 ngx_http_core_find_static_location(ngx_http_request_t *r,
     ngx_http_location_tree_node_t *node)
 {
-    u_char     *uri;
-    size_t      len, n;
-    ngx_int_t   rc, rv;
+    u_char                          *uri, key;
+    size_t                           len;
+    ngx_int_t                        rv;
+    ngx_uint_t                       i, lo, hi;
+    ngx_http_location_tree_node_t   *child;
 
     len = r->uri.len;
     uri = r->uri.data;
 
     rv = NGX_DECLINED;
 
-    for ( ;; ) {
-
-        if (node == NULL) {
-            return rv;
-        }
+    while (node) {
 
         ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "test location: \"%*s\"",
-                       (size_t) node->len, node->name);
+                       "test location: \"%*s\"", node->len, node->name);
 
-        n = (len <= (size_t) node->len) ? len : node->len;
+        if (len < node->len) {
 
-        rc = ngx_filename_cmp(uri, node->name, n);
+            if (len + 1 == node->len
+                && node->auto_redirect
+                && ngx_filename_cmp(uri, node->name, len) == 0)
+            {
+                r->loc_conf = (node->exact) ? node->exact->loc_conf:
+                                              node->inclusive->loc_conf;
+                return NGX_DONE;
+            }
 
-        if (rc != 0) {
-            node = (rc < 0) ? node->left : node->right;
+            return rv;
+        }
 
-            continue;
+        if (ngx_filename_cmp(uri, node->name, node->len) != 0) {
+            return rv;
         }
 
-        if (len > (size_t) node->len) {
+        uri += node->len;
+        len -= node->len;
 
-            if (node->inclusive) {
+        if (len == 0) {
 
+            if (node->exact) {
+                r->loc_conf = node->exact->loc_conf;
+                return NGX_OK;
+            }
+
+            if (node->inclusive) {
                 r->loc_conf = node->inclusive->loc_conf;
-                rv = NGX_AGAIN;
+                return NGX_AGAIN;
+            }
 
-                node = node->tree;
-                uri += n;
-                len -= n;
+            for (i = 0; i < node->nchildren; i++) {
+                child = node->children[i];
 
-                continue;
+                if (child->len == 1 && child->auto_redirect) {
+                    r->loc_conf = (child->exact) ? child->exact->loc_conf:
+                                                   child->inclusive->loc_conf;
+                    return NGX_DONE;
+                }
             }
 
-            /* exact only */
-
-            node = node->right;
+            return rv;
+        }
 
-            continue;
+        if (node->inclusive) {
+            r->loc_conf = node->inclusive->loc_conf;
+            rv = NGX_AGAIN;
         }
 
-        if (len == (size_t) node->len) {
+        /* binary search for the child by the next character */
 
-            if (node->exact) {
-                r->loc_conf = node->exact->loc_conf;
-                return NGX_OK;
+        key = ngx_http_location_key(*uri);
 
-            } else {
-                r->loc_conf = node->inclusive->loc_conf;
-                return NGX_AGAIN;
-            }
-        }
+        child = NULL;
+        lo = 0;
+        hi = node->nchildren;
+
+        while (lo < hi) {
+            i = (lo + hi) / 2;
 
-        /* len < node->len */
+            if (node->keys[i] < key) {
+                lo = i + 1;
 
-        if (len + 1 == (size_t) node->len && node->auto_redirect) {
+            } else if (node->keys[i] > key) {
+                hi = i;
 
-            r->loc_conf = (node->exact) ? node->exact->loc_conf:
-                                          node->inclusive->loc_conf;
-            rv = NGX_DONE;
+            } else {
+                child = node->children[i];
+                break;
+            }
         }
 
-        node = node->left;
+        node = child;
     }
+
+    return rv;
 }
 
 
@@ -3410,6 +3463,8 @@ ngx_http_core_create_main_conf(ngx_conf_t *cf)
     cmcf->variables_hash_max_size = NGX_CONF_UNSET_UINT;
     cmcf->variables_hash_bucket_size = NGX_CONF_UNSET_UINT;
 
+    cmcf->regex_set = NGX_CONF_UNSET;
+
     return cmcf;
 }
 
@@ -3433,6 +3488,8 @@ ngx_http_core_init_main_conf(ngx_conf_t *cf, void *conf)
     cmcf->variables_hash_bucket_size =
                ngx_align(cmcf->variables_hash_bucket_size, ngx_cacheline_size);
 
+    ngx_conf_init_value(cmcf->regex_set, 0);
+
     if (cmcf->ncaptures) {
         cmcf->ncaptures = (cmcf->ncaptures + 1) * 3;
     }
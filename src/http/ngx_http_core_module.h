@@ -204,6 +204,8 @@ typedef struct {
     ngx_uint_t                 variables_hash_max_size;
     ngx_uint_t                 variables_hash_bucket_size;
 
+    ngx_flag_t                 regex_set;
+
     ngx_hash_keys_arrays_t    *variables_keys;
 
     ngx_array_t               *ports;
@@ -261,6 +263,9 @@ typedef struct {
 
     ngx_uint_t                 nregex;
     ngx_http_server_name_t    *regex;
+#if (NGX_PCRE)
+    ngx_regex_set_t           *regex_set;
+#endif
 } ngx_http_virtual_names_t;
 
 
@@ -316,6 +321,7 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_uint_t                 nregex;
     ngx_http_server_name_t    *regex;
+    ngx_regex_set_t           *regex_set;
 #endif
 
     /* the default server configuration for this address:port */
@@ -365,6 +371,7 @@ struct ngx_http_core_loc_conf_s {
     ngx_http_location_tree_node_t   *static_locations;
 #if (NGX_PCRE)
     ngx_http_core_loc_conf_t       **regex_locations;
+    ngx_regex_set_t                 *regex_set;
 #endif
 
     /* pointer to the modules' loc_conf */
@@ -496,19 +503,26 @@ typedef struct {
 
 
 struct ngx_http_location_tree_node_s {
-    ngx_http_location_tree_node_t   *left;
-    ngx_http_location_tree_node_t   *right;
-    ngx_http_location_tree_node_t   *tree;
+    ngx_http_location_tree_node_t  **children;
+    u_char                          *keys;
+    ngx_uint_t                       nchildren;
 
     ngx_http_core_loc_conf_t        *exact;
     ngx_http_core_loc_conf_t        *inclusive;
 
+    size_t                           len;
     u_char                           auto_redirect;
-    u_char                           len;
     u_char                           name[1];
 };
 
 
+#if (NGX_HAVE_CASELESS_FILESYSTEM)
+#define ngx_http_location_key(c)  ((u_char) tolower(c))
+#else
+#define ngx_http_location_key(c)  (c)
+#endif
+
+
 void ngx_http_core_run_phases(ngx_http_request_t *r);
 ngx_int_t ngx_http_core_generic_phase(ngx_http_request_t *r,
     ngx_http_phase_handler_t *ph);
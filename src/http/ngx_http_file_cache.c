@@ -16,6 +16,11 @@ static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
 static void ngx_http_file_cache_lock_wait(ngx_http_request_t *r,
     ngx_http_cache_t *c);
+static ngx_int_t ngx_http_file_cache_open_partial(ngx_http_request_t *r,
+    ngx_http_cache_t *c, uint32_t number, off_t offset);
+static ngx_int_t ngx_http_file_cache_partial_send(ngx_http_request_t *r);
+static void ngx_http_file_cache_partial_handler(ngx_http_request_t *r);
+static void ngx_http_file_cache_partial_wait_handler(ngx_event_t *ev);
 static ngx_int_t ngx_http_file_cache_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
@@ -28,6 +33,8 @@ static ngx_int_t ngx_http_cache_thread_handler(ngx_thread_task_t *task,
     ngx_file_t *file);
 static void ngx_http_cache_thread_event_handler(ngx_event_t *ev);
 #endif
+static ngx_http_file_cache_t *ngx_http_file_cache_shard(
+    ngx_http_file_cache_t *cache, u_char *key);
 static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
@@ -49,6 +56,18 @@ static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
 static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
     ngx_queue_t *q, u_char *name);
+static ngx_msec_t ngx_http_file_cache_manage(ngx_http_file_cache_t *cache);
+static ngx_uint_t ngx_http_file_cache_manager_limit(
+    ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_unlinked(ngx_http_file_cache_t *cache,
+    ngx_uint_t usec);
+static ngx_uint_t ngx_http_file_cache_usec(void);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_file_cache_unlink_post(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, u_char *name, size_t len, u_char *key);
+static void ngx_http_file_cache_unlink_thread(void *data, ngx_log_t *log);
+static void ngx_http_file_cache_unlink_event_handler(ngx_event_t *ev);
+#endif
 static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
@@ -59,10 +78,68 @@ static ngx_int_t ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx,
 static ngx_int_t ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
-    ngx_http_cache_t *c);
+    ngx_http_cache_t *c, ngx_uint_t orphan);
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static void ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache);
+static ngx_uint_t ngx_http_file_cache_invalidate(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static ngx_int_t ngx_http_file_cache_purge_tier(ngx_http_file_cache_t *cache,
+    u_char *key, ngx_log_t *log);
+static void ngx_http_file_cache_file_name(ngx_path_t *path, u_char *name,
+    u_char *key);
+static ngx_msec_t ngx_http_file_cache_tier(ngx_http_file_cache_t *cache);
+static ngx_http_file_cache_node_t *ngx_http_file_cache_tier_candidate(
+    ngx_http_file_cache_t *cache, ngx_uint_t *promote);
+static ngx_int_t ngx_http_file_cache_tier_copy(u_char *from, u_char *to,
+    u_char *temp, ngx_file_uniq_t *uniq);
+static ngx_int_t ngx_http_file_cache_purge_file(ngx_http_file_cache_t *cache,
+    u_char *name, u_char *key, ngx_log_t *log);
+static void ngx_http_file_cache_tags_add(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_str_t *value);
+static void ngx_http_file_cache_tags_free(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static void ngx_http_file_cache_text_add(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_array_t *keys);
+static void ngx_http_file_cache_text_free(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static ngx_msec_t ngx_http_file_cache_index_save(
+    ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_index_copy(ngx_http_file_cache_t *cache,
+    u_char *cursor, u_char *last, ngx_http_file_cache_index_entry_t *entries,
+    ngx_uint_t *n);
+static ngx_int_t ngx_http_file_cache_index_load(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_index_add(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_entry_t *entry);
+
+static ngx_int_t ngx_http_file_cache_sketch_init(
+    ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_admit(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_sketch_add(
+    ngx_http_file_cache_sketch_t *sketch, u_char *key);
+static ngx_uint_t ngx_http_file_cache_sketch_estimate(
+    ngx_http_file_cache_sketch_t *sketch, u_char *key);
+static void ngx_http_file_cache_enqueue(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_uint_t hit);
+static ngx_uint_t ngx_http_file_cache_demote(ngx_http_file_cache_t *cache,
+    ngx_uint_t tail);
+static ngx_queue_t *ngx_http_file_cache_victim(ngx_http_file_cache_t *cache);
+
+static ngx_int_t ngx_http_file_cache_ram_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_http_file_cache_ram_open(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_ram_add(ngx_http_request_t *r,
+    ngx_http_cache_t *c, size_t n);
+static void ngx_http_file_cache_ram_update(ngx_http_cache_t *c,
+    ngx_http_file_cache_header_t *h);
+static void ngx_http_file_cache_ram_delete(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_http_file_cache_ram_node_t *ngx_http_file_cache_ram_lookup(
+    ngx_http_file_cache_ram_t *ram, u_char *key);
+static void ngx_http_file_cache_ram_free(ngx_http_file_cache_ram_t *ram,
+    ngx_http_file_cache_ram_node_t *rn);
 
 
 ngx_str_t  ngx_http_cache_status[] = {
@@ -79,6 +156,21 @@ ngx_str_t  ngx_http_cache_status[] = {
 static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_http_file_cache_t       *cache;
+    ngx_file_uniq_t              uniq;
+    ngx_uint_t                   time;
+    ngx_err_t                    err;
+    ngx_uint_t                   skipped;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
+    u_char                       name[1];
+} ngx_http_file_cache_unlink_t;
+
+#endif
+
+
 static ngx_int_t
 ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
@@ -101,6 +193,18 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if ((cache->tier_path == NULL) != (ocache->tier_path == NULL)
+            || (cache->tier_path
+                && ngx_strcmp(cache->tier_path->name.data,
+                              ocache->tier_path->name.data)
+                   != 0))
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously a different tier",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
         for (n = 0; n < NGX_MAX_PATH_LEVEL; n++) {
             if (cache->path->level[n] != ocache->path->level[n]) {
                 ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
@@ -116,12 +220,13 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
         cache->bsize = ocache->bsize;
 
         cache->max_size /= cache->bsize;
+        cache->tier_max_size /= cache->bsize;
 
         if (!cache->sh->cold || cache->sh->loading) {
             cache->path->loader = NULL;
         }
 
-        return NGX_OK;
+        return ngx_http_file_cache_sketch_init(cache);
     }
 
     cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
@@ -130,7 +235,7 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
         cache->sh = cache->shpool->data;
         cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
-        return NGX_OK;
+        return ngx_http_file_cache_sketch_init(cache);
     }
 
     cache->sh = ngx_slab_alloc(cache->shpool, sizeof(ngx_http_file_cache_sh_t));
@@ -144,16 +249,23 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
                     ngx_http_file_cache_rbtree_insert_value);
 
     ngx_queue_init(&cache->sh->queue);
+    ngx_queue_init(&cache->sh->promoted);
+
+    ngx_rbtree_init(&cache->sh->tags, &cache->sh->tags_sentinel,
+                    ngx_str_rbtree_insert_value);
 
     cache->sh->cold = 1;
     cache->sh->loading = 0;
     cache->sh->size = 0;
+    cache->sh->tier_size = 0;
     cache->sh->count = 0;
+    cache->sh->npromoted = 0;
     cache->sh->watermark = (ngx_uint_t) -1;
 
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
     cache->max_size /= cache->bsize;
+    cache->tier_max_size /= cache->bsize;
 
     len = sizeof(" in cache keys zone \"\"") + shm_zone->shm.name.len;
 
@@ -167,7 +279,7 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     cache->shpool->log_nomem = 0;
 
-    return NGX_OK;
+    return ngx_http_file_cache_sketch_init(cache);
 }
 
 
@@ -201,7 +313,9 @@ ngx_http_file_cache_create(ngx_http_request_t *r)
     ngx_http_file_cache_t  *cache;
 
     c = r->cache;
-    cache = c->file_cache;
+
+    cache = ngx_http_file_cache_shard(c->file_cache, c->key);
+    c->file_cache = cache;
 
     cln = ngx_pool_cleanup_add(r->pool, 0);
     if (cln == NULL) {
@@ -215,7 +329,9 @@ ngx_http_file_cache_create(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    if (ngx_http_file_cache_name(r, cache->path) != NGX_OK) {
+    if (ngx_http_file_cache_name(r, c->tier ? cache->tier_path : cache->path)
+        != NGX_OK)
+    {
         return NGX_ERROR;
     }
 
@@ -281,9 +397,9 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         return ngx_http_file_cache_read(r, c);
     }
 
-    cache = c->file_cache;
-
     if (c->node == NULL) {
+        c->file_cache = ngx_http_file_cache_shard(c->file_cache, c->key);
+
         cln = ngx_pool_cleanup_add(r->pool, 0);
         if (cln == NULL) {
             return NGX_ERROR;
@@ -293,6 +409,14 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         cln->data = c;
     }
 
+    cache = c->file_cache;
+
+    if (c->node == NULL && cache->sketch) {
+        if (ngx_http_file_cache_admit(cache, c) == NGX_DECLINED) {
+            return NGX_HTTP_CACHE_SCARCE;
+        }
+    }
+
     rc = ngx_http_file_cache_exists(cache, c);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -334,7 +458,9 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         }
     }
 
-    if (ngx_http_file_cache_name(r, cache->path) != NGX_OK) {
+    if (ngx_http_file_cache_name(r, c->tier ? cache->tier_path : cache->path)
+        != NGX_OK)
+    {
         return NGX_ERROR;
     }
 
@@ -342,6 +468,18 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         goto done;
     }
 
+    if (cache->ram && c->exists) {
+        rc = ngx_http_file_cache_ram_open(r, c);
+
+        if (rc == NGX_OK) {
+            return ngx_http_file_cache_read(r, c);
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
@@ -401,6 +539,9 @@ done:
 static ngx_int_t
 ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
+    off_t                      offset;
+    uint32_t                   number;
+    ngx_int_t                  rc;
     ngx_msec_t                 now, timer;
     ngx_http_file_cache_t     *cache;
 
@@ -419,20 +560,32 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
     if (!c->node->updating || (ngx_msec_int_t) timer <= 0) {
         c->node->updating = 1;
         c->node->lock_time = now + c->lock_age;
+        c->node->temp_number = 0;
         c->updating = 1;
         c->lock_time = c->node->lock_time;
     }
 
+    number = c->node->temp_number;
+    offset = c->node->temp_offset;
+
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache lock u:%d wt:%M",
-                   c->updating, c->wait_time);
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache lock u:%d wt:%M t:%uD",
+                   c->updating, c->wait_time, number);
 
     if (c->updating) {
         return NGX_DECLINED;
     }
 
+    if (number && cache->read_while_write && r == r->main) {
+        rc = ngx_http_file_cache_open_partial(r, c, number, offset);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
     if (c->lock_timeout == 0) {
         return NGX_HTTP_CACHE_SCARCE;
     }
@@ -504,6 +657,14 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     if (c->node->updating && (ngx_msec_int_t) timer > 0) {
         wait = 1;
+
+        /* the response being received can be read while it is written */
+
+        if (c->node->temp_number && cache->read_while_write
+            && r == r->main)
+        {
+            wait = 0;
+        }
     }
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
@@ -521,6 +682,77 @@ wakeup:
 }
 
 
+static ngx_int_t
+ngx_http_file_cache_open_partial(ngx_http_request_t *r, ngx_http_cache_t *c,
+    uint32_t number, off_t offset)
+{
+    u_char                   *name;
+    ngx_fd_t                  fd;
+    ngx_err_t                 err;
+    ngx_pool_cleanup_t       *cln;
+    ngx_pool_cleanup_file_t  *clnf;
+
+    /* the temporary file is created by the name of the cache file */
+
+    name = ngx_pnalloc(r->pool, c->file.name.len + 1 + 10 + 1);
+    if (name == NULL) {
+        return NGX_ERROR;
+    }
+
+    (void) ngx_sprintf(name, "%V.%010uD%Z", &c->file.name, number);
+
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_pool_cleanup_file_t));
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        /* the response may have been already stored or discarded */
+
+        if (err == NGX_ENOENT) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http file cache partial \"%s\" not found",
+                           name);
+            return NGX_DECLINED;
+        }
+
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
+                      ngx_open_file_n " \"%s\" failed", name);
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_pool_cleanup_file;
+    clnf = cln->data;
+
+    clnf->fd = fd;
+    clnf->name = name;
+    clnf->log = r->pool->log;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache partial \"%s\" fd:%d size:%O",
+                   name, fd, offset);
+
+    c->file.fd = fd;
+    c->file.log = r->connection->log;
+    c->uniq = 0;
+    c->length = offset;
+    c->fs_size = 0;
+    c->temp_number = number;
+    c->partial = 1;
+
+    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    if (c->buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_file_cache_read(r, c);
+}
+
+
 static ngx_int_t
 ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
@@ -533,10 +765,15 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     ngx_http_file_cache_t         *cache;
     ngx_http_file_cache_header_t  *h;
 
-    n = ngx_http_file_cache_aio_read(r, c);
+    if (c->ram) {
+        n = ngx_min(c->length, (off_t) c->body_start);
 
-    if (n < 0) {
-        return n;
+    } else {
+        n = ngx_http_file_cache_aio_read(r, c);
+
+        if (n < 0) {
+            return n;
+        }
     }
 
     if ((size_t) n < c->header_start) {
@@ -594,6 +831,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         if (ngx_memcmp(c->variant, h->variant, NGX_HTTP_CACHE_KEY_LEN) != 0) {
             ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "http file cache vary mismatch");
+            c->partial = 0;
             return ngx_http_file_cache_reopen(r, c);
         }
     }
@@ -612,6 +850,10 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     r->cached = 1;
 
+    if (c->partial) {
+        return NGX_OK;
+    }
+
     cache = c->file_cache;
 
     if (cache->sh->cold) {
@@ -621,11 +863,16 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         if (!c->node->exists) {
             c->node->uses = 1;
             c->node->body_start = c->body_start;
+            c->node->valid_sec = c->valid_sec;
             c->node->exists = 1;
             c->node->uniq = c->uniq;
             c->node->fs_size = c->fs_size;
 
             cache->sh->size += c->fs_size;
+
+            if (c->node->tier) {
+                cache->sh->tier_size += c->fs_size;
+            }
         }
 
         ngx_shmtx_unlock(&cache->shpool->mutex);
@@ -658,6 +905,10 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         return rc;
     }
 
+    if (cache->ram && c->ram == NULL) {
+        ngx_http_file_cache_ram_add(r, c, n);
+    }
+
     return NGX_OK;
 }
 
@@ -815,6 +1066,24 @@ ngx_http_cache_thread_event_handler(ngx_event_t *ev)
 #endif
 
 
+static ngx_http_file_cache_t *
+ngx_http_file_cache_shard(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_uint_t  n;
+
+    if (cache->shards == NULL) {
+        return cache;
+    }
+
+    /* the leading key bytes are used as the rbtree key */
+
+    n = (key[NGX_HTTP_CACHE_KEY_LEN - 2] << 8)
+        | key[NGX_HTTP_CACHE_KEY_LEN - 1];
+
+    return cache->shards[n % cache->nshards];
+}
+
+
 static ngx_int_t
 ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
@@ -902,6 +1171,8 @@ renew:
 
     rc = NGX_DECLINED;
 
+    ngx_http_file_cache_tags_free(cache, fcn);
+
     fcn->valid_msec = 0;
     fcn->error = 0;
     fcn->exists = 0;
@@ -914,10 +1185,15 @@ done:
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    if (cache->purge_prefix && fcn->text == NULL) {
+        ngx_http_file_cache_text_add(cache, fcn, &c->keys);
+    }
+
+    ngx_http_file_cache_enqueue(cache, fcn, fcn->exists);
 
     c->uniq = fcn->uniq;
     c->error = fcn->error;
+    c->tier = fcn->tier;
     c->node = fcn;
 
 failed:
@@ -1230,6 +1506,7 @@ ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
     c->secondary = 1;
     c->file.name.len = 0;
     c->body_start = c->buf->end - c->buf->start;
+    c->ram = NULL;
 
     ngx_memcpy(c->key, c->variant, NGX_HTTP_CACHE_KEY_LEN);
 
@@ -1331,6 +1608,7 @@ ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     c->node->count--;
     c->node->updating = 0;
+    c->node->purged = 0;
     c->node = NULL;
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
@@ -1339,11 +1617,16 @@ ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     ngx_memcpy(c->key, c->main, NGX_HTTP_CACHE_KEY_LEN);
 
+    cache = ngx_http_file_cache_shard(cache, c->key);
+    c->file_cache = cache;
+
     if (ngx_http_file_cache_exists(cache, c) == NGX_ERROR) {
         return NGX_ERROR;
     }
 
-    if (ngx_http_file_cache_name(r, cache->path) != NGX_OK) {
+    if (ngx_http_file_cache_name(r, c->tier ? cache->tier_path : cache->path)
+        != NGX_OK)
+    {
         return NGX_ERROR;
     }
 
@@ -1356,6 +1639,7 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 {
     off_t                   fs_size;
     ngx_int_t               rc;
+    ngx_uint_t              purged;
     ngx_file_uniq_t         uniq;
     ngx_file_info_t         fi;
     ngx_http_cache_t        *c;
@@ -1392,6 +1676,10 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     rc = ngx_ext_rename_file(&tf->file.name, &c->file.name, &ext);
 
+    if (cache->ram) {
+        ngx_http_file_cache_ram_delete(cache, c->key);
+    }
+
     if (rc == NGX_OK) {
 
         if (ngx_fd_info(tf->file.fd, &fi) == NGX_FILE_ERROR) {
@@ -1408,21 +1696,137 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     ngx_shmtx_lock(&cache->shpool->mutex);
 
+    /* the entry was purged while the response was being received */
+
+    purged = c->node->purged;
+
+    if (purged) {
+        c->node->purged = 0;
+
+        if (rc == NGX_OK) {
+            rc = NGX_DECLINED;
+            uniq = 0;
+            fs_size = 0;
+        }
+    }
+
     c->node->count--;
     c->node->error = 0;
     c->node->uniq = uniq;
+
+    if (c->temp_number && c->node->temp_number == c->temp_number) {
+        c->node->temp_number = 0;
+    }
     c->node->body_start = c->body_start;
 
     cache->sh->size += fs_size - c->node->fs_size;
+
+    if (c->node->tier) {
+        cache->sh->tier_size += fs_size - c->node->fs_size;
+    }
+
     c->node->fs_size = fs_size;
 
     if (rc == NGX_OK) {
         c->node->exists = 1;
+        c->node->valid_sec = c->valid_sec;
+
+        if (c->tags.len) {
+            ngx_http_file_cache_tags_add(cache, c->node, &c->tags);
+
+        } else {
+            ngx_http_file_cache_tags_free(cache, c->node);
+        }
     }
 
     c->node->updating = 0;
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (purged && rc == NGX_DECLINED) {
+        (void) ngx_http_file_cache_purge_file(cache, c->file.name.data,
+                                              c->key, r->connection->log);
+    }
+}
+
+
+ngx_int_t
+ngx_http_file_cache_fresh(ngx_http_request_t *r)
+{
+    ngx_int_t                    rc;
+    ngx_http_cache_t            *c;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
+
+    c = r->cache;
+    cache = ngx_http_file_cache_shard(c->file_cache, c->key);
+
+    rc = NGX_DECLINED;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = ngx_http_file_cache_lookup(cache, c->key);
+
+    /* valid_sec of an entry is not known after it was loaded from disk */
+
+    if (fcn && fcn->exists && !fcn->error && !fcn->updating
+        && fcn->valid_sec >= ngx_time())
+    {
+        rc = NGX_OK;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache fresh: %i", rc);
+
+    return rc;
+}
+
+
+void
+ngx_http_file_cache_publish(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    off_t                   n;
+    ngx_http_cache_t       *c;
+    ngx_http_file_cache_t  *cache;
+
+    c = r->cache;
+    cache = c->file_cache;
+
+    if (!cache->read_while_write
+        || !c->updating
+        || c->updated
+        || tf->file.fd == NGX_INVALID_FILE
+        || tf->offset < (off_t) c->body_start)
+    {
+        return;
+    }
+
+    /* the name of a temporary file ends with its number */
+
+    if (c->temp_number == 0) {
+        n = ngx_atoof(tf->file.name.data + tf->file.name.len - 10, 10);
+
+        if (n <= 0) {
+            return;
+        }
+
+        c->temp_number = (uint32_t) n;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache publish: %uD %O",
+                   c->temp_number, tf->offset);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (c->node->updating && c->node->lock_time == c->lock_time) {
+        c->node->temp_number = c->temp_number;
+        c->node->temp_offset = tf->offset;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 }
 
 
@@ -1546,8 +1950,18 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
         ngx_memcpy(h.variant, c->variant, NGX_HTTP_CACHE_KEY_LEN);
     }
 
-    (void) ngx_write_file(&file, (u_char *) &h,
-                          sizeof(ngx_http_file_cache_header_t), 0);
+    if (ngx_write_file(&file, (u_char *) &h,
+                       sizeof(ngx_http_file_cache_header_t), 0)
+        != NGX_ERROR)
+    {
+        ngx_shmtx_lock(&c->file_cache->shpool->mutex);
+        c->node->valid_sec = c->valid_sec;
+        ngx_shmtx_unlock(&c->file_cache->shpool->mutex);
+
+        if (c->file_cache->ram) {
+            ngx_http_file_cache_ram_update(c, &h);
+        }
+    }
 
 done:
 
@@ -1582,9 +1996,21 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
-    if (b->file == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (c->ram == NULL) {
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    if (c->partial) {
+
+        /*
+         * the body is sent in parts while it is written, and multipart
+         * ranges need the whole body in a single buffer
+         */
+
+        r->single_range = 1;
     }
 
     rc = ngx_http_send_header(r);
@@ -1593,16 +2019,39 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return rc;
     }
 
-    b->file_pos = c->body_start;
-    b->file_last = c->length;
+    if (c->partial) {
+        r->read_event_handler = ngx_http_block_reading;
+        r->write_event_handler = ngx_http_file_cache_partial_handler;
+
+        c->wait_event.handler = ngx_http_file_cache_partial_wait_handler;
+        c->wait_event.data = r;
+        c->wait_event.log = r->connection->log;
+
+        /* c->length is the part of the response already sent */
+
+        c->length = c->body_start;
+
+        return ngx_http_file_cache_partial_send(r);
+    }
 
-    b->in_file = (c->length - c->body_start) ? 1: 0;
     b->last_buf = (r == r->main) ? 1: 0;
     b->last_in_chain = 1;
 
-    b->file->fd = c->file.fd;
-    b->file->name = c->file.name;
-    b->file->log = r->connection->log;
+    if (c->ram) {
+        b->pos = c->ram + c->body_start;
+        b->last = c->ram + c->length;
+        b->memory = (c->length - c->body_start) ? 1: 0;
+
+    } else {
+        b->file_pos = c->body_start;
+        b->file_last = c->length;
+
+        b->in_file = (c->length - c->body_start) ? 1: 0;
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+    }
 
     out.buf = b;
     out.next = NULL;
@@ -1611,43 +2060,251 @@ ngx_http_cache_send(ngx_http_request_t *r)
 }
 
 
-void
-ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
+static ngx_int_t
+ngx_http_file_cache_partial_send(ngx_http_request_t *r)
 {
-    ngx_http_file_cache_t       *cache;
-    ngx_http_file_cache_node_t  *fcn;
-
-    if (c->updated || c->node == NULL) {
-        return;
-    }
+    off_t                      offset;
+    ngx_int_t                  rc;
+    ngx_buf_t                 *b;
+    ngx_uint_t                 done;
+    ngx_chain_t                out;
+    ngx_event_t               *wev;
+    ngx_file_uniq_t            uniq;
+    ngx_file_info_t            fi;
+    ngx_http_cache_t          *c;
+    ngx_http_file_cache_t     *cache;
+    ngx_http_core_loc_conf_t  *clcf;
 
+    c = r->cache;
     cache = c->file_cache;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                   "http file cache free, fd: %d", c->file.fd);
-
     ngx_shmtx_lock(&cache->shpool->mutex);
 
-    fcn = c->node;
-    fcn->count--;
+    done = (c->node->temp_number != c->temp_number);
+    uniq = c->node->exists ? c->node->uniq : 0;
+    offset = c->node->temp_offset;
 
-    if (c->updating && fcn->lock_time == c->lock_time) {
-        fcn->updating = 0;
-    }
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    if (c->error) {
-        fcn->error = c->error;
+    if (done) {
 
-        if (c->valid_sec) {
-            fcn->valid_sec = c->valid_sec;
-            fcn->valid_msec = c->valid_msec;
+        /*
+         * the writer has finished, the file was either renamed
+         * to the cache file or discarded
+         */
+
+        if (ngx_fd_info(c->file.fd, &fi) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                          ngx_fd_info_n " \"%s\" failed",
+                          c->file.name.data);
+            return NGX_ERROR;
         }
 
-    } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
-        ngx_queue_remove(&fcn->queue);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        cache->sh->count--;
+        if (uniq != ngx_file_uniq(&fi)) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "cache file \"%s\" was not completed",
+                          c->file.name.data);
+            return NGX_ERROR;
+        }
+
+        offset = ngx_file_size(&fi);
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache partial send: %O-%O d:%ui",
+                   c->length, offset, done);
+
+    if (offset > c->length || done) {
+
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->file_pos = c->length;
+        b->file_last = ngx_max(offset, c->length);
+
+        b->in_file = (b->file_last - b->file_pos) ? 1: 0;
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+
+        if (done) {
+            b->last_buf = 1;
+            b->last_in_chain = 1;
+
+        } else {
+            b->flush = 1;
+        }
+
+        c->length = b->file_last;
+
+        out.buf = b;
+        out.next = NULL;
+
+        rc = ngx_http_output_filter(r, &out);
+
+        if (rc == NGX_ERROR || done) {
+            return rc;
+        }
+    }
+
+    wev = r->connection->write;
+
+    if (r->buffered || r->postponed || r->connection->buffered) {
+
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (!wev->delayed) {
+            ngx_add_timer(wev, clcf->send_timeout);
+        }
+
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_DONE;
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    ngx_add_timer(&c->wait_event, 100);
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_file_cache_partial_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                  rc;
+    ngx_event_t               *wev;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    wev = r->connection->write;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, wev->log, 0,
+                   "http file cache partial handler: \"%V?%V\"",
+                   &r->uri, &r->args);
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, NGX_ETIMEDOUT,
+                      "client timed out");
+        r->connection->timedout = 1;
+
+        ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    if (wev->delayed || r->aio) {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (!wev->delayed) {
+            ngx_add_timer(wev, clcf->send_timeout);
+        }
+
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+        }
+
+        return;
+    }
+
+    if (r->cache->wait_event.timer_set) {
+        ngx_del_timer(&r->cache->wait_event);
+    }
+
+    if (ngx_http_output_filter(r, NULL) == NGX_ERROR) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+        return;
+    }
+
+    rc = ngx_http_file_cache_partial_send(r);
+
+    if (rc == NGX_DONE) {
+        return;
+    }
+
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    ngx_http_finalize_request(r, rc);
+}
+
+
+static void
+ngx_http_file_cache_partial_wait_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    r->write_event_handler(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+void
+ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
+{
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
+
+    if (c->updated || c->node == NULL) {
+        return;
+    }
+
+    cache = c->file_cache;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache free, fd: %d", c->file.fd);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = c->node;
+    fcn->count--;
+
+    if (c->updating && fcn->lock_time == c->lock_time) {
+        fcn->updating = 0;
+        fcn->temp_number = 0;
+
+        /* the purge was for the response which is not cached */
+
+        fcn->purged = 0;
+    }
+
+    if (c->error) {
+        fcn->error = c->error;
+
+        if (c->valid_sec) {
+            fcn->valid_sec = c->valid_sec;
+            fcn->valid_msec = c->valid_msec;
+        }
+
+    } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
+        if (fcn->promoted) {
+            cache->sh->npromoted--;
+        }
+
+        ngx_http_file_cache_tags_free(cache, fcn);
+        ngx_http_file_cache_text_free(cache, fcn);
+
+        ngx_queue_remove(&fcn->queue);
+        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+        ngx_slab_free_locked(cache->shpool, fcn);
+        cache->sh->count--;
         c->node = NULL;
     }
 
@@ -1715,19 +2372,33 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
     path = cache->path;
     len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
 
+    if (cache->tier_path) {
+        len += cache->tier_path->name.len;
+    }
+
     name = ngx_alloc(len + 1, ngx_cycle->log);
     if (name == NULL) {
         return 10;
     }
 
-    ngx_memcpy(name, path->name.data, path->name.len);
-
     wait = 10;
     tries = 20;
     sentinel = NULL;
 
     ngx_shmtx_lock(&cache->shpool->mutex);
 
+    if (ngx_queue_empty(&cache->sh->queue)) {
+        (void) ngx_http_file_cache_demote(cache, 0);
+    }
+
+    q = ngx_http_file_cache_victim(cache);
+
+    if (q) {
+        ngx_http_file_cache_delete(cache, q, name);
+        wait = 0;
+        goto done;
+    }
+
     for ( ;; ) {
         if (ngx_queue_empty(&cache->sh->queue)) {
             break;
@@ -1783,6 +2454,8 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
         break;
     }
 
+done:
+
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
     ngx_free(name);
@@ -1809,17 +2482,32 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
     path = cache->path;
     len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
 
+    if (cache->tier_path) {
+        len += cache->tier_path->name.len;
+    }
+
     name = ngx_alloc(len + 1, ngx_cycle->log);
     if (name == NULL) {
         return 10;
     }
 
-    ngx_memcpy(name, path->name.data, path->name.len);
-
     now = ngx_time();
 
     ngx_shmtx_lock(&cache->shpool->mutex);
 
+    /* inactive protected entries are expired from the probation segment */
+
+    while (!ngx_queue_empty(&cache->sh->promoted)) {
+        q = ngx_queue_last(&cache->sh->promoted);
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        if (fcn->expire > now) {
+            break;
+        }
+
+        (void) ngx_http_file_cache_demote(cache, 1);
+    }
+
     for ( ;; ) {
 
         if (ngx_quit || ngx_terminate) {
@@ -1879,7 +2567,7 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
 next:
 
-        if (++cache->files >= cache->manager_files) {
+        if (ngx_http_file_cache_manager_limit(cache)) {
             wait = 0;
             break;
         }
@@ -1908,43 +2596,94 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
 {
     u_char                      *p;
     size_t                       len;
+    ngx_uint_t                   start;
     ngx_path_t                  *path;
+    ngx_http_file_cache_t       *first;
     ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
 
     fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
     if (fcn->exists) {
         cache->sh->size -= fcn->fs_size;
 
-        path = cache->path;
-        p = name + path->name.len + 1 + path->len;
+        if (fcn->tier) {
+            cache->sh->tier_size -= fcn->fs_size;
+        }
+
+        first = cache->shards ? cache->shards[0] : cache;
+        first->manager_deleted += fcn->fs_size * cache->bsize;
+
+        ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        path = fcn->tier ? cache->tier_path : cache->path;
+        p = ngx_cpymem(name, path->name.data, path->name.len);
+        p += 1 + path->len;
         p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
                          sizeof(ngx_rbtree_key_t));
         len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
         p = ngx_hex_dump(p, fcn->key, len);
         *p = '\0';
 
+        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+#if (NGX_THREADS)
+
+        /*
+         * the node is removed right away, and the file is unlinked
+         * by a thread; the task is declined outside of the cache manager
+         */
+
+        if (ngx_http_file_cache_unlink_post(cache, fcn, name, len, key)
+            == NGX_OK)
+        {
+            goto done;
+        }
+
+#endif
+
         fcn->count++;
         fcn->deleting = 1;
         ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
         ngx_create_hashed_filename(path, name, len);
 
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                        "http file cache expire: \"%s\"", name);
 
+        start = ngx_http_file_cache_usec();
+
         if (ngx_delete_file(name) == NGX_FILE_ERROR) {
             ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
                           ngx_delete_file_n " \"%s\" failed", name);
         }
 
+        ngx_http_file_cache_unlinked(first,
+                                     ngx_http_file_cache_usec() - start);
+
+        if (cache->ram) {
+            ngx_http_file_cache_ram_delete(cache, key);
+        }
+
         ngx_shmtx_lock(&cache->shpool->mutex);
         fcn->count--;
         fcn->deleting = 0;
     }
 
+#if (NGX_THREADS)
+done:
+#endif
+
     if (fcn->count == 0) {
+        if (fcn->promoted) {
+            cache->sh->npromoted--;
+        }
+
+        ngx_http_file_cache_tags_free(cache, fcn);
+        ngx_http_file_cache_text_free(cache, fcn);
+
         ngx_queue_remove(q);
         ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
         ngx_slab_free_locked(cache->shpool, fcn);
@@ -1958,6 +2697,60 @@ ngx_http_file_cache_manager(void *data)
 {
     ngx_http_file_cache_t  *cache = data;
 
+    ngx_uint_t  i;
+    ngx_msec_t  next, n;
+
+    cache->manager_deleted = 0;
+
+    if (cache->shards == NULL) {
+        next = ngx_http_file_cache_manage(cache);
+
+    } else {
+        next = ngx_http_file_cache_manage(cache->shards[0]);
+
+        for (i = 1; i < cache->nshards; i++) {
+
+            if (ngx_quit || ngx_terminate) {
+                break;
+            }
+
+            n = ngx_http_file_cache_manage(cache->shards[i]);
+
+            if (n < next) {
+                next = n;
+            }
+        }
+    }
+
+    for (i = 0; cache->tier_path && i < (cache->shards ? cache->nshards : 1);
+         i++)
+    {
+        if (ngx_quit || ngx_terminate) {
+            break;
+        }
+
+        n = ngx_http_file_cache_tier(cache->shards ? cache->shards[i] : cache);
+
+        if (n < next) {
+            next = n;
+        }
+    }
+
+    if (cache->index_interval && !ngx_quit && !ngx_terminate) {
+        n = ngx_http_file_cache_index_save(cache);
+
+        if (n < next) {
+            next = n;
+        }
+    }
+
+    return next;
+}
+
+
+static ngx_msec_t
+ngx_http_file_cache_manage(ngx_http_file_cache_t *cache)
+{
     off_t       size;
     time_t      wait;
     ngx_msec_t  elapsed, next;
@@ -2001,7 +2794,7 @@ ngx_http_file_cache_manager(void *data)
             break;
         }
 
-        if (++cache->files >= cache->manager_files) {
+        if (ngx_http_file_cache_manager_limit(cache)) {
             next = cache->manager_sleep;
             break;
         }
@@ -2028,247 +2821,2427 @@ done:
 }
 
 
-static void
-ngx_http_file_cache_loader(void *data)
+static ngx_msec_t
+ngx_http_file_cache_tier(ngx_http_file_cache_t *cache)
 {
-    ngx_http_file_cache_t  *cache = data;
-
-    ngx_tree_ctx_t  tree;
+    u_char                      *from, *to, *temp, *name;
+    size_t                       len;
+    ngx_int_t                    rc;
+    ngx_msec_t                   elapsed, next;
+    ngx_uint_t                   n, promote;
+    ngx_path_t                  *src, *dst;
+    ngx_file_uniq_t              uniq, nuniq;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
 
-    if (!cache->sh->cold || cache->sh->loading) {
-        return;
-    }
+    len = ngx_max(cache->path->name.len, cache->tier_path->name.len)
+          + 1 + cache->path->len + 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10 + 1;
 
-    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
-        return;
+    from = ngx_alloc(3 * len, ngx_cycle->log);
+    if (from == NULL) {
+        return cache->manager_sleep;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache loader");
+    to = from + len;
+    temp = to + len;
 
-    tree.init_handler = NULL;
-    tree.file_handler = ngx_http_file_cache_manage_file;
-    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
-    tree.post_tree_handler = ngx_http_file_cache_noop;
-    tree.spec_handler = ngx_http_file_cache_delete_file;
-    tree.data = cache;
-    tree.alloc = 0;
-    tree.log = ngx_cycle->log;
+    /* the use counts are rechecked periodically */
 
     cache->last = ngx_current_msec;
-    cache->files = 0;
+    next = 10000;
 
-    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
-        cache->sh->loading = 0;
-        return;
-    }
+    for (n = 0; n < cache->manager_files; n++) {
 
-    cache->sh->cold = 0;
-    cache->sh->loading = 0;
+        ngx_shmtx_lock(&cache->shpool->mutex);
 
-    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
-                  "http file cache: %V %.3fM, bsize: %uz",
-                  &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
+        fcn = ngx_http_file_cache_tier_candidate(cache, &promote);
+
+        if (fcn == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            break;
+        }
+
+        ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        uniq = fcn->uniq;
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        src = promote ? cache->path : cache->tier_path;
+        dst = promote ? cache->tier_path : cache->path;
+
+        ngx_http_file_cache_file_name(src, from, key);
+        ngx_http_file_cache_file_name(dst, to, key);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache %s: \"%s\"",
+                       promote ? "promote" : "demote", from);
+
+        nuniq = uniq;
+
+        rc = ngx_http_file_cache_tier_copy(from, to, temp, &nuniq);
+
+        if (rc != NGX_OK) {
+            break;
+        }
+
+        /*
+         * the entry is switched only if it was neither used nor replaced
+         * while it was copied, so no request may still use the old file
+         */
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        fcn = ngx_http_file_cache_lookup(cache, key);
+
+        if (fcn && fcn->exists && fcn->count == 0 && !fcn->deleting
+            && fcn->tier != promote && fcn->uniq == uniq)
+        {
+            fcn->tier = promote;
+            fcn->uniq = nuniq;
+
+            if (promote) {
+                cache->sh->tier_size += fcn->fs_size;
+
+            } else {
+                cache->sh->tier_size -= fcn->fs_size;
+            }
+
+        } else {
+            rc = NGX_DECLINED;
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        /* either the old file or the unused copy is removed */
+
+        name = (rc == NGX_OK) ? from : to;
+
+        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", name);
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            break;
+        }
+
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        if (elapsed >= cache->manager_threshold) {
+            next = cache->manager_sleep;
+            break;
+        }
+    }
+
+    if (n == cache->manager_files) {
+        next = cache->manager_sleep;
+    }
+
+    ngx_free(from);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache tier: %ui n:%M", n, next);
+
+    return next;
+}
+
+
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_tier_candidate(ngx_http_file_cache_t *cache,
+    ngx_uint_t *promote)
+{
+    ngx_uint_t                   j, n;
+    ngx_queue_t                 *q, *queue;
+    ngx_http_file_cache_node_t  *fcn, *hot, *cold;
+
+    hot = NULL;
+
+    if (cache->sh->tier_size > cache->tier_max_size) {
+        goto demote;
+    }
+
+    /* the most recently used entry worth moving to the fast tier */
+
+    n = cache->manager_files;
+
+    for (j = 0; j < 2 && hot == NULL; j++) {
+
+        queue = j ? &cache->sh->queue : &cache->sh->promoted;
+
+        for (q = ngx_queue_head(queue);
+             q != ngx_queue_sentinel(queue) && n;
+             q = ngx_queue_next(q), n--)
+        {
+            fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+            if (!fcn->tier && fcn->exists && fcn->count == 0
+                && !fcn->deleting && fcn->uses >= cache->tier_min_uses)
+            {
+                hot = fcn;
+                break;
+            }
+        }
+    }
+
+    if (hot == NULL) {
+        return NULL;
+    }
+
+    if (cache->sh->tier_size + hot->fs_size <= cache->tier_max_size) {
+        *promote = 1;
+        return hot;
+    }
+
+demote:
+
+    /* the least recently used entry on the fast tier */
+
+    n = cache->manager_files;
+
+    for (j = 0; j < 2; j++) {
+
+        queue = j ? &cache->sh->promoted : &cache->sh->queue;
+
+        for (q = ngx_queue_last(queue);
+             q != ngx_queue_sentinel(queue) && n;
+             q = ngx_queue_prev(q), n--)
+        {
+            cold = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+            if (!cold->tier || !cold->exists || cold->count
+                || cold->deleting)
+            {
+                continue;
+            }
+
+            /* a full fast tier only makes room for more used entries */
+
+            if (hot && cold->uses >= hot->uses) {
+                return NULL;
+            }
+
+            *promote = 0;
+            return cold;
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_tier_copy(u_char *from, u_char *to, u_char *temp,
+    ngx_file_uniq_t *uniq)
+{
+    ngx_err_t        err;
+    ngx_file_info_t  fi;
+    ngx_copy_file_t  cf;
+
+    if (ngx_file_info(from, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_file_info_n " \"%s\" failed", from);
+        return NGX_ERROR;
+    }
+
+    if (*uniq && ngx_file_uniq(&fi) != *uniq) {
+        return NGX_DECLINED;
+    }
+
+    /* the copy is made under a temporary name skipped by the loader */
+
+    (void) ngx_sprintf(temp, "%s.%010uD%Z", to,
+                       (uint32_t) ngx_next_temp_number(0));
+
+    err = ngx_create_full_path(temp, ngx_dir_access(NGX_FILE_OWNER_ACCESS));
+    if (err) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, err,
+                      ngx_create_dir_n " \"%s\" failed", temp);
+        return NGX_ERROR;
+    }
+
+    cf.size = ngx_file_size(&fi);
+    cf.buf_size = 0;
+    cf.access = NGX_FILE_OWNER_ACCESS;
+    cf.time = ngx_file_mtime(&fi);
+    cf.log = ngx_cycle->log;
+
+    if (ngx_copy_file(from, temp, &cf) != NGX_OK) {
+        goto failed;
+    }
+
+    if (ngx_file_info(temp, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_file_info_n " \"%s\" failed", temp);
+        goto failed;
+    }
+
+    if (ngx_rename_file(temp, to) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      temp, to);
+        goto failed;
+    }
+
+    *uniq = ngx_file_uniq(&fi);
+
+    return NGX_OK;
+
+failed:
+
+    (void) ngx_delete_file(temp);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_manager_limit(ngx_http_file_cache_t *cache)
+{
+    ngx_http_file_cache_t  *first;
+
+    cache->files++;
+
+    first = cache->shards ? cache->shards[0] : cache;
+
+#if (NGX_THREADS)
+    if (first->manager_thread_pool == NULL && first->manager_budget == 0)
+#else
+    if (first->manager_budget == 0)
+#endif
+    {
+        return cache->files >= cache->manager_files;
+    }
+
+    /*
+     * the iteration stops when the bytes budget is spent, when the files
+     * already deleted are estimated to have taken manager_threshold of I/O
+     * time, or when too many unlinks are still queued to threads
+     */
+
+    if (first->manager_budget
+        && first->manager_deleted >= first->manager_budget)
+    {
+        return 1;
+    }
+
+    if (cache->files * first->unlink_time
+        >= cache->manager_threshold * 1000)
+    {
+        return 1;
+    }
+
+    return first->manager_backlog >= cache->manager_files;
+}
+
+
+static void
+ngx_http_file_cache_unlinked(ngx_http_file_cache_t *cache, ngx_uint_t usec)
+{
+    if (ngx_process != NGX_PROCESS_HELPER) {
+        return;
+    }
+
+    /* an exponentially weighted moving average of the unlink latency */
+
+    if (cache->unlink_time == 0) {
+        cache->unlink_time = usec;
+
+    } else {
+        cache->unlink_time = (cache->unlink_time * 7 + usec) / 8;
+    }
+
+    cache->sh->manager_unlink_time = cache->unlink_time;
+    cache->sh->manager_deleted++;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_usec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (ngx_uint_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_file_cache_unlink_post(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, u_char *name, size_t len, u_char *key)
+{
+    ngx_thread_task_t             *task;
+    ngx_http_file_cache_t         *first;
+    ngx_http_file_cache_unlink_t  *ctx;
+
+    first = cache->shards ? cache->shards[0] : cache;
+
+    if (first->manager_thread_pool == NULL
+        || ngx_process != NGX_PROCESS_HELPER)
+    {
+        return NGX_DECLINED;
+    }
+
+    task = ngx_calloc(sizeof(ngx_thread_task_t)
+                      + sizeof(ngx_http_file_cache_unlink_t) + len,
+                      ngx_cycle->log);
+    if (task == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx = (ngx_http_file_cache_unlink_t *) (task + 1);
+
+    ctx->cache = first;
+    ctx->uniq = fcn->uniq;
+    ngx_memcpy(ctx->key, key, NGX_HTTP_CACHE_KEY_LEN);
+
+    ngx_memcpy(ctx->name, name, len + 1);
+    ngx_create_hashed_filename(fcn->tier ? cache->tier_path : cache->path,
+                               ctx->name, len);
+
+    task->ctx = ctx;
+    task->handler = ngx_http_file_cache_unlink_thread;
+    task->event.handler = ngx_http_file_cache_unlink_event_handler;
+    task->event.data = task;
+    task->event.log = ngx_cycle->log;
+
+    if (ngx_thread_task_post(first->manager_thread_pool, task) != NGX_OK) {
+        ngx_free(task);
+        return NGX_ERROR;
+    }
+
+    first->manager_backlog++;
+    first->sh->manager_backlog = first->manager_backlog;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_unlink_thread(void *data, ngx_log_t *log)
+{
+    ngx_http_file_cache_unlink_t *ctx = data;
+
+    ngx_uint_t       start;
+    ngx_file_info_t  fi;
+
+    start = ngx_http_file_cache_usec();
+
+    /*
+     * the node is already gone, so a response cached again under
+     * the same key may have replaced the file in the meantime
+     */
+
+    if (ctx->uniq
+        && ngx_file_info(ctx->name, &fi) != NGX_FILE_ERROR
+        && ngx_file_uniq(&fi) != ctx->uniq)
+    {
+        ctx->skipped = 1;
+
+    } else if (ngx_delete_file(ctx->name) == NGX_FILE_ERROR) {
+        ctx->err = ngx_errno;
+    }
+
+    ctx->time = ngx_http_file_cache_usec() - start;
+}
+
+
+static void
+ngx_http_file_cache_unlink_event_handler(ngx_event_t *ev)
+{
+    ngx_thread_task_t             *task;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_unlink_t  *ctx;
+
+    task = ev->data;
+    ctx = task->ctx;
+    cache = ctx->cache;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http file cache unlink: \"%s\" s:%ui",
+                   ctx->name, ctx->skipped);
+
+    if (ctx->err) {
+        ngx_log_error(NGX_LOG_CRIT, ev->log, ctx->err,
+                      ngx_delete_file_n " \"%s\" failed", ctx->name);
+    }
+
+    cache->manager_backlog--;
+    cache->sh->manager_backlog = cache->manager_backlog;
+
+    if (!ctx->skipped) {
+        ngx_http_file_cache_unlinked(cache, ctx->time);
+
+        if (cache->ram) {
+            ngx_http_file_cache_ram_delete(cache, ctx->key);
+        }
+    }
+
+    ngx_free(task);
+}
+
+#endif
+
+
+static void
+ngx_http_file_cache_loader(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    off_t           size;
+    ngx_uint_t      i;
+    ngx_tree_ctx_t  tree;
+
+    if (!cache->sh->cold || cache->sh->loading) {
+        return;
+    }
+
+    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache loader");
+
+    /*
+     * the cache is usable as soon as its index is loaded; the files
+     * written after the index was saved, as well as the files left by
+     * deletions not completed before the exit, are then added by
+     * walking the cache directory in the background
+     */
+
+    if (cache->index_interval
+        && ngx_http_file_cache_index_load(cache) == NGX_OK)
+    {
+        cache->index_orphans = 1;
+
+        for (i = 1; i < cache->nshards; i++) {
+            cache->shards[i]->sh->cold = 0;
+        }
+
+        cache->sh->cold = 0;
+    }
+
+    tree.init_handler = NULL;
+    tree.file_handler = ngx_http_file_cache_manage_file;
+    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
+    tree.post_tree_handler = ngx_http_file_cache_noop;
+    tree.spec_handler = ngx_http_file_cache_delete_file;
+    tree.data = cache;
+    tree.alloc = 0;
+    tree.log = ngx_cycle->log;
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+
+    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
+        cache->sh->loading = 0;
+        return;
+    }
+
+    if (cache->tier_path
+        && ngx_walk_tree(&tree, &cache->tier_path->name) == NGX_ABORT)
+    {
+        cache->sh->loading = 0;
+        return;
+    }
+
+    size = cache->sh->size;
+
+    for (i = 1; i < cache->nshards; i++) {
+        cache->shards[i]->sh->cold = 0;
+        size += cache->shards[i]->sh->size;
+    }
+
+    cache->sh->cold = 0;
+    cache->sh->loading = 0;
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V %.3fM, bsize: %uz",
+                  &cache->path->name,
+                  ((double) size * cache->bsize) / (1024 * 1024),
                   cache->bsize);
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    return NGX_OK;
+static ngx_int_t
+ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_msec_t              elapsed;
+    ngx_http_file_cache_t  *cache;
+
+    cache = ctx->data;
+
+    if (cache->index_interval
+        && (ngx_strcmp(path->data, cache->index.data) == 0
+            || ngx_strcmp(path->data, cache->index_temp.data) == 0))
+    {
+        return NGX_OK;
+    }
+
+    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
+        (void) ngx_http_file_cache_delete_file(ctx, path);
+    }
+
+    if (++cache->files >= cache->loader_files) {
+        ngx_http_file_cache_loader_sleep(cache);
+
+    } else {
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache loader time elapsed: %M", elapsed);
+
+        if (elapsed >= cache->loader_threshold) {
+            ngx_http_file_cache_loader_sleep(cache);
+        }
+    }
+
+    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    if (path->len >= 5
+        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
+{
+    ngx_msleep(cache->loader_sleep);
+
+    ngx_time_update();
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
+{
+    u_char                 *p;
+    ngx_int_t               n;
+    ngx_uint_t              i;
+    ngx_http_cache_t        c;
+    ngx_http_file_cache_t  *cache;
+
+    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * Temporary files in cache have a suffix consisting of a dot
+     * followed by 10 digits.
+     */
+
+    if (name->len >= 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10
+        && name->data[name->len - 10 - 1] == '.')
+    {
+        return NGX_OK;
+    }
+
+    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
+                      "cache file \"%s\" is too small", name->data);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&c, sizeof(ngx_http_cache_t));
+    cache = ctx->data;
+
+    if (cache->tier_path
+        && name->len > cache->tier_path->name.len
+        && name->data[cache->tier_path->name.len] == '/'
+        && ngx_strncmp(name->data, cache->tier_path->name.data,
+                       cache->tier_path->name.len)
+           == 0)
+    {
+        c.tier = 1;
+    }
+
+    c.length = ctx->size;
+    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+
+    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
+        n = ngx_hextoi(p, 2);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        p += 2;
+
+        c.key[i] = (u_char) n;
+    }
+
+    return ngx_http_file_cache_add(ngx_http_file_cache_shard(cache, c.key),
+                                   &c, cache->index_orphans);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c,
+    ngx_uint_t orphan)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = ngx_http_file_cache_lookup(cache, c->key);
+
+    if (fcn == NULL) {
+
+        fcn = ngx_slab_calloc_locked(cache->shpool,
+                                     sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_http_file_cache_set_watermark(cache);
+
+            if (cache->fail_time != ngx_time()) {
+                cache->fail_time = ngx_time();
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                           "could not allocate node%s", cache->shpool->log_ctx);
+            }
+
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
+        }
+
+        cache->sh->count++;
+
+        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+
+        fcn->uses = 1;
+        fcn->exists = 1;
+        fcn->fs_size = c->fs_size;
+        fcn->tier = c->tier;
+
+        cache->sh->size += c->fs_size;
+
+        if (fcn->tier) {
+            cache->sh->tier_size += c->fs_size;
+        }
+
+    } else if (orphan) {
+
+        /* the node was loaded from the index, or created since */
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_OK;
+
+    } else {
+        ngx_queue_remove(&fcn->queue);
+    }
+
+    fcn->expire = ngx_time() + cache->inactive;
+
+    ngx_http_file_cache_enqueue(cache, fcn, 0);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
+                   "http file cache delete: \"%s\"", path->data);
+
+    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", path->data);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
+{
+    cache->sh->watermark = cache->sh->count - cache->sh->count / 8;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache watermark: %ui", cache->sh->watermark);
+}
+
+
+ngx_int_t
+ngx_http_file_cache_purge(ngx_http_request_t *r, ngx_str_t *tags)
+{
+    u_char                          *p, *last, *name, *key;
+    size_t                           len;
+    uint32_t                         hash;
+    ngx_int_t                        rc, trc;
+    ngx_str_t                        tag, prefix, *k;
+    ngx_uint_t                       i, purged;
+    ngx_path_t                      *path;
+    ngx_queue_t                     *q;
+    ngx_array_t                      keys;
+    ngx_rbtree_t                    *tree;
+    ngx_rbtree_node_t               *node;
+    ngx_http_cache_t                *c;
+    ngx_http_file_cache_t           *cache, *shard;
+    ngx_http_file_cache_tag_t       *t;
+    ngx_http_file_cache_node_t      *fcn;
+    ngx_http_file_cache_text_t      *text;
+    ngx_http_file_cache_tag_link_t  *link;
+
+    c = r->cache;
+
+    ngx_str_null(&prefix);
+
+    /* a key ending with "*" purges all keys starting with the rest of it */
+
+    if (tags->len == 0 && c->file_cache->purge_prefix) {
+
+        len = 0;
+
+        k = c->keys.elts;
+        for (i = 0; i < c->keys.nelts; i++) {
+            len += k[i].len;
+        }
+
+        p = ngx_pnalloc(r->pool, len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        last = p;
+
+        for (i = 0; i < c->keys.nelts; i++) {
+            last = ngx_cpymem(last, k[i].data, k[i].len);
+        }
+
+        if (len && last[-1] == '*') {
+            prefix.len = len - 1;
+            prefix.data = p;
+        }
+    }
+
+    if (tags->len == 0 && prefix.data == NULL) {
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache purge key");
+
+        cache = ngx_http_file_cache_shard(c->file_cache, c->key);
+        c->file_cache = cache;
+
+        if (ngx_http_file_cache_name(r, cache->path) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        fcn = ngx_http_file_cache_lookup(cache, c->key);
+
+        purged = fcn ? ngx_http_file_cache_invalidate(cache, fcn) : 0;
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        rc = ngx_http_file_cache_purge_file(cache, c->file.name.data, c->key,
+                                            r->connection->log);
+
+        /* the file may be on either tier, if it is being moved */
+
+        if (cache->tier_path) {
+            trc = ngx_http_file_cache_purge_tier(cache, c->key,
+                                                 r->connection->log);
+
+            if (rc != NGX_OK && trc != NGX_DECLINED) {
+                rc = trc;
+            }
+        }
+
+        return purged ? NGX_OK : rc;
+    }
+
+    if (prefix.data) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache purge prefix: \"%V\"", &prefix);
+
+    } else {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache purge tags: \"%V\"", tags);
+    }
+
+    if (ngx_array_init(&keys, r->pool, 16, NGX_HTTP_CACHE_KEY_LEN) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    cache = c->file_cache;
+    rc = NGX_OK;
+
+    for (i = 0; i < (cache->shards ? cache->nshards : 1); i++) {
+
+        shard = cache->shards ? cache->shards[i] : cache;
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        tree = &shard->sh->rbtree;
+
+        if (prefix.data && tree->root != tree->sentinel) {
+            node = ngx_rbtree_min(tree->root, tree->sentinel);
+
+        } else {
+            node = NULL;
+        }
+
+        /* invalidation leaves nodes in the tree, so the walk is safe */
+
+        for ( /* void */ ; node; node = ngx_rbtree_next(tree, node)) {
+
+            fcn = (ngx_http_file_cache_node_t *) node;
+            text = fcn->text;
+
+            if (text == NULL
+                || text->len < prefix.len
+                || ngx_memcmp(text->data, prefix.data, prefix.len) != 0)
+            {
+                continue;
+            }
+
+            key = ngx_array_push(&keys);
+            if (key == NULL) {
+                rc = NGX_ERROR;
+                break;
+            }
+
+            ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+            (void) ngx_http_file_cache_invalidate(shard, fcn);
+        }
+
+        p = tags->data;
+        last = p + tags->len;
+
+        while (p < last) {
+
+            if (*p == ' ' || *p == '\t' || *p == ',') {
+                p++;
+                continue;
+            }
+
+            tag.data = p;
+
+            while (p < last && *p != ' ' && *p != '\t' && *p != ',') {
+                p++;
+            }
+
+            tag.len = p - tag.data;
+
+            hash = ngx_crc32_long(tag.data, tag.len);
+
+            t = (ngx_http_file_cache_tag_t *)
+                    ngx_str_rbtree_lookup(&shard->sh->tags, &tag, hash);
+
+            while (t) {
+                q = ngx_queue_head(&t->links);
+                link = ngx_queue_data(q, ngx_http_file_cache_tag_link_t,
+                                      queue);
+                fcn = link->node;
+
+                key = ngx_array_push(&keys);
+                if (key == NULL) {
+                    rc = NGX_ERROR;
+                    break;
+                }
+
+                ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+                ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                           NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+                /* the tag itself is freed along with its last link */
+
+                if (q == ngx_queue_last(&t->links)) {
+                    t = NULL;
+                }
+
+                (void) ngx_http_file_cache_invalidate(shard, fcn);
+            }
+
+            if (rc == NGX_ERROR) {
+                break;
+            }
+        }
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+
+        if (rc == NGX_ERROR) {
+            break;
+        }
+    }
+
+    if (keys.nelts == 0) {
+        return rc == NGX_OK ? NGX_DECLINED : rc;
+    }
+
+    path = cache->path;
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name = ngx_pnalloc(r->pool, len + 1);
+    if (name == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(name, path->name.data, path->name.len);
+
+    key = keys.elts;
+
+    for (i = 0; i < keys.nelts; i++) {
+        p = name + path->name.len + 1 + path->len;
+        p = ngx_hex_dump(p, key, NGX_HTTP_CACHE_KEY_LEN);
+        *p = '\0';
+
+        ngx_create_hashed_filename(path, name, len);
+
+        (void) ngx_http_file_cache_purge_file(cache, name, key,
+                                              r->connection->log);
+
+        if (cache->tier_path) {
+            (void) ngx_http_file_cache_purge_tier(cache, key,
+                                                  r->connection->log);
+        }
+
+        key += NGX_HTTP_CACHE_KEY_LEN;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache purged: %ui", keys.nelts);
+
+    return rc;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_invalidate(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_uint_t  exists;
+
+    ngx_http_file_cache_tags_free(cache, fcn);
+
+    exists = fcn->exists;
+
+    if (fcn->exists && !fcn->deleting) {
+        cache->sh->size -= fcn->fs_size;
+
+        if (fcn->tier) {
+            cache->sh->tier_size -= fcn->fs_size;
+        }
+    }
+
+    if (fcn->updating) {
+        fcn->purged = 1;
+    }
+
+    fcn->valid_msec = 0;
+    fcn->error = 0;
+    fcn->exists = 0;
+    fcn->valid_sec = 0;
+    fcn->uniq = 0;
+    fcn->body_start = 0;
+    fcn->fs_size = 0;
+
+    return exists;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_purge_file(ngx_http_file_cache_t *cache, u_char *name,
+    u_char *key, ngx_log_t *log)
+{
+    ngx_err_t  err;
+    ngx_int_t  rc;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http file cache purge: \"%s\"", name);
+
+    rc = NGX_OK;
+
+    if (ngx_delete_file(name) == NGX_FILE_ERROR) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, log, err,
+                          ngx_delete_file_n " \"%s\" failed", name);
+        }
+
+        rc = NGX_DECLINED;
+    }
+
+    if (cache->ram) {
+        ngx_http_file_cache_ram_delete(cache, key);
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_purge_tier(ngx_http_file_cache_t *cache, u_char *key,
+    ngx_log_t *log)
+{
+    u_char      *name;
+    size_t       len;
+    ngx_int_t    rc;
+    ngx_path_t  *path;
+
+    path = cache->tier_path;
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name = ngx_alloc(len + 1, log);
+    if (name == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_file_cache_file_name(path, name, key);
+
+    rc = ngx_http_file_cache_purge_file(cache, name, key, log);
+
+    ngx_free(name);
+
+    return rc;
+}
+
+
+static void
+ngx_http_file_cache_file_name(ngx_path_t *path, u_char *name, u_char *key)
+{
+    u_char  *p;
+    size_t   len;
+
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    p = ngx_cpymem(name, path->name.data, path->name.len);
+    p = ngx_hex_dump(p + 1 + path->len, key, NGX_HTTP_CACHE_KEY_LEN);
+    *p = '\0';
+
+    ngx_create_hashed_filename(path, name, len);
+}
+
+
+static void
+ngx_http_file_cache_tags_add(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_str_t *value)
+{
+    u_char                          *p, *last;
+    uint32_t                         hash;
+    ngx_str_t                        name;
+    ngx_http_file_cache_tag_t       *tag;
+    ngx_http_file_cache_tag_link_t  *link;
+
+    ngx_http_file_cache_tags_free(cache, fcn);
+
+    p = value->data;
+    last = p + value->len;
+
+    while (p < last) {
+
+        if (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+            continue;
+        }
+
+        name.data = p;
+
+        while (p < last && *p != ' ' && *p != '\t' && *p != ',') {
+            p++;
+        }
+
+        name.len = p - name.data;
+
+        hash = ngx_crc32_long(name.data, name.len);
+
+        tag = (ngx_http_file_cache_tag_t *)
+                  ngx_str_rbtree_lookup(&cache->sh->tags, &name, hash);
+
+        if (tag) {
+            for (link = fcn->tags; link; link = link->next) {
+                if (link->tag == tag) {
+                    break;
+                }
+            }
+
+            if (link) {
+                continue;
+            }
+
+        } else {
+            tag = ngx_slab_alloc_locked(cache->shpool,
+                                        sizeof(ngx_http_file_cache_tag_t)
+                                        + name.len);
+            if (tag == NULL) {
+                return;
+            }
+
+            tag->sn.node.key = hash;
+            tag->sn.str.len = name.len;
+            tag->sn.str.data = tag->data;
+            ngx_memcpy(tag->data, name.data, name.len);
+
+            ngx_queue_init(&tag->links);
+
+            ngx_rbtree_insert(&cache->sh->tags, &tag->sn.node);
+        }
+
+        link = ngx_slab_alloc_locked(cache->shpool,
+                                     sizeof(ngx_http_file_cache_tag_link_t));
+        if (link == NULL) {
+            if (ngx_queue_empty(&tag->links)) {
+                ngx_rbtree_delete(&cache->sh->tags, &tag->sn.node);
+                ngx_slab_free_locked(cache->shpool, tag);
+            }
+
+            return;
+        }
+
+        link->tag = tag;
+        link->node = fcn;
+        link->next = fcn->tags;
+        fcn->tags = link;
+
+        ngx_queue_insert_tail(&tag->links, &link->queue);
+    }
+}
+
+
+static void
+ngx_http_file_cache_tags_free(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_http_file_cache_tag_t       *tag;
+    ngx_http_file_cache_tag_link_t  *link, *next;
+
+    for (link = fcn->tags; link; link = next) {
+        next = link->next;
+        tag = link->tag;
+
+        ngx_queue_remove(&link->queue);
+
+        if (ngx_queue_empty(&tag->links)) {
+            ngx_rbtree_delete(&cache->sh->tags, &tag->sn.node);
+            ngx_slab_free_locked(cache->shpool, tag);
+        }
+
+        ngx_slab_free_locked(cache->shpool, link);
+    }
+
+    fcn->tags = NULL;
+}
+
+
+static void
+ngx_http_file_cache_text_add(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_array_t *keys)
+{
+    u_char                      *p;
+    size_t                       len;
+    ngx_str_t                   *key;
+    ngx_uint_t                   i;
+    ngx_http_file_cache_text_t  *text;
+
+    len = 0;
+
+    key = keys->elts;
+    for (i = 0; i < keys->nelts; i++) {
+        len += key[i].len;
+    }
+
+    text = ngx_slab_alloc_locked(cache->shpool,
+                                 offsetof(ngx_http_file_cache_text_t, data)
+                                 + len);
+    if (text == NULL) {
+        return;
+    }
+
+    text->len = len;
+
+    p = text->data;
+
+    for (i = 0; i < keys->nelts; i++) {
+        p = ngx_cpymem(p, key[i].data, key[i].len);
+    }
+
+    fcn->text = text;
+}
+
+
+static void
+ngx_http_file_cache_text_free(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    if (fcn->text) {
+        ngx_slab_free_locked(cache->shpool, fcn->text);
+        fcn->text = NULL;
+    }
+}
+
+
+static ngx_msec_t
+ngx_http_file_cache_index_save(ngx_http_file_cache_t *cache)
+{
+    off_t                               offset;
+    size_t                              size;
+    u_char                             *cursor;
+    ngx_int_t                           rc;
+    ngx_uint_t                          i, n, count;
+    ngx_msec_t                          elapsed;
+    ngx_file_t                          file;
+    ngx_http_file_cache_t              *shard;
+    ngx_http_file_cache_index_entry_t  *entries;
+    ngx_http_file_cache_index_header_t  h;
+    u_char                              key[NGX_HTTP_CACHE_KEY_LEN];
+
+    elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->index_last));
+
+    if (cache->index_last && elapsed < cache->index_interval) {
+        return cache->index_interval - elapsed;
+    }
+
+    if (cache->sh->cold) {
+        return cache->index_interval;
+    }
+
+    cache->index_last = ngx_current_msec;
+
+    entries = ngx_alloc(cache->manager_files
+                        * sizeof(ngx_http_file_cache_index_entry_t),
+                        ngx_cycle->log);
+    if (entries == NULL) {
+        return cache->index_interval;
+    }
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = cache->index_temp;
+    file.log = ngx_cycle->log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_WRONLY,
+                            NGX_FILE_TRUNCATE, NGX_FILE_DEFAULT_ACCESS);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        ngx_free(entries);
+        return cache->index_interval;
+    }
+
+    ngx_memzero(&h, sizeof(ngx_http_file_cache_index_header_t));
+
+    h.version = NGX_HTTP_CACHE_INDEX_VERSION;
+    h.entry_size = sizeof(ngx_http_file_cache_index_entry_t);
+    h.bsize = cache->bsize;
+    ngx_memcpy(h.level, cache->path->level, sizeof(h.level));
+    h.time = ngx_time();
+
+    ngx_crc32_init(h.crc32);
+
+    offset = sizeof(ngx_http_file_cache_index_header_t);
+    count = 0;
+
+    for (i = 0; i < (cache->shards ? cache->nshards : 1); i++) {
+
+        shard = cache->shards ? cache->shards[i] : cache;
+
+        /*
+         * the tree is walked in the order of keys in batches of
+         * manager_files nodes, the mutex is released while a batch
+         * is written; the walk resumes at the first key greater than
+         * the key visited last, so entries used, moved or deleted
+         * meanwhile do not stop it, and every entry which exists during
+         * the whole walk is written
+         */
+
+        cursor = NULL;
+
+        do {
+            n = cache->manager_files;
+
+            rc = ngx_http_file_cache_index_copy(shard, cursor, key, entries,
+                                                &n);
+            cursor = key;
+
+            size = n * sizeof(ngx_http_file_cache_index_entry_t);
+
+            ngx_crc32_update(&h.crc32, (u_char *) entries, size);
+
+            if (n && ngx_write_file(&file, (u_char *) entries, size, offset)
+                     == NGX_ERROR)
+            {
+                goto failed;
+            }
+
+            offset += size;
+            count += n;
+
+            if (ngx_quit || ngx_terminate) {
+                goto failed;
+            }
+
+        } while (rc == NGX_OK);
+    }
+
+    ngx_crc32_final(h.crc32);
+
+    h.count = count;
+
+    if (ngx_write_file(&file, (u_char *) &h,
+                       sizeof(ngx_http_file_cache_index_header_t), 0)
+        == NGX_ERROR)
+    {
+        goto failed;
+    }
+
+    ngx_free(entries);
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    if (ngx_rename_file(file.name.data, cache->index.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      file.name.data, cache->index.data);
+
+        return cache->index_interval;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache index: \"%s\" %ui entries",
+                   cache->index.data, count);
+
+    return cache->index_interval;
+
+failed:
+
+    ngx_free(entries);
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    if (ngx_delete_file(file.name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", file.name.data);
+    }
+
+    return cache->index_interval;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_copy(ngx_http_file_cache_t *cache,
+    u_char *cursor, u_char *last, ngx_http_file_cache_index_entry_t *entries,
+    ngx_uint_t *n)
+{
+    ngx_int_t                           rc;
+    ngx_uint_t                          i, j;
+    ngx_rbtree_key_t                    node_key;
+    ngx_rbtree_node_t                  *node, *next, *sentinel;
+    ngx_http_file_cache_node_t         *fcn;
+    ngx_http_file_cache_index_entry_t  *e;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+    next = NULL;
+
+    if (cursor == NULL) {
+        if (node != sentinel) {
+            next = ngx_rbtree_min(node, sentinel);
+        }
+
+    } else {
+
+        /* the least node with a key greater than the cursor */
+
+        ngx_memcpy((u_char *) &node_key, cursor, sizeof(ngx_rbtree_key_t));
+
+        while (node != sentinel) {
+
+            if (node_key < node->key) {
+                next = node;
+                node = node->left;
+                continue;
+            }
+
+            if (node_key > node->key) {
+                node = node->right;
+                continue;
+            }
+
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            rc = ngx_memcmp(&cursor[sizeof(ngx_rbtree_key_t)], fcn->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+            if (rc < 0) {
+                next = node;
+                node = node->left;
+
+            } else {
+                node = node->right;
+            }
+        }
+    }
+
+    i = 0;
+
+    for (j = 0;
+         next && j < *n;
+         next = ngx_rbtree_next(&cache->sh->rbtree, next), j++)
+    {
+        fcn = (ngx_http_file_cache_node_t *) next;
+
+        ngx_memcpy(last, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(&last[sizeof(ngx_rbtree_key_t)], fcn->key,
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (!fcn->exists || fcn->deleting) {
+            continue;
+        }
+
+        e = &entries[i++];
+
+        ngx_memcpy(e->key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(&e->key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        e->uniq = fcn->uniq;
+        e->expire = fcn->expire;
+        e->fs_size = fcn->fs_size;
+        e->body_start = fcn->body_start;
+        e->tier = fcn->tier;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    *n = i;
+
+    return next ? NGX_OK : NGX_DONE;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_load(ngx_http_file_cache_t *cache)
+{
+#if (NGX_WIN32)
+
+    return NGX_DECLINED;
+
+#else
+
+    u_char                              *p;
+    size_t                               size;
+    time_t                               age;
+    uint32_t                             crc32;
+    ngx_fd_t                             fd;
+    ngx_int_t                            rc;
+    ngx_err_t                            err;
+    ngx_uint_t                           i;
+    ngx_file_info_t                      fi;
+    ngx_http_file_cache_index_entry_t   *e;
+    ngx_http_file_cache_index_header_t  *h;
+
+    fd = ngx_open_file(cache->index.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, err,
+                          ngx_open_file_n " \"%s\" failed",
+                          cache->index.data);
+        }
+
+        return NGX_DECLINED;
+    }
+
+    rc = NGX_DECLINED;
+    p = MAP_FAILED;
+    size = 0;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", cache->index.data);
+        goto done;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size < sizeof(ngx_http_file_cache_index_header_t)) {
+        goto stale;
+    }
+
+    p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      "mmap(\"%s\") failed", cache->index.data);
+        goto done;
+    }
+
+    h = (ngx_http_file_cache_index_header_t *) p;
+    e = (ngx_http_file_cache_index_entry_t *) (h + 1);
+
+    if (h->version != NGX_HTTP_CACHE_INDEX_VERSION
+        || h->entry_size != sizeof(ngx_http_file_cache_index_entry_t)
+        || h->bsize != cache->bsize
+        || ngx_memcmp(h->level, cache->path->level, sizeof(h->level)) != 0
+        || size != sizeof(ngx_http_file_cache_index_header_t)
+                   + h->count * sizeof(ngx_http_file_cache_index_entry_t))
+    {
+        goto stale;
+    }
+
+    age = ngx_time() - h->time;
+
+    if (age < 0 || age > cache->index_valid) {
+        goto stale;
+    }
+
+    ngx_crc32_init(crc32);
+    ngx_crc32_update(&crc32, (u_char *) e,
+                     h->count * sizeof(ngx_http_file_cache_index_entry_t));
+    ngx_crc32_final(crc32);
+
+    if (crc32 != h->crc32) {
+        goto stale;
+    }
+
+    for (i = 0; i < h->count; i++) {
+        if (ngx_http_file_cache_index_add(
+                              ngx_http_file_cache_shard(cache, e[i].key),
+                              &e[i])
+            != NGX_OK)
+        {
+            goto done;
+        }
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V index loaded, %ui entries",
+                  &cache->path->name, h->count);
+
+    rc = NGX_OK;
+
+    goto done;
+
+stale:
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V index \"%s\" is stale",
+                  &cache->path->name, cache->index.data);
+
+done:
+
+    if (p != MAP_FAILED && munmap(p, size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "munmap(\"%s\") failed", cache->index.data);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", cache->index.data);
+    }
+
+    return rc;
+
+#endif
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_add(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_entry_t *entry)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    /* the tier was removed from the configuration since the snapshot */
+
+    if (entry->tier && cache->tier_path == NULL) {
+        return NGX_OK;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = ngx_http_file_cache_lookup(cache, entry->key);
+
+    if (fcn) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_OK;
+    }
+
+    fcn = ngx_slab_calloc_locked(cache->shpool,
+                                 sizeof(ngx_http_file_cache_node_t));
+    if (fcn == NULL) {
+        ngx_http_file_cache_set_watermark(cache);
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "could not allocate node%s", cache->shpool->log_ctx);
+        return NGX_ERROR;
+    }
+
+    cache->sh->count++;
+
+    ngx_memcpy((u_char *) &fcn->node.key, entry->key,
+               sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(fcn->key, &entry->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+
+    fcn->uses = 1;
+    fcn->exists = 1;
+    fcn->uniq = entry->uniq;
+    fcn->body_start = entry->body_start;
+    fcn->fs_size = entry->fs_size;
+    fcn->tier = entry->tier;
+
+    fcn->expire = entry->expire;
+
+    cache->sh->size += entry->fs_size;
+
+    if (fcn->tier) {
+        cache->sh->tier_size += entry->fs_size;
+    }
+
+    /*
+     * the entries are stored in the order of keys, so the queue order
+     * of the loaded entries is arbitrary, much like after a walk of the
+     * cache directory; their inactivity times are kept though
+     */
+
+    ngx_http_file_cache_enqueue(cache, fcn, 0);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_sketch_init(ngx_http_file_cache_t *cache)
+{
+    u_char                        *p;
+    size_t                         size;
+    ngx_uint_t                     width;
+    ngx_http_file_cache_sketch_t  *sketch;
+
+    if (cache->admission == 0) {
+        return NGX_OK;
+    }
+
+    if (cache->sh->sketch) {
+        cache->sketch = cache->sh->sketch;
+        return NGX_OK;
+    }
+
+    /* each slot takes NGX_HTTP_CACHE_SKETCH_DEPTH 4-bit counters and 1 bit */
+
+    width = 64;
+
+    while (width * 2 * (NGX_HTTP_CACHE_SKETCH_DEPTH * 4 + 1) / 8
+           <= cache->admission)
+    {
+        width *= 2;
+    }
+
+    size = sizeof(ngx_http_file_cache_sketch_t)
+           + width / 8 + NGX_HTTP_CACHE_SKETCH_DEPTH * width / 2;
+
+    p = ngx_slab_calloc(cache->shpool, size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    sketch = (ngx_http_file_cache_sketch_t *) p;
+    p += sizeof(ngx_http_file_cache_sketch_t);
+
+    sketch->mask = width - 1;
+    sketch->sample = 10 * width;
+    sketch->doorkeeper = p;
+    sketch->counters = p + width / 8;
+
+    cache->sh->sketch = sketch;
+    cache->sketch = sketch;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_admit(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_int_t                    rc;
+    ngx_uint_t                   freq;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    ngx_http_file_cache_sketch_add(cache->sketch, c->key);
+
+    if (cache->sh->cold || ngx_http_file_cache_lookup(cache, c->key)) {
+        rc = NGX_OK;
+        goto done;
+    }
+
+    freq = ngx_http_file_cache_sketch_estimate(cache->sketch, c->key);
+
+    /* min_uses is not checked in configuration if the cache is variable */
+
+    if (freq < ngx_min(c->min_uses, NGX_HTTP_CACHE_SKETCH_MAX_USES)) {
+        rc = NGX_DECLINED;
+        goto done;
+    }
+
+    /*
+     * if the keys zone or the cache is full, a new node is only
+     * created if it is requested more often than the next victim
+     */
+
+    if ((cache->sh->count >= cache->sh->watermark
+         || cache->sh->size >= cache->max_size)
+        && !ngx_queue_empty(&cache->sh->queue))
+    {
+        q = ngx_queue_last(&cache->sh->queue);
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (freq <= ngx_http_file_cache_sketch_estimate(cache->sketch, key)) {
+            rc = NGX_DECLINED;
+            goto done;
+        }
+    }
+
+    /* the uses are already counted by the sketch */
+
+    c->min_uses = 1;
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache admit: %i", rc);
+
+    return rc;
+}
+
+
+static void
+ngx_http_file_cache_sketch_add(ngx_http_file_cache_sketch_t *sketch,
+    u_char *key)
+{
+    u_char      *p;
+    uint32_t     h[NGX_HTTP_CACHE_SKETCH_DEPTH];
+    ngx_uint_t   i, n, v, min;
+
+    ngx_memcpy(h, key, sizeof(h));
+
+    n = (h[0] ^ h[NGX_HTTP_CACHE_SKETCH_DEPTH - 1]) & sketch->mask;
+
+    if (!(sketch->doorkeeper[n / 8] & (1 << (n % 8)))) {
+        sketch->doorkeeper[n / 8] |= 1 << (n % 8);
+        goto sample;
+    }
+
+    /* conservative update: only the smallest counters are incremented */
+
+    min = 15;
+
+    for (i = 0; i < NGX_HTTP_CACHE_SKETCH_DEPTH; i++) {
+        n = h[i] & sketch->mask;
+        p = &sketch->counters[i * (sketch->mask + 1) / 2 + n / 2];
+        v = (n & 1) ? *p >> 4 : *p & 0x0f;
+
+        if (v < min) {
+            min = v;
+        }
+    }
+
+    if (min == 15) {
+        goto sample;
+    }
+
+    for (i = 0; i < NGX_HTTP_CACHE_SKETCH_DEPTH; i++) {
+        n = h[i] & sketch->mask;
+        p = &sketch->counters[i * (sketch->mask + 1) / 2 + n / 2];
+        v = (n & 1) ? *p >> 4 : *p & 0x0f;
+
+        if (v == min) {
+            *p += (n & 1) ? 0x10 : 0x01;
+        }
+    }
+
+sample:
+
+    if (++sketch->additions < sketch->sample) {
+        return;
+    }
+
+    /* aging: all counters are halved and the doorkeeper is cleared */
+
+    p = sketch->counters;
+    n = NGX_HTTP_CACHE_SKETCH_DEPTH * (sketch->mask + 1) / 2;
+
+    for (i = 0; i < n; i++) {
+        p[i] = (p[i] >> 1) & 0x77;
+    }
+
+    ngx_memzero(sketch->doorkeeper, (sketch->mask + 1) / 8);
+
+    sketch->additions /= 2;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_sketch_estimate(ngx_http_file_cache_sketch_t *sketch,
+    u_char *key)
+{
+    u_char      *p;
+    uint32_t     h[NGX_HTTP_CACHE_SKETCH_DEPTH];
+    ngx_uint_t   i, n, v, min;
+
+    ngx_memcpy(h, key, sizeof(h));
+
+    n = (h[0] ^ h[NGX_HTTP_CACHE_SKETCH_DEPTH - 1]) & sketch->mask;
+
+    if (!(sketch->doorkeeper[n / 8] & (1 << (n % 8)))) {
+        return 0;
+    }
+
+    min = 15;
+
+    for (i = 0; i < NGX_HTTP_CACHE_SKETCH_DEPTH; i++) {
+        n = h[i] & sketch->mask;
+        p = &sketch->counters[i * (sketch->mask + 1) / 2 + n / 2];
+        v = (n & 1) ? *p >> 4 : *p & 0x0f;
+
+        if (v < min) {
+            min = v;
+        }
+    }
+
+    return min + 1;
+}
+
+
+static void
+ngx_http_file_cache_enqueue(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, ngx_uint_t hit)
+{
+    if (cache->eviction != NGX_HTTP_CACHE_EVICT_SLRU) {
+
+        if (fcn->promoted) {
+            fcn->promoted = 0;
+            cache->sh->npromoted--;
+        }
+
+        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        return;
+    }
+
+    /*
+     * segmented LRU: entries hit in the probation segment are promoted
+     * to the protected one, which takes up to 80% of entries, and the
+     * least recently used protected entries are demoted back
+     */
+
+    if (hit && !fcn->promoted) {
+        fcn->promoted = 1;
+        cache->sh->npromoted++;
+
+        if (cache->sh->npromoted > cache->sh->count - cache->sh->count / 5) {
+            (void) ngx_http_file_cache_demote(cache, 0);
+        }
+    }
+
+    ngx_queue_insert_head(fcn->promoted ? &cache->sh->promoted
+                                        : &cache->sh->queue,
+                          &fcn->queue);
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_demote(ngx_http_file_cache_t *cache, ngx_uint_t tail)
+{
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+
+    if (ngx_queue_empty(&cache->sh->promoted)) {
+        return 0;
+    }
+
+    q = ngx_queue_last(&cache->sh->promoted);
+    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+    ngx_queue_remove(q);
+
+    fcn->promoted = 0;
+    cache->sh->npromoted--;
+
+    if (tail) {
+        ngx_queue_insert_tail(&cache->sh->queue, q);
+
+    } else {
+        ngx_queue_insert_head(&cache->sh->queue, q);
+    }
+
+    return 1;
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+static ngx_queue_t *
+ngx_http_file_cache_victim(ngx_http_file_cache_t *cache)
 {
-    ngx_msec_t              elapsed;
-    ngx_http_file_cache_t  *cache;
-
-    cache = ctx->data;
+    off_t                        size, vsize;
+    ngx_uint_t                   n, freq, vfreq;
+    ngx_queue_t                 *q, *victim;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
 
-    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
-        (void) ngx_http_file_cache_delete_file(ctx, path);
+    if (cache->eviction != NGX_HTTP_CACHE_EVICT_GDSF && cache->sketch == NULL)
+    {
+        return NULL;
     }
 
-    if (++cache->files >= cache->loader_files) {
-        ngx_http_file_cache_loader_sleep(cache);
+    /*
+     * the last inactive entries are sampled, and the one with the lowest
+     * frequency (divided by size for GDSF) is chosen; the frequency is
+     * estimated by the admission sketch if there is one
+     */
 
-    } else {
-        ngx_time_update();
+    victim = NULL;
+    vfreq = 0;
+    vsize = 1;
+    n = 8;
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+    for (q = ngx_queue_last(&cache->sh->queue);
+         q != ngx_queue_sentinel(&cache->sh->queue) && n;
+         q = ngx_queue_prev(q), n--)
+    {
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache loader time elapsed: %M", elapsed);
+        if (fcn->count) {
+            continue;
+        }
 
-        if (elapsed >= cache->loader_threshold) {
-            ngx_http_file_cache_loader_sleep(cache);
+        if (cache->sketch) {
+            ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+            freq = ngx_http_file_cache_sketch_estimate(cache->sketch, key);
+
+        } else {
+            freq = fcn->uses;
+        }
+
+        if (cache->eviction == NGX_HTTP_CACHE_EVICT_GDSF) {
+            size = ngx_max(fcn->fs_size, 1);
+
+        } else {
+            size = 1;
+        }
+
+        if (victim == NULL || (off_t) freq * vsize < (off_t) vfreq * size) {
+            victim = q;
+            vfreq = freq;
+            vsize = size;
         }
     }
 
-    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
+    return victim;
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+ngx_http_file_cache_ram_init(ngx_shm_zone_t *shm_zone, void *data)
 {
-    if (path->len >= 5
-        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
-    {
-        return NGX_DECLINED;
+    ngx_http_file_cache_ram_t  *oram = data;
+
+    size_t                      len;
+    ngx_http_file_cache_ram_t  *ram;
+
+    ram = shm_zone->data;
+
+    if (oram) {
+        ram->sh = oram->sh;
+        ram->shpool = oram->shpool;
+        return NGX_OK;
     }
 
-    return NGX_OK;
-}
+    ram->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
+    if (shm_zone->shm.exists) {
+        ram->sh = ram->shpool->data;
+        return NGX_OK;
+    }
 
-static void
-ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
-{
-    ngx_msleep(cache->loader_sleep);
+    ram->sh = ngx_slab_alloc(ram->shpool,
+                             sizeof(ngx_http_file_cache_ram_sh_t));
+    if (ram->sh == NULL) {
+        return NGX_ERROR;
+    }
 
-    ngx_time_update();
+    ram->shpool->data = ram->sh;
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+    ngx_rbtree_init(&ram->sh->rbtree, &ram->sh->sentinel,
+                    ngx_http_file_cache_rbtree_insert_value);
+
+    ngx_queue_init(&ram->sh->queue);
+
+    len = sizeof(" in cache ram zone \"\"") + shm_zone->shm.name.len;
+
+    ram->shpool->log_ctx = ngx_slab_alloc(ram->shpool, len);
+    if (ram->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ram->shpool->log_ctx, " in cache ram zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* allocation failures are expected and handled by eviction */
+
+    ram->shpool->log_nomem = 0;
+
+    return NGX_OK;
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
+ngx_http_file_cache_ram_open(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    u_char                 *p;
-    ngx_int_t               n;
-    ngx_uint_t              i;
-    ngx_http_cache_t        c;
-    ngx_http_file_cache_t  *cache;
+    u_char                          *p;
+    size_t                           size;
+    ngx_http_file_cache_ram_t       *ram;
+    ngx_http_file_cache_ram_node_t  *rn;
 
-    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
-        return NGX_ERROR;
+    ram = c->file_cache->ram;
+
+    ngx_shmtx_lock(&ram->shpool->mutex);
+
+    rn = ngx_http_file_cache_ram_lookup(ram, c->key);
+
+    if (rn == NULL) {
+        ngx_shmtx_unlock(&ram->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    if (rn->uniq != c->uniq) {
+
+        /* the cache file was replaced */
+
+        ngx_http_file_cache_ram_free(ram, rn);
+
+        ngx_shmtx_unlock(&ram->shpool->mutex);
+        return NGX_DECLINED;
     }
 
     /*
-     * Temporary files in cache have a suffix consisting of a dot
-     * followed by 10 digits.
+     * the data are copied, as the entry may be evicted
+     * while the response is being sent
      */
 
-    if (name->len >= 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10
-        && name->data[name->len - 10 - 1] == '.')
-    {
-        return NGX_OK;
-    }
+    size = ngx_max(rn->len, c->body_start);
 
-    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
-                      "cache file \"%s\" is too small", name->data);
+    p = ngx_pnalloc(r->pool, size);
+    if (p == NULL) {
+        ngx_shmtx_unlock(&ram->shpool->mutex);
         return NGX_ERROR;
     }
 
-    ngx_memzero(&c, sizeof(ngx_http_cache_t));
-    cache = ctx->data;
-
-    c.length = ctx->size;
-    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+    ngx_memcpy(p, rn->data, rn->len);
 
-    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+    c->length = rn->len;
 
-    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
-        n = ngx_hextoi(p, 2);
+    ngx_queue_remove(&rn->queue);
+    ngx_queue_insert_head(&ram->sh->queue, &rn->queue);
 
-        if (n == NGX_ERROR) {
-            return NGX_ERROR;
-        }
+    ngx_shmtx_unlock(&ram->shpool->mutex);
 
-        p += 2;
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache ram hit: %O", c->length);
 
-        c.key[i] = (u_char) n;
+    c->buf = ngx_calloc_buf(r->pool);
+    if (c->buf == NULL) {
+        return NGX_ERROR;
     }
 
-    return ngx_http_file_cache_add(cache, &c);
+    c->buf->start = p;
+    c->buf->pos = p;
+    c->buf->last = p;
+    c->buf->end = p + c->body_start;
+    c->buf->temporary = 1;
+
+    c->ram = p;
+
+    return NGX_OK;
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+static void
+ngx_http_file_cache_ram_add(ngx_http_request_t *r, ngx_http_cache_t *c,
+    size_t n)
 {
-    ngx_http_file_cache_node_t  *fcn;
+    u_char                          *data;
+    size_t                           len, size;
+    ssize_t                          rc;
+    ngx_uint_t                       uses;
+    ngx_queue_t                     *q;
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_ram_t       *ram;
+    ngx_http_file_cache_ram_node_t  *rn;
+
+    cache = c->file_cache;
+    ram = cache->ram;
+
+    if (c->length > (off_t) ram->max_object) {
+        return;
+    }
 
     ngx_shmtx_lock(&cache->shpool->mutex);
+    uses = c->node->uses;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+    if (uses < ram->min_uses) {
+        return;
+    }
 
-    if (fcn == NULL) {
+    len = (size_t) c->length;
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
-                                     sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            ngx_http_file_cache_set_watermark(cache);
+    if (n < len) {
 
-            if (cache->fail_time != ngx_time()) {
-                cache->fail_time = ngx_time();
-                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                           "could not allocate node%s", cache->shpool->log_ctx);
-            }
+        /* the body is read once, as the cache file is small and hot */
 
-            ngx_shmtx_unlock(&cache->shpool->mutex);
-            return NGX_ERROR;
+        data = ngx_pnalloc(r->pool, len);
+        if (data == NULL) {
+            return;
         }
 
-        cache->sh->count++;
+        ngx_memcpy(data, c->buf->pos, n);
 
-        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+        rc = ngx_read_file(&c->file, data + n, len - n, n);
 
-        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        if (rc != (ssize_t) (len - n)) {
+            return;
+        }
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+    } else {
+        data = c->buf->pos;
+    }
 
-        fcn->uses = 1;
-        fcn->exists = 1;
-        fcn->fs_size = c->fs_size;
+    size = offsetof(ngx_http_file_cache_ram_node_t, data) + len;
 
-        cache->sh->size += c->fs_size;
+    ngx_shmtx_lock(&ram->shpool->mutex);
 
-    } else {
-        ngx_queue_remove(&fcn->queue);
+    rn = ngx_http_file_cache_ram_lookup(ram, c->key);
+
+    if (rn) {
+        if (rn->uniq == c->uniq) {
+            goto done;
+        }
+
+        ngx_http_file_cache_ram_free(ram, rn);
     }
 
-    fcn->expire = ngx_time() + cache->inactive;
+    for ( ;; ) {
+        rn = ngx_slab_alloc_locked(ram->shpool, size);
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        if (rn) {
+            break;
+        }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+        if (ngx_queue_empty(&ram->sh->queue)) {
+            goto done;
+        }
 
-    return NGX_OK;
+        /* evict the least recently used entry */
+
+        q = ngx_queue_last(&ram->sh->queue);
+
+        ngx_http_file_cache_ram_free(ram,
+                   ngx_queue_data(q, ngx_http_file_cache_ram_node_t, queue));
+    }
+
+    ngx_memcpy((u_char *) &rn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(rn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    rn->uniq = c->uniq;
+    rn->len = len;
+
+    ngx_memcpy(rn->data, data, len);
+
+    ngx_rbtree_insert(&ram->sh->rbtree, &rn->node);
+    ngx_queue_insert_head(&ram->sh->queue, &rn->queue);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache ram add: %uz", len);
+
+done:
+
+    ngx_shmtx_unlock(&ram->shpool->mutex);
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+static void
+ngx_http_file_cache_ram_update(ngx_http_cache_t *c,
+    ngx_http_file_cache_header_t *h)
 {
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
-                   "http file cache delete: \"%s\"", path->data);
+    ngx_http_file_cache_ram_t       *ram;
+    ngx_http_file_cache_ram_node_t  *rn;
 
-    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                      ngx_delete_file_n " \"%s\" failed", path->data);
+    /*
+     * the cache file header was rewritten in place after revalidation,
+     * the copy of the header in memory is updated as well, or else
+     * the entry would be served with the old valid_sec
+     */
+
+    ram = c->file_cache->ram;
+
+    ngx_shmtx_lock(&ram->shpool->mutex);
+
+    rn = ngx_http_file_cache_ram_lookup(ram, c->key);
+
+    if (rn) {
+        if (rn->uniq == c->uniq
+            && rn->len >= sizeof(ngx_http_file_cache_header_t))
+        {
+            ngx_memcpy(rn->data, h, sizeof(ngx_http_file_cache_header_t));
+
+        } else {
+            ngx_http_file_cache_ram_free(ram, rn);
+        }
     }
 
-    return NGX_OK;
+    ngx_shmtx_unlock(&ram->shpool->mutex);
 }
 
 
 static void
-ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
+ngx_http_file_cache_ram_delete(ngx_http_file_cache_t *cache, u_char *key)
 {
-    cache->sh->watermark = cache->sh->count - cache->sh->count / 8;
+    ngx_http_file_cache_ram_t       *ram;
+    ngx_http_file_cache_ram_node_t  *rn;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache watermark: %ui", cache->sh->watermark);
+    ram = cache->ram;
+
+    ngx_shmtx_lock(&ram->shpool->mutex);
+
+    rn = ngx_http_file_cache_ram_lookup(ram, key);
+
+    if (rn) {
+        ngx_http_file_cache_ram_free(ram, rn);
+    }
+
+    ngx_shmtx_unlock(&ram->shpool->mutex);
+}
+
+
+static ngx_http_file_cache_ram_node_t *
+ngx_http_file_cache_ram_lookup(ngx_http_file_cache_ram_t *ram, u_char *key)
+{
+    ngx_int_t                        rc;
+    ngx_rbtree_key_t                 node_key;
+    ngx_rbtree_node_t               *node, *sentinel;
+    ngx_http_file_cache_ram_node_t  *rn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = ram->sh->rbtree.root;
+    sentinel = ram->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        rn = (ngx_http_file_cache_ram_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], rn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return rn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_ram_free(ngx_http_file_cache_ram_t *ram,
+    ngx_http_file_cache_ram_node_t *rn)
+{
+    ngx_queue_remove(&rn->queue);
+    ngx_rbtree_delete(&ram->sh->rbtree, &rn->node);
+    ngx_slab_free_locked(ram->shpool, rn);
 }
 
 
@@ -2298,22 +5271,41 @@ ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
 }
 
 
+ngx_http_file_cache_t *
+ngx_http_file_cache_path_cache(ngx_path_t *path)
+{
+    if (path->manager != ngx_http_file_cache_manager) {
+        return NULL;
+    }
+
+    return path->data;
+}
+
+
 char *
 ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     char  *confp = conf;
 
-    off_t                   max_size;
+    off_t                   max_size, manager_budget, tier_max_size;
     u_char                 *last, *p;
     time_t                  inactive;
-    ssize_t                 size;
-    ngx_str_t               s, name, *value;
-    ngx_int_t               loader_files, manager_files;
+    size_t                  ram_max_object, admission;
+    ngx_uint_t              eviction;
+    ssize_t                 size, ram_size;
+    ngx_str_t               s, name, ram_name, tier, *value;
+    ngx_int_t               loader_files, manager_files, ram_min_uses,
+                            shards, tier_min_uses;
     ngx_msec_t              loader_sleep, manager_sleep, loader_threshold,
-                            manager_threshold;
-    ngx_uint_t              i, n, use_temp_path;
+                            manager_threshold, index_interval;
+    time_t                  index_valid;
+    ngx_uint_t              i, n, use_temp_path, read_while_write,
+                            purge_prefix;
     ngx_array_t            *caches;
-    ngx_http_file_cache_t  *cache, **ce;
+    ngx_http_file_cache_t  *cache, *shard, **ce;
+#if (NGX_THREADS)
+    ngx_thread_pool_t      *manager_thread_pool;
+#endif
 
     cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_file_cache_t));
     if (cache == NULL) {
@@ -2326,6 +5318,8 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     use_temp_path = 1;
+    read_while_write = 0;
+    purge_prefix = 0;
 
     inactive = 600;
 
@@ -2336,10 +5330,29 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     manager_files = 100;
     manager_sleep = 50;
     manager_threshold = 200;
+    manager_budget = 0;
+#if (NGX_THREADS)
+    manager_thread_pool = NULL;
+#endif
 
     name.len = 0;
     size = 0;
     max_size = NGX_MAX_OFF_T_VALUE;
+    shards = 1;
+
+    index_interval = 0;
+    index_valid = NGX_CONF_UNSET;
+
+    admission = 0;
+    eviction = NGX_HTTP_CACHE_EVICT_LRU;
+
+    tier.len = 0;
+    tier_max_size = NGX_MAX_OFF_T_VALUE;
+    tier_min_uses = 2;
+
+    ram_size = 0;
+    ram_max_object = 16384;
+    ram_min_uses = 2;
 
     value = cf->args->elts;
 
@@ -2411,6 +5424,44 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "read_while_write=", 17) == 0) {
+
+            if (ngx_strcmp(&value[i].data[17], "on") == 0) {
+                read_while_write = 1;
+
+            } else if (ngx_strcmp(&value[i].data[17], "off") == 0) {
+                read_while_write = 0;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid read_while_write value \"%V\", "
+                                   "it must be \"on\" or \"off\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "purge_prefix=", 13) == 0) {
+
+            if (ngx_strcmp(&value[i].data[13], "on") == 0) {
+                purge_prefix = 1;
+
+            } else if (ngx_strcmp(&value[i].data[13], "off") == 0) {
+                purge_prefix = 0;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid purge_prefix value \"%V\", "
+                                   "it must be \"on\" or \"off\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "keys_zone=", 10) == 0) {
 
             name.data = value[i].data + 10;
@@ -2436,6 +5487,18 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             return NGX_CONF_ERROR;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards == NGX_ERROR || shards == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid shards value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
 
             s.len = value[i].len - 9;
@@ -2466,6 +5529,175 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "eviction=", 9) == 0) {
+
+            if (ngx_strcmp(&value[i].data[9], "lru") == 0) {
+                eviction = NGX_HTTP_CACHE_EVICT_LRU;
+
+            } else if (ngx_strcmp(&value[i].data[9], "gdsf") == 0) {
+                eviction = NGX_HTTP_CACHE_EVICT_GDSF;
+
+            } else if (ngx_strcmp(&value[i].data[9], "slru") == 0) {
+                eviction = NGX_HTTP_CACHE_EVICT_SLRU;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid eviction value \"%V\", "
+                                   "it must be \"lru\", \"gdsf\" "
+                                   "or \"slru\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "tier=", 5) == 0) {
+
+            tier.len = value[i].len - 5;
+            tier.data = value[i].data + 5;
+
+            if (tier.len && tier.data[tier.len - 1] == '/') {
+                tier.len--;
+            }
+
+            if (tier.len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid tier value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (ngx_conf_full_name(cf->cycle, &tier, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "tier_max_size=", 14) == 0) {
+
+            s.len = value[i].len - 14;
+            s.data = value[i].data + 14;
+
+            tier_max_size = ngx_parse_offset(&s);
+            if (tier_max_size < 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                              "invalid tier_max_size value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "tier_min_uses=", 14) == 0) {
+
+            tier_min_uses = ngx_atoi(value[i].data + 14, value[i].len - 14);
+            if (tier_min_uses == NGX_ERROR || tier_min_uses == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                              "invalid tier_min_uses value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "admission=", 10) == 0) {
+
+            s.len = value[i].len - 10;
+            s.data = value[i].data + 10;
+
+            admission = ngx_parse_size(&s);
+            if (admission == (size_t) NGX_ERROR || admission < 1024) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid admission value \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ram_cache=", 10) == 0) {
+
+            s.len = value[i].len - 10;
+            s.data = value[i].data + 10;
+
+            ram_size = ngx_parse_size(&s);
+            if (ram_size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid ram_cache value \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (ram_size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "ram_cache \"%V\" is too small",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ram_cache_max_object=", 21) == 0) {
+
+            s.len = value[i].len - 21;
+            s.data = value[i].data + 21;
+
+            ram_max_object = ngx_parse_size(&s);
+            if (ram_max_object == (size_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid ram_cache_max_object value \"%V\"",
+                           &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ram_cache_min_uses=", 19) == 0) {
+
+            ram_min_uses = ngx_atoi(value[i].data + 19, value[i].len - 19);
+            if (ram_min_uses == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid ram_cache_min_uses value \"%V\"",
+                           &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "index=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            index_interval = ngx_parse_time(&s, 0);
+            if (index_interval == (ngx_msec_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid index value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "index_valid=", 12) == 0) {
+
+            s.len = value[i].len - 12;
+            s.data = value[i].data + 12;
+
+            index_valid = ngx_parse_time(&s, 1);
+            if (index_valid == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid index_valid value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "loader_files=", 13) == 0) {
 
             loader_files = ngx_atoi(value[i].data + 13, value[i].len - 13);
@@ -2550,6 +5782,42 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "manager_budget=", 15) == 0) {
+
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            manager_budget = ngx_parse_offset(&s);
+            if (manager_budget <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                             "invalid manager_budget value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "manager_threads=", 16) == 0) {
+#if (NGX_THREADS)
+            s.len = value[i].len - 16;
+            s.data = value[i].data + 16;
+
+            manager_thread_pool = ngx_thread_pool_add(cf, &s);
+            if (manager_thread_pool == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_thread_pool_use_manager(manager_thread_pool);
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"manager_threads\" "
+                               "is unsupported on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -2562,6 +5830,15 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    /* readers derive the name of a temporary file from the cache file name */
+
+    if (read_while_write && use_temp_path) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"read_while_write\" requires "
+                           "\"use_temp_path=off\"");
+        return NGX_CONF_ERROR;
+    }
+
     cache->path->manager = ngx_http_file_cache_manager;
     cache->path->loader = ngx_http_file_cache_loader;
     cache->path->data = cache;
@@ -2573,11 +5850,86 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->manager_files = manager_files;
     cache->manager_sleep = manager_sleep;
     cache->manager_threshold = manager_threshold;
+    cache->manager_budget = manager_budget;
+#if (NGX_THREADS)
+    cache->manager_thread_pool = manager_thread_pool;
+#endif
+
+    if (index_interval) {
+        cache->index_interval = index_interval;
+        /* entries of an index older than "inactive" are all expired */
+
+        cache->index_valid = (index_valid == NGX_CONF_UNSET) ? inactive
+                                                             : index_valid;
+
+        cache->index.len = cache->path->name.len + sizeof("/index") - 1;
+
+        cache->index.data = ngx_pnalloc(cf->pool, cache->index.len + 1);
+        if (cache->index.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(cache->index.data, "%V/index%Z", &cache->path->name);
+
+        cache->index_temp.len = cache->index.len + sizeof(".tmp") - 1;
+
+        cache->index_temp.data = ngx_pnalloc(cf->pool,
+                                             cache->index_temp.len + 1);
+        if (cache->index_temp.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(cache->index_temp.data, "%V.tmp%Z", &cache->index);
+    }
 
     if (ngx_add_path(cf, &cache->path) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
 
+    /* the fast tier mirrors the layout of the cache path */
+
+    if (tier.len) {
+        if (tier.len == cache->path->name.len
+            && ngx_strcmp(tier.data, cache->path->name.data) == 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "tier \"%V\" is the cache path itself",
+                               &tier);
+            return NGX_CONF_ERROR;
+        }
+
+        cache->tier_path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
+        if (cache->tier_path == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->tier_path->name = tier;
+        cache->tier_path->len = cache->path->len;
+        ngx_memcpy(cache->tier_path->level, cache->path->level,
+                   sizeof(cache->path->level));
+        cache->tier_path->data = cache;
+        cache->tier_path->conf_file = cache->path->conf_file;
+        cache->tier_path->line = cache->path->line;
+
+        if (ngx_add_path(cf, &cache->tier_path) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->tier_max_size = tier_max_size / shards;
+        cache->tier_min_uses = tier_min_uses;
+    }
+
+    /* each shard gets an equal part of the keys zone and of max_size */
+
+    size /= shards;
+
+    if (size < 8192) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "keys zone \"%V\" is too small for %i shards",
+                           &name, shards);
+        return NGX_CONF_ERROR;
+    }
+
     cache->shm_zone = ngx_shared_memory_add(cf, &name, size, cmd->post);
     if (cache->shm_zone == NULL) {
         return NGX_CONF_ERROR;
@@ -2593,10 +5945,89 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->shm_zone->init = ngx_http_file_cache_init;
     cache->shm_zone->data = cache;
 
+    if (ram_size) {
+        cache->ram = ngx_pcalloc(cf->pool, sizeof(ngx_http_file_cache_ram_t));
+        if (cache->ram == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ram_name.len = name.len + sizeof(":ram") - 1;
+
+        ram_name.data = ngx_pnalloc(cf->pool, ram_name.len);
+        if (ram_name.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(ram_name.data, "%V:ram", &name);
+
+        cache->ram->shm_zone = ngx_shared_memory_add(cf, &ram_name, ram_size,
+                                                     cmd->post);
+        if (cache->ram->shm_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->ram->shm_zone->init = ngx_http_file_cache_ram_init;
+        cache->ram->shm_zone->data = cache->ram;
+
+        cache->ram->max_object = ram_max_object;
+        cache->ram->min_uses = ram_min_uses;
+    }
+
     cache->use_temp_path = use_temp_path;
+    cache->read_while_write = read_while_write;
+    cache->purge_prefix = purge_prefix;
 
     cache->inactive = inactive;
-    cache->max_size = max_size;
+    cache->max_size = max_size / shards;
+    cache->admission = admission / shards;
+    cache->eviction = eviction;
+
+    if (shards > 1) {
+        cache->nshards = shards;
+
+        cache->shards = ngx_palloc(cf->pool,
+                                   shards * sizeof(ngx_http_file_cache_t *));
+        if (cache->shards == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->shards[0] = cache;
+
+        for (n = 1; n < (ngx_uint_t) shards; n++) {
+
+            shard = ngx_palloc(cf->pool, sizeof(ngx_http_file_cache_t));
+            if (shard == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            *shard = *cache;
+
+            s.len = name.len + 1 + NGX_INT_T_LEN;
+
+            s.data = ngx_pnalloc(cf->pool, s.len);
+            if (s.data == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            s.len = ngx_sprintf(s.data, "%V:%ui", &name, n) - s.data;
+
+            shard->shm_zone = ngx_shared_memory_add(cf, &s, size, cmd->post);
+            if (shard->shm_zone == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            if (shard->shm_zone->data) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate zone \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            shard->shm_zone->init = ngx_http_file_cache_init;
+            shard->shm_zone->data = shard;
+
+            cache->shards[n] = shard;
+        }
+    }
 
     caches = (ngx_array_t *) (confp + cmd->offset);
 
@@ -9,6 +9,40 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HAVE_SSE42)
+#include <nmmintrin.h>
+#endif
+
+
+/*
+ * the vectorized scanners skip the bytes that do not change the parser
+ * state; they return either the first byte of the set or the position
+ * after which less than a full vector of bytes remains
+ */
+
+typedef u_char *(*ngx_http_parse_scan_pt)(u_char *p, u_char *last);
+
+/* the stop characters, the terminating null is included in the sets */
+
+#if (NGX_WIN32)
+#define NGX_HTTP_PARSE_URI_STOP    " #%+./?\r\n\\"
+#else
+#define NGX_HTTP_PARSE_URI_STOP    " #%+./?\r\n"
+#endif
+#define NGX_HTTP_PARSE_ARGS_STOP   " #\r\n"
+#define NGX_HTTP_PARSE_VALUE_STOP  "\r\n"
+
+#if (NGX_HAVE_SSE42)
+static u_char *ngx_http_parse_scan_uri_sse42(u_char *p, u_char *last);
+static u_char *ngx_http_parse_scan_args_sse42(u_char *p, u_char *last);
+static u_char *ngx_http_parse_scan_value_sse42(u_char *p, u_char *last);
+#endif
+
+
+static ngx_http_parse_scan_pt  ngx_http_parse_scan_uri;
+static ngx_http_parse_scan_pt  ngx_http_parse_scan_args;
+static ngx_http_parse_scan_pt  ngx_http_parse_scan_value;
+
 
 static uint32_t  usual[] = {
     0xffffdbfe, /* 1111 1111 1111 1111  1101 1011 1111 1110 */
@@ -540,6 +574,17 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         /* check "/", "%" and "\" (Win32) in URI */
         case sw_check_uri:
 
+            if (ngx_http_parse_scan_uri && b->last - p >= 16) {
+                p = ngx_http_parse_scan_uri(p, b->last);
+
+                if (p == b->last) {
+                    p--;
+                    break;
+                }
+
+                ch = *p;
+            }
+
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
                 break;
             }
@@ -626,6 +671,17 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         /* URI */
         case sw_uri:
 
+            if (ngx_http_parse_scan_args && b->last - p >= 16) {
+                p = ngx_http_parse_scan_args(p, b->last);
+
+                if (p == b->last) {
+                    p--;
+                    break;
+                }
+
+                ch = *p;
+            }
+
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
                 break;
             }
@@ -841,7 +897,7 @@ ngx_int_t
 ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
     ngx_uint_t allow_underscores)
 {
-    u_char      c, ch, *p;
+    u_char      c, ch, *p, *m;
     ngx_uint_t  hash, i;
     enum {
         sw_start = 0,
@@ -1012,6 +1068,57 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 
         /* header value */
         case sw_value:
+
+            if (ngx_http_parse_scan_value && b->last - p >= 16) {
+
+                /*
+                 * the scanner stops at CR, LF, and null only, so the spaces
+                 * it has skipped are looked up here: before the end of line
+                 * they are excluded from the value, and before the bytes
+                 * left to the scalar code they start sw_space_after_value
+                 * as if the scalar code had scanned them
+                 */
+
+                p = ngx_http_parse_scan_value(p, b->last);
+
+                for (m = p; m > r->header_start; m--) {
+                    if (m[-1] != ' ') {
+                        break;
+                    }
+                }
+
+                if (p == b->last) {
+
+                    if (m != p) {
+                        r->header_end = m;
+                        state = sw_space_after_value;
+                    }
+
+                    p--;
+                    break;
+                }
+
+                ch = *p;
+
+                if (ch == CR || ch == LF) {
+                    r->header_end = m;
+
+                    if (ch == LF) {
+                        goto done;
+                    }
+
+                    state = sw_almost_done;
+                    break;
+                }
+
+                if (m != p) {
+                    r->header_end = m;
+                    state = sw_space_after_value;
+                    p--;
+                    break;
+                }
+            }
+
             switch (ch) {
             case ' ':
                 r->header_end = p;
@@ -2386,3 +2493,88 @@ invalid:
 
     return NGX_ERROR;
 }
+
+
+void
+ngx_http_parse_init(void)
+{
+#if (NGX_HAVE_SSE42)
+
+    if (ngx_cpu_features & NGX_CPU_SSE42) {
+        ngx_http_parse_scan_uri = ngx_http_parse_scan_uri_sse42;
+        ngx_http_parse_scan_args = ngx_http_parse_scan_args_sse42;
+        ngx_http_parse_scan_value = ngx_http_parse_scan_value_sse42;
+        return;
+    }
+
+#endif
+
+    ngx_http_parse_scan_uri = NULL;
+    ngx_http_parse_scan_args = NULL;
+    ngx_http_parse_scan_value = NULL;
+}
+
+
+#if (NGX_HAVE_SSE42)
+
+__attribute__((target("sse4.2")))
+static ngx_inline u_char *
+ngx_http_parse_scan_sse42(u_char *p, u_char *last, const char *stop,
+    size_t n)
+{
+    int      i;
+    u_char   set[16];
+    __m128i  s, b;
+
+    ngx_memzero(set, 16);
+    ngx_memcpy(set, stop, n);
+
+    s = _mm_loadu_si128((const __m128i *) set);
+
+    while (last - p >= 16) {
+        b = _mm_loadu_si128((const __m128i *) p);
+
+        i = _mm_cmpestri(s, (int) n, b, 16,
+                         _SIDD_UBYTE_OPS
+                         |_SIDD_CMP_EQUAL_ANY
+                         |_SIDD_LEAST_SIGNIFICANT);
+
+        if (i != 16) {
+            return p + i;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+
+__attribute__((target("sse4.2")))
+static u_char *
+ngx_http_parse_scan_uri_sse42(u_char *p, u_char *last)
+{
+    return ngx_http_parse_scan_sse42(p, last, NGX_HTTP_PARSE_URI_STOP,
+                                     sizeof(NGX_HTTP_PARSE_URI_STOP));
+}
+
+
+__attribute__((target("sse4.2")))
+static u_char *
+ngx_http_parse_scan_args_sse42(u_char *p, u_char *last)
+{
+    return ngx_http_parse_scan_sse42(p, last, NGX_HTTP_PARSE_ARGS_STOP,
+                                     sizeof(NGX_HTTP_PARSE_ARGS_STOP));
+}
+
+
+__attribute__((target("sse4.2")))
+static u_char *
+ngx_http_parse_scan_value_sse42(u_char *p, u_char *last)
+{
+    return ngx_http_parse_scan_sse42(p, last, NGX_HTTP_PARSE_VALUE_STOP,
+                                     sizeof(NGX_HTTP_PARSE_VALUE_STOP));
+}
+
+#endif
+
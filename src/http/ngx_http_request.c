@@ -2153,13 +2153,43 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
         ngx_http_server_name_t  *sn;
 
         sn = virtual_names->regex;
+        i = 0;
 
 #if (NGX_HTTP_SSL && defined SSL_CTRL_SET_TLSEXT_HOSTNAME)
 
         if (r == NULL) {
             ngx_http_connection_t  *hc;
 
-            for (i = 0; i < virtual_names->nregex; i++) {
+            if (virtual_names->regex_set) {
+
+                /* captures are not needed yet */
+
+                n = ngx_regex_exec_set(virtual_names->regex_set, host);
+
+                if (n == NGX_REGEX_NO_MATCHED) {
+                    return NGX_DECLINED;
+                }
+
+                if (n >= 0) {
+                    hc = c->data;
+                    hc->ssl_servername_regex = sn[n].regex;
+
+                    *cscfp = sn[n].server;
+                    return NGX_OK;
+                }
+
+                if (!ngx_regex_set_limit(n)) {
+                    ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                                  ngx_regex_exec_set_n " failed: %i on \"%V\"",
+                                  n, host);
+
+                    return NGX_ERROR;
+                }
+
+                /* the match limit was exceeded, test names one by one */
+            }
+
+            for ( /* void */ ; i < virtual_names->nregex; i++) {
 
                 n = ngx_regex_exec(sn[i].regex->regex, host, NULL, 0);
 
@@ -2188,7 +2218,23 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
 
 #endif /* NGX_HTTP_SSL && defined SSL_CTRL_SET_TLSEXT_HOSTNAME */
 
-        for (i = 0; i < virtual_names->nregex; i++) {
+        if (virtual_names->regex_set) {
+
+            /* find the first matching name in one pass */
+
+            n = ngx_http_regex_exec_set(r, virtual_names->regex_set, host);
+
+            if (n < 0) {
+                /* NGX_DECLINED or NGX_ERROR */
+                return n;
+            }
+
+            /* the name regex itself sets the captures */
+
+            i = n;
+        }
+
+        for ( /* void */ ; i < virtual_names->nregex; i++) {
 
             n = ngx_http_regex_exec(r, sn[i].regex, host);
 
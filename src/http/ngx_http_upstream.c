@@ -13,6 +13,10 @@
 #if (NGX_HTTP_CACHE)
 static ngx_int_t ngx_http_upstream_cache(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_cache_purge(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_cache_tags(ngx_http_request_t *r,
+    ngx_list_part_t *part, ngx_str_t *name, ngx_str_t *tags);
 static ngx_int_t ngx_http_upstream_cache_get(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_http_file_cache_t **cache);
 static ngx_int_t ngx_http_upstream_cache_send(ngx_http_request_t *r,
@@ -799,6 +803,7 @@ static ngx_int_t
 ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
     ngx_int_t               rc;
+    ngx_uint_t              purge;
     ngx_http_cache_t       *c;
     ngx_http_file_cache_t  *cache;
 
@@ -806,7 +811,20 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     if (c == NULL) {
 
-        if (!(r->method & u->conf->cache_methods)) {
+        switch (ngx_http_test_predicates(r, u->conf->cache_purge)) {
+
+        case NGX_ERROR:
+            return NGX_ERROR;
+
+        case NGX_DECLINED:
+            purge = 1;
+            break;
+
+        default: /* NGX_OK */
+            purge = 0;
+        }
+
+        if (!purge && !(r->method & u->conf->cache_methods)) {
             return NGX_DECLINED;
         }
 
@@ -851,6 +869,10 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
         c->min_uses = u->conf->cache_min_uses;
         c->file_cache = cache;
 
+        if (purge) {
+            return ngx_http_upstream_cache_purge(r, u);
+        }
+
         switch (ngx_http_test_predicates(r, u->conf->cache_bypass)) {
 
         case NGX_ERROR:
@@ -868,6 +890,13 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
         c->lock_timeout = u->conf->cache_lock_timeout;
         c->lock_age = u->conf->cache_lock_age;
 
+        /* a prefetch does not need to read an entry which is still valid */
+
+        if (r->cache_prefetch && ngx_http_file_cache_fresh(r) == NGX_OK) {
+            u->cache_status = NGX_HTTP_CACHE_HIT;
+            return NGX_HTTP_NO_CONTENT;
+        }
+
         u->cache_status = NGX_HTTP_CACHE_MISS;
     }
 
@@ -971,6 +1000,107 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 }
 
 
+static ngx_int_t
+ngx_http_upstream_cache_purge(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_int_t  rc;
+    ngx_str_t  tags;
+
+    ngx_str_null(&tags);
+
+    if (u->conf->cache_tags.len
+        && ngx_http_upstream_cache_tags(r, &r->headers_in.headers.part,
+                                        &u->conf->cache_tags, &tags)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    rc = ngx_http_file_cache_purge(r, &tags);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream cache purge: %i", rc);
+
+    switch (rc) {
+
+    case NGX_OK:
+        return NGX_HTTP_NO_CONTENT;
+
+    case NGX_DECLINED:
+        return NGX_HTTP_NOT_FOUND;
+
+    default:
+        return NGX_ERROR;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_cache_tags(ngx_http_request_t *r, ngx_list_part_t *part,
+    ngx_str_t *name, ngx_str_t *tags)
+{
+    u_char           *p;
+    size_t            len;
+    ngx_uint_t        i;
+    ngx_list_part_t  *first;
+    ngx_table_elt_t  *h;
+
+    /* the values of all headers with the name are joined by spaces */
+
+    first = part;
+    len = 0;
+
+    for ( ;; ) {
+
+        h = part->elts;
+
+        for (i = 0; i < part->nelts; i++) {
+            if (h[i].hash && h[i].key.len == name->len
+                && ngx_strncasecmp(h[i].key.data, name->data, name->len) == 0)
+            {
+                len += h[i].value.len + 1;
+            }
+        }
+
+        if (part->next == NULL) {
+            break;
+        }
+
+        part = part->next;
+    }
+
+    if (len == 0) {
+        ngx_str_null(tags);
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    tags->data = p;
+
+    for (part = first; part; part = part->next) {
+
+        h = part->elts;
+
+        for (i = 0; i < part->nelts; i++) {
+            if (h[i].hash && h[i].key.len == name->len
+                && ngx_strncasecmp(h[i].key.data, name->data, name->len) == 0)
+            {
+                p = ngx_copy(p, h[i].value.data, h[i].value.len);
+                *p++ = ' ';
+            }
+        }
+    }
+
+    tags->len = p - tags->data - 1;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_cache_get(ngx_http_request_t *r, ngx_http_upstream_t *u,
     ngx_http_file_cache_t **cache)
@@ -2997,6 +3127,16 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
                 ngx_str_null(&r->cache->etag);
             }
 
+            if (u->conf->cache_tags.len
+                && ngx_http_upstream_cache_tags(r, &u->headers_in.headers.part,
+                                                &u->conf->cache_tags,
+                                                &r->cache->tags)
+                   != NGX_OK)
+            {
+                ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+                return;
+            }
+
             if (ngx_http_file_cache_set_header(r, u->buffer.start) != NGX_OK) {
                 ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
                 return;
@@ -3901,6 +4041,9 @@ ngx_http_upstream_process_request(ngx_http_request_t *r,
 
             } else if (p->upstream_error) {
                 ngx_http_file_cache_free(r->cache, p->temp_file);
+
+            } else {
+                ngx_http_file_cache_publish(r, p->temp_file);
             }
         }
 
@@ -5588,7 +5731,8 @@ ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
                                          |NGX_HTTP_UPSTREAM_MAX_FAILS
                                          |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
                                          |NGX_HTTP_UPSTREAM_DOWN
-                                         |NGX_HTTP_UPSTREAM_BACKUP);
+                                         |NGX_HTTP_UPSTREAM_BACKUP
+                                         |NGX_HTTP_UPSTREAM_SLOW_START);
     if (uscf == NULL) {
         return NGX_CONF_ERROR;
     }
@@ -5687,6 +5831,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_str_t                   *value, s;
     ngx_url_t                    u;
     ngx_int_t                    weight, max_conns, max_fails;
+    ngx_msec_t                   slow_start;
     ngx_uint_t                   i;
     ngx_http_upstream_server_t  *us;
 
@@ -5703,6 +5848,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     max_conns = 0;
     max_fails = 1;
     fail_timeout = 10;
+    slow_start = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
 
@@ -5769,6 +5915,43 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "slow_start=", 11) == 0) {
+
+            if (!(uscf->flags & NGX_HTTP_UPSTREAM_SLOW_START)) {
+                goto not_supported;
+            }
+
+            s.len = value[i].len - 11;
+            s.data = &value[i].data[11];
+
+            slow_start = ngx_parse_time(&s, 0);
+
+            if (slow_start == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (ngx_strcmp(value[i].data, "resolve") == 0) {
+            us->resolve = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "service=", 8) == 0) {
+
+            us->service.len = value[i].len - 8;
+            us->service.data = &value[i].data[8];
+
+            if (us->service.len == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+#endif
+
         if (ngx_strcmp(value[i].data, "backup") == 0) {
 
             if (!(uscf->flags & NGX_HTTP_UPSTREAM_BACKUP)) {
@@ -5794,10 +5977,18 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         goto invalid;
     }
 
+    if (us->service.len && !us->resolve) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"service\" parameter requires \"resolve\" "
+                           "in upstream \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
     ngx_memzero(&u, sizeof(ngx_url_t));
 
     u.url = value[1];
     u.default_port = 80;
+    u.no_resolve = us->resolve;
 
     if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
         if (u.err) {
@@ -5808,6 +5999,27 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (us->service.len && (u.naddrs || !u.no_port)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"service\" parameter requires a name "
+                           "without port in upstream \"%V\"", &u.url);
+        return NGX_CONF_ERROR;
+    }
+
+    if (us->resolve) {
+
+        if (u.naddrs) {
+
+            /* addresses are not resolved */
+
+            us->resolve = 0;
+
+        } else {
+            us->host = u.host;
+            us->port = u.port;
+        }
+    }
+
     us->name = u.url;
     us->addrs = u.addrs;
     us->naddrs = u.naddrs;
@@ -5815,6 +6027,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     us->max_conns = max_conns;
     us->max_fails = max_fails;
     us->fail_timeout = fail_timeout;
+    us->slow_start = slow_start;
 
     return NGX_CONF_OK;
 
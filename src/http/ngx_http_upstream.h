@@ -99,8 +99,13 @@ typedef struct {
     time_t                           fail_timeout;
     ngx_msec_t                       slow_start;
 
+    ngx_str_t                        host;
+    ngx_str_t                        service;
+    in_port_t                        port;
+
     unsigned                         down:1;
     unsigned                         backup:1;
+    unsigned                         resolve:1;
 
     NGX_COMPAT_BEGIN(6)
     NGX_COMPAT_END
@@ -114,6 +119,7 @@ typedef struct {
 #define NGX_HTTP_UPSTREAM_DOWN          0x0010
 #define NGX_HTTP_UPSTREAM_BACKUP        0x0020
 #define NGX_HTTP_UPSTREAM_MAX_CONNS     0x0100
+#define NGX_HTTP_UPSTREAM_SLOW_START    0x0200
 
 
 struct ngx_http_upstream_srv_conf_s {
@@ -131,6 +137,8 @@ struct ngx_http_upstream_srv_conf_s {
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_shm_zone_t                  *shm_zone;
+    ngx_resolver_t                  *resolver;
+    ngx_msec_t                       resolver_timeout;
 #endif
 };
 
@@ -209,6 +217,7 @@ typedef struct {
     ngx_array_t                     *cache_valid;
     ngx_array_t                     *cache_bypass;
     ngx_array_t                     *cache_purge;
+    ngx_str_t                        cache_tags;
     ngx_array_t                     *no_cache;
 #endif
 
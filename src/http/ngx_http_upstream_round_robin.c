@@ -32,18 +32,58 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
     ngx_url_t                      u;
-    ngx_uint_t                     i, j, n, w;
+    ngx_uint_t                     i, j, n, w, r;
     ngx_http_upstream_server_t    *server;
     ngx_http_upstream_rr_peer_t   *peer, **peerp;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_core_loc_conf_t      *clcf;
+#endif
 
     us->peer.init = ngx_http_upstream_init_round_robin_peer;
 
     if (us->servers) {
         server = us->servers->elts;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+        for (i = 0; i < us->servers->nelts; i++) {
+            if (!server[i].resolve) {
+                continue;
+            }
+
+            if (us->shm_zone == NULL) {
+                ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                              "resolving names at run time requires "
+                              "upstream \"%V\" in %s:%ui "
+                              "to be in shared memory",
+                              &us->host, us->file_name, us->line);
+                return NGX_ERROR;
+            }
+
+            clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+            if (clcf->resolver == NULL
+                || clcf->resolver->connections.nelts == 0)
+            {
+                ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                              "no resolver defined to resolve names "
+                              "at run time in upstream \"%V\" in %s:%ui",
+                              &us->host, us->file_name, us->line);
+                return NGX_ERROR;
+            }
+
+            us->resolver = clcf->resolver;
+            us->resolver_timeout = clcf->resolver_timeout;
+
+            break;
+        }
+
+#endif
+
         n = 0;
         w = 0;
+        r = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             if (server[i].backup) {
@@ -52,9 +92,15 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
+
+            if (server[i].resolve) {
+                r++;
+            }
         }
 
-        if (n == 0) {
+        /* servers resolved at run time are added to the list later */
+
+        if (n == 0 && r == 0) {
             ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
                           "no servers in upstream \"%V\" in %s:%ui",
                           &us->host, us->file_name, us->line);
@@ -95,6 +141,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].max_conns = server[i].max_conns;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
+                peer[n].slow_start = server[i].slow_start;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
 
@@ -159,6 +206,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].max_conns = server[i].max_conns;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
+                peer[n].slow_start = server[i].slow_start;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
 
@@ -262,12 +310,27 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     rrp->current = NULL;
     rrp->config = 0;
 
+    ngx_http_upstream_rr_peers_rlock(rrp->peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (rrp->peers->config) {
+        rrp->config = *rrp->peers->config;
+    }
+#endif
+
     n = rrp->peers->number;
 
     if (rrp->peers->next && rrp->peers->next->number > n) {
         n = rrp->peers->next->number;
     }
 
+    ngx_http_upstream_rr_peers_unlock(rrp->peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    rrp->ntried = (n + (8 * sizeof(uintptr_t) - 1)) / (8 * sizeof(uintptr_t));
+    rrp->pool = r->pool;
+#endif
+
     if (n <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
         rrp->data = 0;
@@ -432,6 +495,11 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     peers = rrp->peers;
     ngx_http_upstream_rr_peers_wlock(peers);
 
+    if (ngx_http_upstream_rr_update_tried(rrp) != NGX_OK) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return NGX_ERROR;
+    }
+
     if (peers->single) {
         peer = peers->peer;
 
@@ -509,7 +577,7 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 {
     time_t                        now;
     uintptr_t                     m;
-    ngx_int_t                     total;
+    ngx_int_t                     total, weight;
     ngx_uint_t                    i, n, p;
     ngx_http_upstream_rr_peer_t  *peer, *best;
 
@@ -548,8 +616,11 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
             continue;
         }
 
-        peer->current_weight += peer->effective_weight;
-        total += peer->effective_weight;
+        weight = ngx_http_upstream_rr_peer_weight(peer,
+                                                  peer->effective_weight);
+
+        peer->current_weight += weight;
+        total += weight;
 
         if (peer->effective_weight < peer->weight) {
             peer->effective_weight++;
@@ -619,12 +690,23 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
         peer->accessed = now;
         peer->checked = now;
 
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(&peer->stats.fails, 1);
+#endif
+
         if (peer->max_fails) {
             peer->effective_weight -= peer->weight / peer->max_fails;
 
             if (peer->fails >= peer->max_fails) {
                 ngx_log_error(NGX_LOG_WARN, pc->log, 0,
                               "upstream server temporarily disabled");
+
+                /* the ramp starts as soon as the peer is tried again */
+
+                if (peer->slow_start) {
+                    peer->start_time = ngx_current_msec
+                                       + (ngx_msec_t) peer->fail_timeout * 1000;
+                }
             }
         }
 
@@ -656,6 +738,84 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 }
 
 
+ngx_int_t
+ngx_http_upstream_rr_peer_weight(ngx_http_upstream_rr_peer_t *peer,
+    ngx_int_t weight)
+{
+    ngx_int_t       w;
+    ngx_msec_int_t  elapsed;
+
+    /*
+     * the weight of a recovered peer grows linearly during slow start;
+     * weights are scaled to keep the ramp smooth even for "weight=1";
+     * peer->start_time is left intact as only the read lock is held
+     */
+
+    weight *= NGX_HTTP_UPSTREAM_RR_WEIGHT_SCALE;
+
+    if (peer->start_time == 0) {
+        return weight;
+    }
+
+    elapsed = (ngx_msec_int_t) (ngx_current_msec - peer->start_time);
+
+    if (elapsed >= (ngx_msec_int_t) peer->slow_start) {
+        return weight;
+    }
+
+    if (elapsed < 0) {
+        elapsed = 0;
+    }
+
+    w = weight * elapsed / (ngx_msec_int_t) peer->slow_start;
+
+    return w ? w : ngx_min(weight, 1);
+}
+
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+ngx_int_t
+ngx_http_upstream_rr_grow_tried(ngx_http_upstream_rr_peer_data_t *rrp)
+{
+    uintptr_t   *tried;
+    ngx_uint_t   n;
+
+    /*
+     * peers are locked; the bits of the peers added at runtime
+     * are clear, retries of requests started earlier may use them
+     */
+
+    rrp->config = *rrp->peers->config;
+
+    n = rrp->peers->number;
+
+    if (rrp->peers->next && rrp->peers->next->number > n) {
+        n = rrp->peers->next->number;
+    }
+
+    n = (n + (8 * sizeof(uintptr_t) - 1)) / (8 * sizeof(uintptr_t));
+
+    if (n <= rrp->ntried) {
+        return NGX_OK;
+    }
+
+    tried = ngx_pcalloc(rrp->pool, n * sizeof(uintptr_t));
+    if (tried == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(tried, rrp->tried, rrp->ntried * sizeof(uintptr_t));
+
+    rrp->tried = tried;
+    rrp->ntried = n;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 #if (NGX_HTTP_SSL)
 
 ngx_int_t
@@ -16,6 +16,25 @@
 
 typedef struct ngx_http_upstream_rr_peer_s   ngx_http_upstream_rr_peer_t;
 
+
+/* the "down" bits, besides the "down" server parameter */
+#define NGX_HTTP_UPSTREAM_RR_DOWN          0x01
+#define NGX_HTTP_UPSTREAM_RR_UNHEALTHY     0x02
+#define NGX_HTTP_UPSTREAM_RR_DRAINING      0x04
+#define NGX_HTTP_UPSTREAM_RR_REMOVED       0x08
+
+#define NGX_HTTP_UPSTREAM_RR_WEIGHT_SCALE  100
+
+
+typedef struct {
+    ngx_atomic_t                    requests;
+    ngx_atomic_t                    responses[5];
+    ngx_atomic_t                    received;
+    ngx_atomic_t                    response_time;
+    ngx_atomic_t                    fails;
+} ngx_http_upstream_rr_peer_stats_t;
+
+
 struct ngx_http_upstream_rr_peer_s {
     struct sockaddr                *sockaddr;
     socklen_t                       socklen;
@@ -49,6 +68,15 @@ struct ngx_http_upstream_rr_peer_s {
     ngx_atomic_t                    lock;
 #endif
 
+    ngx_uint_t                      ewma;
+    ngx_msec_t                      ewma_time;
+
+    ngx_uint_t                      hc_fails;
+    ngx_uint_t                      hc_passes;
+    ngx_msec_t                      hc_checking;
+
+    ngx_http_upstream_rr_peer_stats_t  stats;
+
     ngx_http_upstream_rr_peer_t    *next;
 
     NGX_COMPAT_BEGIN(32)
@@ -64,6 +92,7 @@ struct ngx_http_upstream_rr_peers_s {
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_slab_pool_t                *shpool;
     ngx_atomic_t                    rwlock;
+    ngx_uint_t                     *config;
     ngx_http_upstream_rr_peers_t   *zone_next;
 #endif
 
@@ -113,6 +142,16 @@ struct ngx_http_upstream_rr_peers_s {
         ngx_rwlock_unlock(&peer->lock);                                       \
     }
 
+
+/*
+ * the list of peers was extended after the request data were initialized,
+ * the tried bitmap is extended to the new number of peers
+ */
+
+#define ngx_http_upstream_rr_update_tried(rrp)                                \
+    (((rrp)->peers->config && (rrp)->config != *(rrp)->peers->config)         \
+     ? ngx_http_upstream_rr_grow_tried(rrp) : NGX_OK)
+
 #else
 
 #define ngx_http_upstream_rr_peers_rlock(peers)
@@ -120,6 +159,7 @@ struct ngx_http_upstream_rr_peers_s {
 #define ngx_http_upstream_rr_peers_unlock(peers)
 #define ngx_http_upstream_rr_peer_lock(peers, peer)
 #define ngx_http_upstream_rr_peer_unlock(peers, peer)
+#define ngx_http_upstream_rr_update_tried(rrp)  NGX_OK
 
 #endif
 
@@ -130,6 +170,10 @@ typedef struct {
     ngx_http_upstream_rr_peer_t    *current;
     uintptr_t                      *tried;
     uintptr_t                       data;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                      ntried;
+    ngx_pool_t                     *pool;
+#endif
 } ngx_http_upstream_rr_peer_data_t;
 
 
@@ -143,6 +187,18 @@ ngx_int_t ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
     void *data);
 void ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
+ngx_int_t ngx_http_upstream_rr_peer_weight(ngx_http_upstream_rr_peer_t *peer,
+    ngx_int_t weight);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+ngx_int_t ngx_http_upstream_rr_grow_tried(
+    ngx_http_upstream_rr_peer_data_t *rrp);
+ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_add_peer(
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t backup,
+    struct sockaddr *sockaddr, socklen_t socklen, ngx_str_t *server);
+void ngx_http_upstream_zone_update_weights(
+    ngx_http_upstream_rr_peers_t *peers);
+#endif
 
 #if (NGX_HTTP_SSL)
 ngx_int_t
@@ -2363,8 +2363,25 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
         ngx_http_map_regex_t  *reg;
 
         reg = map->regex;
+        i = 0;
 
-        for (i = 0; i < map->nregex; i++) {
+        if (map->regex_set) {
+
+            /* find the first matching regex in one pass */
+
+            n = ngx_http_regex_exec_set(r, map->regex_set, match);
+
+            if (n < 0) {
+                /* NGX_DECLINED or NGX_ERROR */
+                return NULL;
+            }
+
+            /* the regex itself sets the captures */
+
+            i = n;
+        }
+
+        for ( /* void */ ; i < map->nregex; i++) {
 
             n = ngx_http_regex_exec(r, reg[i].regex, match);
 
@@ -2539,6 +2556,80 @@ ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s)
     return NGX_OK;
 }
 
+
+ngx_regex_set_t *
+ngx_http_regex_compile_set(ngx_conf_t *cf, ngx_regex_elt_t *elts,
+    ngx_uint_t n)
+{
+    ngx_regex_set_t            *set;
+    ngx_regex_compile_t         rc;
+    ngx_http_core_main_conf_t  *cmcf;
+    u_char                      errstr[NGX_MAX_CONF_ERRSTR];
+
+    /*
+     * regex sets are only used if enabled before the regexes are compiled,
+     * like the map_hash_max_size directive for maps
+     */
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    if (cmcf->regex_set != 1 || n < NGX_HTTP_REGEX_SET_MIN) {
+        return NULL;
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pool = cf->pool;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    set = ngx_regex_compile_set(&rc, elts, n);
+
+    if (set == NULL) {
+        ngx_conf_log_error(NGX_LOG_INFO, cf, 0,
+                           "regexes are tested one by one: %V", &rc.err);
+    }
+
+    return set;
+}
+
+
+ngx_int_t
+ngx_http_regex_exec_set(ngx_http_request_t *r, ngx_regex_set_t *set,
+    ngx_str_t *s)
+{
+    ngx_int_t  n;
+
+    n = ngx_regex_exec_set(set, s);
+
+    if (n >= 0) {
+        return n;
+    }
+
+    if (n == NGX_REGEX_NO_MATCHED) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_regex_set_limit(n)) {
+
+        /*
+         * a combined regex may exceed the match limit where the regexes
+         * do not, so they are tested one by one from the first one
+         */
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       ngx_regex_exec_set_n " failed: %i on \"%V\", "
+                       "testing regexes one by one", n, s);
+
+        return 0;
+    }
+
+    ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                  ngx_regex_exec_set_n " failed: %i on \"%V\"", n, s);
+
+    return NGX_ERROR;
+}
+
 #endif
 
 
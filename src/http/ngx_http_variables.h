@@ -61,6 +61,10 @@ ngx_int_t ngx_http_variable_unknown_header(ngx_http_variable_value_t *v,
 
 #if (NGX_PCRE)
 
+/* the number of regexes from which they are matched as a set */
+#define NGX_HTTP_REGEX_SET_MIN        8
+
+
 typedef struct {
     ngx_uint_t                    capture;
     ngx_int_t                     index;
@@ -86,6 +90,10 @@ ngx_http_regex_t *ngx_http_regex_compile(ngx_conf_t *cf,
     ngx_regex_compile_t *rc);
 ngx_int_t ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re,
     ngx_str_t *s);
+ngx_regex_set_t *ngx_http_regex_compile_set(ngx_conf_t *cf,
+    ngx_regex_elt_t *elts, ngx_uint_t n);
+ngx_int_t ngx_http_regex_exec_set(ngx_http_request_t *r, ngx_regex_set_t *set,
+    ngx_str_t *s);
 
 #endif
 
@@ -95,6 +103,7 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_http_map_regex_t         *regex;
     ngx_uint_t                    nregex;
+    ngx_regex_set_t              *regex_set;
 #endif
 } ngx_http_map_t;
 
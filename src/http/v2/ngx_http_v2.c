@@ -171,6 +171,7 @@ static ngx_int_t ngx_http_v2_terminate_stream(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_stream_t *stream, ngx_uint_t status);
 static void ngx_http_v2_close_stream_handler(ngx_event_t *ev);
 static void ngx_http_v2_handle_connection_handler(ngx_event_t *rev);
+static void ngx_http_v2_table_error_handler(ngx_event_t *rev);
 static void ngx_http_v2_idle_handler(ngx_event_t *rev);
 static void ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
     ngx_uint_t status);
@@ -245,6 +246,8 @@ ngx_http_v2_init(ngx_event_t *rev)
 
     h2c->frame_size = NGX_HTTP_V2_DEFAULT_FRAME_SIZE;
 
+    h2c->table_size = NGX_HTTP_V2_TABLE_SIZE;
+
     h2scf = ngx_http_get_module_srv_conf(hc->conf_ctx, ngx_http_v2_module);
 
     h2c->pool = ngx_create_pool(h2scf->pool_size, h2c->connection->log);
@@ -1986,6 +1989,11 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         switch (id) {
 
+        case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
+
+            ngx_http_v2_table_update_size(h2c, value);
+            break;
+
         case NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING:
 
             if (value > NGX_HTTP_V2_MAX_WINDOW) {
@@ -4109,11 +4117,17 @@ ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc)
 
     h2c->processing--;
 
-    if (h2c->processing || h2c->blocked) {
+    ev = h2c->connection->read;
+
+    if (h2c->table_error && !h2c->connection->error) {
+        ev->handler = ngx_http_v2_table_error_handler;
+        ngx_post_event(ev, &ngx_posted_events);
         return;
     }
 
-    ev = h2c->connection->read;
+    if (h2c->processing || h2c->blocked) {
+        return;
+    }
 
     ev->handler = ngx_http_v2_handle_connection_handler;
     ngx_post_event(ev, &ngx_posted_events);
@@ -4178,6 +4192,27 @@ ngx_http_v2_handle_connection_handler(ngx_event_t *rev)
 }
 
 
+static void
+ngx_http_v2_table_error_handler(ngx_event_t *rev)
+{
+    ngx_connection_t          *c;
+    ngx_http_v2_connection_t  *h2c;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, rev->log, 0,
+                   "http2 table error handler");
+
+    c = rev->data;
+    h2c = c->data;
+
+    /*
+     * a header block was not sent after the encoder table was changed,
+     * so the client's decoder table can no longer be kept in sync
+     */
+
+    ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_COMP_ERROR);
+}
+
+
 static void
 ngx_http_v2_idle_handler(ngx_event_t *rev)
 {
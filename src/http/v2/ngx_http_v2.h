@@ -26,6 +26,9 @@
 
 #define NGX_HTTP_V2_FRAME_HEADER_SIZE    9
 
+#define NGX_HTTP_V2_TABLE_SIZE           4096
+#define NGX_HTTP_V2_MAX_TABLE_SIZE       65536
+
 /* frame types */
 #define NGX_HTTP_V2_DATA_FRAME           0x0
 #define NGX_HTTP_V2_HEADERS_FRAME        0x1
@@ -107,6 +110,11 @@ typedef struct {
     size_t                           free;
     u_char                          *storage;
     u_char                          *pos;
+    u_char                          *end;
+
+    /* encoder only */
+    ngx_uint_t                      *buckets;
+    ngx_uint_t                      *next;
 } ngx_http_v2_hpack_t;
 
 
@@ -127,6 +135,8 @@ struct ngx_http_v2_connection_s {
     ngx_http_v2_state_t              state;
 
     ngx_http_v2_hpack_t              hpack;
+    ngx_http_v2_hpack_t              hpack_enc;
+    size_t                           table_size;
 
     ngx_pool_t                      *pool;
 
@@ -146,6 +156,8 @@ struct ngx_http_v2_connection_s {
     unsigned                         settings_ack:1;
     unsigned                         blocked:1;
     unsigned                         goaway:1;
+    unsigned                         table_update:1;
+    unsigned                         table_error:1;
 };
 
 
@@ -287,6 +299,14 @@ ngx_int_t ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header);
 ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
+ngx_int_t ngx_http_v2_table_encoder(ngx_http_v2_connection_t *h2c);
+void ngx_http_v2_table_update_size(ngx_http_v2_connection_t *h2c,
+    size_t size);
+ngx_uint_t ngx_http_v2_table_lookup(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_header_t *header, ngx_uint_t *name_index);
+ngx_int_t ngx_http_v2_table_add(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_header_t *header);
+
 
 ngx_int_t ngx_http_v2_huff_decode(u_char *state, u_char *src, size_t len,
     u_char **dst, ngx_uint_t last, ngx_log_t *log);
@@ -33,6 +33,19 @@
 #define NGX_HTTP_V2_ENCODE_RAW            0
 #define NGX_HTTP_V2_ENCODE_HUFF           0x80
 
+#define NGX_HTTP_V2_FIELD_INC_INDEXED     0x40
+#define NGX_HTTP_V2_FIELD_NOT_INDEXED     0
+#define NGX_HTTP_V2_FIELD_NEVER_INDEXED   0x10
+
+#define NGX_HTTP_V2_TABLE_SIZE_UPDATE     0x20
+
+/*
+ * Fields larger than this part of the encoder table are not indexed,
+ * so that a single big value does not flush the whole table.
+ */
+
+#define NGX_HTTP_V2_FIELD_MAX_SHARE       4
+
 #define NGX_HTTP_V2_STATUS_INDEX          8
 #define NGX_HTTP_V2_STATUS_200_INDEX      8
 #define NGX_HTTP_V2_STATUS_204_INDEX      9
@@ -57,6 +70,11 @@ static u_char *ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len,
     u_char *tmp, ngx_uint_t lower);
 static u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
     ngx_uint_t value);
+static u_char *ngx_http_v2_write_field(ngx_http_v2_connection_t *h2c,
+    u_char *pos, ngx_str_t *name, ngx_str_t *value, ngx_uint_t type,
+    u_char *tmp);
+static ngx_uint_t ngx_http_v2_field_type(ngx_http_request_t *r,
+    ngx_str_t *name);
 static ngx_http_v2_out_frame_t *ngx_http_v2_create_headers_frame(
     ngx_http_request_t *r, u_char *pos, u_char *end, ngx_uint_t fin);
 static ngx_http_v2_out_frame_t *ngx_http_v2_create_trailers_frame(
@@ -130,10 +148,11 @@ static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 static ngx_int_t
 ngx_http_v2_header_filter(ngx_http_request_t *r)
 {
-    u_char                     status, *pos, *start, *p, *tmp;
+    u_char                     status, *pos, *start, *p, *tmp, *low;
     size_t                     len, tmp_len;
-    ngx_str_t                  host, location;
-    ngx_uint_t                 i, port;
+    ngx_int_t                  rc;
+    ngx_str_t                  host, location, name, value;
+    ngx_uint_t                 i, port, encoder;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
     ngx_connection_t          *fc;
@@ -141,7 +160,10 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     ngx_http_v2_out_frame_t   *frame;
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
+    ngx_http_v2_connection_t  *h2c;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
+    u_char                     buf[NGX_OFF_T_LEN
+                                   + sizeof("Wed, 31 Dec 1986 18:00:00 GMT")];
 
     static const u_char nginx[5] = "\x84\xaa\x63\x55\xe7";
 #if (NGX_HTTP_GZIP)
@@ -235,8 +257,26 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
     }
 
+    h2c = r->stream->connection;
+
+    if (h2c->table_error) {
+        return NGX_ERROR;
+    }
+
+    rc = ngx_http_v2_table_encoder(h2c);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    encoder = (rc == NGX_OK);
+
     len = status ? 1 : 1 + ngx_http_v2_literal_size("418");
 
+    if (encoder && h2c->table_update) {
+        len += 1 + NGX_HTTP_V2_INT_OCTETS;
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     if (r->headers_out.server == NULL) {
@@ -421,8 +461,30 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
+    if (encoder) {
+        low = ngx_pnalloc(r->pool, tmp_len);
+        if (low == NULL) {
+            return NGX_ERROR;
+        }
+
+    } else {
+        low = NULL;
+    }
+
     start = pos;
 
+    if (encoder && h2c->table_update) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 hpack table size update: %uz",
+                       h2c->hpack_enc.size);
+
+        *pos = NGX_HTTP_V2_TABLE_SIZE_UPDATE;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5),
+                                    h2c->hpack_enc.size);
+
+        h2c->table_update = 0;
+    }
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 output header: \":status: %03ui\"",
                    r->headers_out.status);
@@ -430,6 +492,19 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (status) {
         *pos++ = status;
 
+    } else if (encoder) {
+        ngx_str_set(&name, ":status");
+
+        value.len = 3;
+        value.data = buf;
+        ngx_sprintf(buf, "%03ui", r->headers_out.status);
+
+        pos = ngx_http_v2_write_field(h2c, pos, &name, &value,
+                                      NGX_HTTP_V2_FIELD_INC_INDEXED, tmp);
+        if (pos == NULL) {
+            return NGX_ERROR;
+        }
+
     } else {
         *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
         *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
@@ -453,9 +528,28 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                            "http2 output header: \"server: nginx\"");
         }
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
+        if (encoder) {
+            ngx_str_set(&name, "server");
+
+            if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
+                ngx_str_set(&value, NGINX_VER);
+
+            } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
+                ngx_str_set(&value, NGINX_VER_BUILD);
+
+            } else {
+                ngx_str_set(&value, "nginx");
+            }
+
+            pos = ngx_http_v2_write_field(h2c, pos, &name, &value,
+                                          NGX_HTTP_V2_FIELD_INC_INDEXED, tmp);
+            if (pos == NULL) {
+                return NGX_ERROR;
+            }
+
+        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
 
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
             if (nginx_ver[0] == '\0') {
                 p = ngx_http_v2_write_value(nginx_ver, (u_char *) NGINX_VER,
                                             sizeof(NGINX_VER) - 1, tmp);
@@ -465,6 +559,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
             pos = ngx_cpymem(pos, nginx_ver, nginx_ver_len);
 
         } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
+
             if (nginx_ver_build[0] == '\0') {
                 p = ngx_http_v2_write_value(nginx_ver_build,
                                             (u_char *) NGINX_VER_BUILD,
@@ -475,6 +571,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
             pos = ngx_cpymem(pos, nginx_ver_build, nginx_ver_build_len);
 
         } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
             pos = ngx_cpymem(pos, nginx, sizeof(nginx));
         }
     }
@@ -484,13 +581,28 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"date: %V\"",
                        &ngx_cached_http_time);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
-        pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
-                                      ngx_cached_http_time.len, tmp);
+        if (encoder) {
+            ngx_str_set(&name, "date");
+
+            value.len = ngx_cached_http_time.len;
+            value.data = ngx_cached_http_time.data;
+
+            /* the date changes every second and is not worth indexing */
+
+            pos = ngx_http_v2_write_field(h2c, pos, &name, &value,
+                                          NGX_HTTP_V2_FIELD_NOT_INDEXED, tmp);
+            if (pos == NULL) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
+            pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
+                                          ngx_cached_http_time.len, tmp);
+        }
     }
 
     if (r->headers_out.content_type.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
 
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
@@ -521,8 +633,23 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        pos = ngx_http_v2_write_value(pos, r->headers_out.content_type.data,
-                                      r->headers_out.content_type.len, tmp);
+        if (encoder) {
+            ngx_str_set(&name, "content-type");
+
+            pos = ngx_http_v2_write_field(h2c, pos, &name,
+                                          &r->headers_out.content_type,
+                                          NGX_HTTP_V2_FIELD_INC_INDEXED, tmp);
+            if (pos == NULL) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
+            pos = ngx_http_v2_write_value(pos,
+                                          r->headers_out.content_type.data,
+                                          r->headers_out.content_type.len,
+                                          tmp);
+        }
     }
 
     if (r->headers_out.content_length == NULL
@@ -532,30 +659,65 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-length: %O\"",
                        r->headers_out.content_length_n);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+        if (encoder) {
+            ngx_str_set(&name, "content-length");
+
+            value.data = buf;
+            value.len = ngx_sprintf(buf, "%O", r->headers_out.content_length_n)
+                        - buf;
 
-        p = pos;
-        pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
-        *p = NGX_HTTP_V2_ENCODE_RAW | (u_char) (pos - p - 1);
+            pos = ngx_http_v2_write_field(h2c, pos, &name, &value,
+                                          NGX_HTTP_V2_FIELD_NOT_INDEXED, tmp);
+            if (pos == NULL) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+
+            p = pos;
+            pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
+            *p = NGX_HTTP_V2_ENCODE_RAW | (u_char) (pos - p - 1);
+        }
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
+        if (encoder) {
+            ngx_str_set(&name, "last-modified");
 
-        ngx_http_time(pos, r->headers_out.last_modified_time);
-        len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
+            value.data = buf;
+            value.len = ngx_http_time(buf, r->headers_out.last_modified_time)
+                        - buf;
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 output header: \"last-modified: %*s\"",
-                       len, pos);
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                           "http2 output header: \"last-modified: %V\"",
+                           &value);
 
-        /*
-         * Date will always be encoded using huffman in the temporary buffer,
-         * so it's safe here to use src and dst pointing to the same address.
-         */
-        pos = ngx_http_v2_write_value(pos, pos, len, tmp);
+            pos = ngx_http_v2_write_field(h2c, pos, &name, &value,
+                                          NGX_HTTP_V2_FIELD_NOT_INDEXED, tmp);
+            if (pos == NULL) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
+
+            ngx_http_time(pos, r->headers_out.last_modified_time);
+            len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                           "http2 output header: \"last-modified: %*s\"",
+                           len, pos);
+
+            /*
+             * Date will always be encoded using huffman in the temporary
+             * buffer, so it's safe here to use src and dst pointing to
+             * the same address.
+             */
+            pos = ngx_http_v2_write_value(pos, pos, len, tmp);
+        }
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -563,9 +725,23 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"location: %V\"",
                        &r->headers_out.location->value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
-        pos = ngx_http_v2_write_value(pos, r->headers_out.location->value.data,
-                                      r->headers_out.location->value.len, tmp);
+        if (encoder) {
+            ngx_str_set(&name, "location");
+
+            pos = ngx_http_v2_write_field(h2c, pos, &name,
+                                          &r->headers_out.location->value,
+                                          NGX_HTTP_V2_FIELD_NOT_INDEXED, tmp);
+            if (pos == NULL) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
+            pos = ngx_http_v2_write_value(pos,
+                                          r->headers_out.location->value.data,
+                                          r->headers_out.location->value.len,
+                                          tmp);
+        }
     }
 
 #if (NGX_HTTP_GZIP)
@@ -573,8 +749,20 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"vary: Accept-Encoding\"");
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        if (encoder) {
+            ngx_str_set(&name, "vary");
+            ngx_str_set(&value, "Accept-Encoding");
+
+            pos = ngx_http_v2_write_field(h2c, pos, &name, &value,
+                                          NGX_HTTP_V2_FIELD_INC_INDEXED, tmp);
+            if (pos == NULL) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
+            pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        }
     }
 #endif
 
@@ -607,6 +795,22 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
 #endif
 
+        if (encoder) {
+            name.len = header[i].key.len;
+            name.data = low;
+
+            ngx_strlow(low, header[i].key.data, header[i].key.len);
+
+            pos = ngx_http_v2_write_field(h2c, pos, &name, &header[i].value,
+                                          ngx_http_v2_field_type(r, &name),
+                                          tmp);
+            if (pos == NULL) {
+                return NGX_ERROR;
+            }
+
+            continue;
+        }
+
         *pos++ = 0;
 
         pos = ngx_http_v2_write_name(pos, header[i].key.data,
@@ -618,6 +822,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
     frame = ngx_http_v2_create_headers_frame(r, start, pos, r->header_only);
     if (frame == NULL) {
+        h2c->table_error = encoder;
         return NGX_ERROR;
     }
 
@@ -800,6 +1005,99 @@ ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix, ngx_uint_t value)
 }
 
 
+static u_char *
+ngx_http_v2_write_field(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_str_t *name, ngx_str_t *value, ngx_uint_t type, u_char *tmp)
+{
+    ngx_uint_t            index, name_index;
+    ngx_http_v2_header_t  header;
+
+    header.name = *name;
+    header.value = *value;
+
+    index = ngx_http_v2_table_lookup(h2c, &header, &name_index);
+
+    if (index) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 hpack indexed field: %ui", index);
+
+        *pos = ngx_http_v2_indexed(0);
+        return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), index);
+    }
+
+    if (type == NGX_HTTP_V2_FIELD_INC_INDEXED
+        && 32 + name->len + value->len
+           > h2c->hpack_enc.size / NGX_HTTP_V2_FIELD_MAX_SHARE)
+    {
+        type = NGX_HTTP_V2_FIELD_NOT_INDEXED;
+    }
+
+    *pos = (u_char) type;
+
+    if (type == NGX_HTTP_V2_FIELD_INC_INDEXED) {
+        if (ngx_http_v2_table_add(h2c, &header) != NGX_OK) {
+            h2c->table_error = 1;
+            return NULL;
+        }
+
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(6), name_index);
+
+    } else {
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), name_index);
+    }
+
+    if (name_index == 0) {
+        pos = ngx_http_v2_write_name(pos, name->data, name->len, tmp);
+    }
+
+    return ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+}
+
+
+static ngx_uint_t
+ngx_http_v2_field_type(ngx_http_request_t *r, ngx_str_t *name)
+{
+    ngx_str_t               *never;
+    ngx_uint_t               i;
+    ngx_http_v2_srv_conf_t  *h2scf;
+
+    static ngx_str_t  sensitive[] = {
+        ngx_string("set-cookie"),
+        ngx_string("authorization"),
+        ngx_string("proxy-authorization"),
+        ngx_null_string
+    };
+
+    /* values of these headers are never indexed, see RFC 7541, 7.1.3 */
+
+    for (never = sensitive; never->len; never++) {
+        if (never->len == name->len
+            && ngx_strncmp(never->data, name->data, name->len) == 0)
+        {
+            return NGX_HTTP_V2_FIELD_NEVER_INDEXED;
+        }
+    }
+
+    h2scf = ngx_http_get_module_srv_conf(r, ngx_http_v2_module);
+
+    if (h2scf->hpack_never_index == NULL) {
+        return NGX_HTTP_V2_FIELD_INC_INDEXED;
+    }
+
+    never = h2scf->hpack_never_index->elts;
+
+    for (i = 0; i < h2scf->hpack_never_index->nelts; i++) {
+        if (never[i].len == name->len
+            && ngx_strncmp(never[i].data, name->data, name->len) == 0)
+        {
+            return NGX_HTTP_V2_FIELD_NEVER_INDEXED;
+        }
+    }
+
+    return NGX_HTTP_V2_FIELD_INC_INDEXED;
+}
+
+
 static ngx_http_v2_out_frame_t *
 ngx_http_v2_create_headers_frame(ngx_http_request_t *r, u_char *pos,
     u_char *end, ngx_uint_t fin)
@@ -34,6 +34,10 @@ static char *ngx_http_v2_preread_size(ngx_conf_t *cf, void *post, void *data);
 static char *ngx_http_v2_streams_index_mask(ngx_conf_t *cf, void *post,
     void *data);
 static char *ngx_http_v2_chunk_size(ngx_conf_t *cf, void *post, void *data);
+static char *ngx_http_v2_hpack_table_size(ngx_conf_t *cf, void *post,
+    void *data);
+static char *ngx_http_v2_hpack_never_index(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_http_v2_spdy_deprecated(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
@@ -48,6 +52,8 @@ static ngx_conf_post_t  ngx_http_v2_streams_index_mask_post =
     { ngx_http_v2_streams_index_mask };
 static ngx_conf_post_t  ngx_http_v2_chunk_size_post =
     { ngx_http_v2_chunk_size };
+static ngx_conf_post_t  ngx_http_v2_hpack_table_size_post =
+    { ngx_http_v2_hpack_table_size };
 
 
 static ngx_command_t  ngx_http_v2_commands[] = {
@@ -122,6 +128,20 @@ static ngx_command_t  ngx_http_v2_commands[] = {
       offsetof(ngx_http_v2_srv_conf_t, idle_timeout),
       NULL },
 
+    { ngx_string("http2_hpack_table_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, hpack_table_size),
+      &ngx_http_v2_hpack_table_size_post },
+
+    { ngx_string("http2_hpack_never_index"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_1MORE,
+      ngx_http_v2_hpack_never_index,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("http2_chunk_size"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -341,6 +361,9 @@ ngx_http_v2_create_srv_conf(ngx_conf_t *cf)
     h2scf->recv_timeout = NGX_CONF_UNSET_MSEC;
     h2scf->idle_timeout = NGX_CONF_UNSET_MSEC;
 
+    h2scf->hpack_table_size = NGX_CONF_UNSET_SIZE;
+    h2scf->hpack_never_index = NGX_CONF_UNSET_PTR;
+
     return h2scf;
 }
 
@@ -372,6 +395,11 @@ ngx_http_v2_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_msec_value(conf->idle_timeout,
                               prev->idle_timeout, 180000);
 
+    ngx_conf_merge_size_value(conf->hpack_table_size, prev->hpack_table_size,
+                              0);
+    ngx_conf_merge_ptr_value(conf->hpack_never_index,
+                             prev->hpack_never_index, NULL);
+
     return NGX_CONF_OK;
 }
 
@@ -498,6 +526,62 @@ ngx_http_v2_chunk_size(ngx_conf_t *cf, void *post, void *data)
 }
 
 
+static char *
+ngx_http_v2_hpack_table_size(ngx_conf_t *cf, void *post, void *data)
+{
+    size_t *sp = data;
+
+    if (*sp > NGX_HTTP_V2_MAX_TABLE_SIZE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the maximum hpack table size is %uz",
+                           (size_t) NGX_HTTP_V2_MAX_TABLE_SIZE);
+
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_v2_hpack_never_index(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_v2_srv_conf_t *h2scf = conf;
+
+    ngx_str_t   *value, *name;
+    ngx_uint_t   i;
+
+    if (h2scf->hpack_never_index != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    h2scf->hpack_never_index = ngx_array_create(cf->pool, cf->args->nelts - 1,
+                                                sizeof(ngx_str_t));
+    if (h2scf->hpack_never_index == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+        name = ngx_array_push(h2scf->hpack_never_index);
+        if (name == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        name->len = value[i].len;
+        name->data = ngx_pnalloc(cf->pool, name->len);
+        if (name->data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_strlow(name->data, value[i].data, name->len);
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_http_v2_spdy_deprecated(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
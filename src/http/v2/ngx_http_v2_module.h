@@ -30,6 +30,8 @@ typedef struct {
     ngx_uint_t                      streams_index_mask;
     ngx_msec_t                      recv_timeout;
     ngx_msec_t                      idle_timeout;
+    size_t                          hpack_table_size;
+    ngx_array_t                    *hpack_never_index;
 } ngx_http_v2_srv_conf_t;
 
 
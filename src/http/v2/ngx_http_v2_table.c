@@ -8,13 +8,20 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_http_v2_module.h>
 
 
-#define NGX_HTTP_V2_TABLE_SIZE  4096
-
-
+static ngx_int_t ngx_http_v2_table_alloc(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_hpack_t *hpack, size_t size, size_t capacity);
+static ngx_int_t ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_hpack_t *hpack, ngx_http_v2_header_t *header);
 static ngx_int_t ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
-    size_t size);
+    ngx_http_v2_hpack_t *hpack, size_t size);
+static void ngx_http_v2_table_resize(ngx_http_v2_hpack_t *hpack, size_t size);
+static ngx_int_t ngx_http_v2_table_cmp(ngx_http_v2_hpack_t *hpack,
+    ngx_str_t *entry, u_char *data);
+static ngx_uint_t ngx_http_v2_table_rebase(ngx_http_v2_hpack_t *hpack,
+    ngx_uint_t n);
 
 
 static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
@@ -81,6 +88,14 @@ static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
     { ngx_string("www-authenticate"), ngx_string("") },
 };
 
+/*
+ * the encoder table is indexed by a hash of the field name: each bucket
+ * and each entry reference the preceding entry with the same hash by its
+ * insertion number plus one, so a chain ends at an evicted entry
+ */
+
+#define NGX_HTTP_V2_TABLE_BUCKETS  64
+
 #define NGX_HTTP_V2_STATIC_TABLE_ENTRIES                                      \
     (sizeof(ngx_http_v2_static_table)                                         \
      / sizeof(ngx_http_v2_header_t))
@@ -125,7 +140,7 @@ ngx_http_v2_get_indexed_header(ngx_http_v2_connection_t *h2c, ngx_uint_t index,
         h2c->state.header.name.len = entry->name.len;
         h2c->state.header.name.data = p;
 
-        rest = h2c->hpack.storage + NGX_HTTP_V2_TABLE_SIZE - entry->name.data;
+        rest = h2c->hpack.end - entry->name.data;
 
         if (entry->name.len > rest) {
             p = ngx_cpymem(p, entry->name.data, rest);
@@ -149,7 +164,7 @@ ngx_http_v2_get_indexed_header(ngx_http_v2_connection_t *h2c, ngx_uint_t index,
         h2c->state.header.value.len = entry->value.len;
         h2c->state.header.value.data = p;
 
-        rest = h2c->hpack.storage + NGX_HTTP_V2_TABLE_SIZE - entry->value.data;
+        rest = h2c->hpack.end - entry->value.data;
 
         if (entry->value.len > rest) {
             p = ngx_cpymem(p, entry->value.data, rest);
@@ -175,118 +190,180 @@ ngx_int_t
 ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header)
 {
-    size_t                 avail;
-    ngx_uint_t             index;
-    ngx_http_v2_header_t  *entry, **entries;
-
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
                    "http2 add header to hpack table: \"%V: %V\"",
                    &header->name, &header->value);
 
     if (h2c->hpack.entries == NULL) {
-        h2c->hpack.allocated = 64;
-        h2c->hpack.size = NGX_HTTP_V2_TABLE_SIZE;
-        h2c->hpack.free = NGX_HTTP_V2_TABLE_SIZE;
-
-        h2c->hpack.entries = ngx_palloc(h2c->connection->pool,
-                                        sizeof(ngx_http_v2_header_t *)
-                                        * h2c->hpack.allocated);
-        if (h2c->hpack.entries == NULL) {
+        if (ngx_http_v2_table_alloc(h2c, &h2c->hpack, NGX_HTTP_V2_TABLE_SIZE,
+                                    NGX_HTTP_V2_TABLE_SIZE)
+            != NGX_OK)
+        {
             return NGX_ERROR;
         }
+    }
 
-        h2c->hpack.storage = ngx_palloc(h2c->connection->pool,
-                                        h2c->hpack.free);
-        if (h2c->hpack.storage == NULL) {
-            return NGX_ERROR;
-        }
+    return ngx_http_v2_table_insert(h2c, &h2c->hpack, header);
+}
 
-        h2c->hpack.pos = h2c->hpack.storage;
+
+static ngx_int_t
+ngx_http_v2_table_alloc(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_hpack_t *hpack, size_t size, size_t capacity)
+{
+    hpack->allocated = 64;
+    hpack->size = size;
+    hpack->free = size;
+
+    hpack->entries = ngx_palloc(h2c->connection->pool,
+                                sizeof(ngx_http_v2_header_t *)
+                                * hpack->allocated);
+    if (hpack->entries == NULL) {
+        return NGX_ERROR;
     }
 
-    if (ngx_http_v2_table_account(h2c, header->name.len + header->value.len)
+    hpack->storage = ngx_palloc(h2c->connection->pool, capacity);
+    if (hpack->storage == NULL) {
+        return NGX_ERROR;
+    }
+
+    hpack->pos = hpack->storage;
+    hpack->end = hpack->storage + capacity;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_hpack_t *hpack, ngx_http_v2_header_t *header)
+{
+    size_t                 avail;
+    ngx_uint_t             i, index, key, *next;
+    ngx_http_v2_header_t  *entry, **entries;
+
+    if (ngx_http_v2_table_account(h2c, hpack,
+                                  header->name.len + header->value.len)
         != NGX_OK)
     {
         return NGX_OK;
     }
 
-    if (h2c->hpack.reused == h2c->hpack.deleted) {
+    if (hpack->reused == hpack->deleted) {
         entry = ngx_palloc(h2c->connection->pool, sizeof(ngx_http_v2_header_t));
         if (entry == NULL) {
             return NGX_ERROR;
         }
 
     } else {
-        entry = h2c->hpack.entries[h2c->hpack.reused++ % h2c->hpack.allocated];
+        entry = hpack->entries[hpack->reused++ % hpack->allocated];
     }
 
-    avail = h2c->hpack.storage + NGX_HTTP_V2_TABLE_SIZE - h2c->hpack.pos;
+    avail = hpack->end - hpack->pos;
 
     entry->name.len = header->name.len;
-    entry->name.data = h2c->hpack.pos;
+    entry->name.data = hpack->pos;
 
     if (avail >= header->name.len) {
-        h2c->hpack.pos = ngx_cpymem(h2c->hpack.pos, header->name.data,
-                                    header->name.len);
+        hpack->pos = ngx_cpymem(hpack->pos, header->name.data,
+                                header->name.len);
     } else {
-        ngx_memcpy(h2c->hpack.pos, header->name.data, avail);
-        h2c->hpack.pos = ngx_cpymem(h2c->hpack.storage,
-                                    header->name.data + avail,
-                                    header->name.len - avail);
-        avail = NGX_HTTP_V2_TABLE_SIZE;
+        ngx_memcpy(hpack->pos, header->name.data, avail);
+        hpack->pos = ngx_cpymem(hpack->storage, header->name.data + avail,
+                                header->name.len - avail);
+        avail = hpack->end - hpack->storage;
     }
 
     avail -= header->name.len;
 
     entry->value.len = header->value.len;
-    entry->value.data = h2c->hpack.pos;
+    entry->value.data = hpack->pos;
 
     if (avail >= header->value.len) {
-        h2c->hpack.pos = ngx_cpymem(h2c->hpack.pos, header->value.data,
-                                    header->value.len);
+        hpack->pos = ngx_cpymem(hpack->pos, header->value.data,
+                                header->value.len);
     } else {
-        ngx_memcpy(h2c->hpack.pos, header->value.data, avail);
-        h2c->hpack.pos = ngx_cpymem(h2c->hpack.storage,
-                                    header->value.data + avail,
-                                    header->value.len - avail);
+        ngx_memcpy(hpack->pos, header->value.data, avail);
+        hpack->pos = ngx_cpymem(hpack->storage, header->value.data + avail,
+                                header->value.len - avail);
     }
 
-    if (h2c->hpack.allocated == h2c->hpack.added - h2c->hpack.deleted) {
+    if (hpack->allocated == hpack->added - hpack->deleted) {
 
         entries = ngx_palloc(h2c->connection->pool,
                              sizeof(ngx_http_v2_header_t *)
-                             * (h2c->hpack.allocated + 64));
+                             * (hpack->allocated + 64));
         if (entries == NULL) {
             return NGX_ERROR;
         }
 
-        index = h2c->hpack.deleted % h2c->hpack.allocated;
+        index = hpack->deleted % hpack->allocated;
 
-        ngx_memcpy(entries, &h2c->hpack.entries[index],
-                   (h2c->hpack.allocated - index)
+        ngx_memcpy(entries, &hpack->entries[index],
+                   (hpack->allocated - index)
                    * sizeof(ngx_http_v2_header_t *));
 
-        ngx_memcpy(&entries[h2c->hpack.allocated - index], h2c->hpack.entries,
+        ngx_memcpy(&entries[hpack->allocated - index], hpack->entries,
                    index * sizeof(ngx_http_v2_header_t *));
 
-        (void) ngx_pfree(h2c->connection->pool, h2c->hpack.entries);
+        (void) ngx_pfree(h2c->connection->pool, hpack->entries);
+
+        hpack->entries = entries;
+
+        if (hpack->next) {
+            next = ngx_palloc(h2c->connection->pool,
+                              sizeof(ngx_uint_t) * (hpack->allocated + 64));
+            if (next == NULL) {
+                return NGX_ERROR;
+            }
+
+            for (i = 0; i < hpack->allocated; i++) {
+                next[i] = ngx_http_v2_table_rebase(hpack,
+                              hpack->next[(index + i) % hpack->allocated]);
+            }
 
-        h2c->hpack.entries = entries;
+            for (i = 0; i < NGX_HTTP_V2_TABLE_BUCKETS; i++) {
+                hpack->buckets[i] = ngx_http_v2_table_rebase(hpack,
+                                                             hpack->buckets[i]);
+            }
 
-        h2c->hpack.added = h2c->hpack.allocated;
-        h2c->hpack.deleted = 0;
-        h2c->hpack.reused = 0;
-        h2c->hpack.allocated += 64;
+            (void) ngx_pfree(h2c->connection->pool, hpack->next);
+
+            hpack->next = next;
+        }
+
+        hpack->added = hpack->allocated;
+        hpack->deleted = 0;
+        hpack->reused = 0;
+        hpack->allocated += 64;
     }
 
-    h2c->hpack.entries[h2c->hpack.added++ % h2c->hpack.allocated] = entry;
+    if (hpack->buckets) {
+        key = ngx_hash_key(header->name.data, header->name.len)
+              % NGX_HTTP_V2_TABLE_BUCKETS;
+
+        hpack->next[hpack->added % hpack->allocated] = hpack->buckets[key];
+        hpack->buckets[key] = hpack->added + 1;
+    }
+
+    hpack->entries[hpack->added++ % hpack->allocated] = entry;
 
     return NGX_OK;
 }
 
 
+static ngx_uint_t
+ngx_http_v2_table_rebase(ngx_http_v2_hpack_t *hpack, ngx_uint_t n)
+{
+    /* entries are renumbered from the oldest one */
+
+    return (n > hpack->deleted) ? n - hpack->deleted : 0;
+}
+
+
 static ngx_int_t
-ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c, size_t size)
+ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_hpack_t *hpack, size_t size)
 {
     ngx_http_v2_header_t  *entry;
 
@@ -294,25 +371,25 @@ ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c, size_t size)
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
                    "http2 hpack table account: %uz free:%uz",
-                   size, h2c->hpack.free);
+                   size, hpack->free);
 
-    if (size <= h2c->hpack.free) {
-        h2c->hpack.free -= size;
+    if (size <= hpack->free) {
+        hpack->free -= size;
         return NGX_OK;
     }
 
-    if (size > h2c->hpack.size) {
-        h2c->hpack.deleted = h2c->hpack.added;
-        h2c->hpack.free = h2c->hpack.size;
+    if (size > hpack->size) {
+        hpack->deleted = hpack->added;
+        hpack->free = hpack->size;
         return NGX_DECLINED;
     }
 
     do {
-        entry = h2c->hpack.entries[h2c->hpack.deleted++ % h2c->hpack.allocated];
-        h2c->hpack.free += 32 + entry->name.len + entry->value.len;
-    } while (size > h2c->hpack.free);
+        entry = hpack->entries[hpack->deleted++ % hpack->allocated];
+        hpack->free += 32 + entry->name.len + entry->value.len;
+    } while (size > hpack->free);
 
-    h2c->hpack.free -= size;
+    hpack->free -= size;
 
     return NGX_OK;
 }
@@ -321,9 +398,6 @@ ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c, size_t size)
 ngx_int_t
 ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
 {
-    ssize_t                needed;
-    ngx_http_v2_header_t  *entry;
-
     if (size > NGX_HTTP_V2_TABLE_SIZE) {
         ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
                       "client sent invalid table size update: %uz", size);
@@ -335,15 +409,211 @@ ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
                    "http2 new hpack table size: %uz was:%uz",
                    size, h2c->hpack.size);
 
-    needed = h2c->hpack.size - size;
+    ngx_http_v2_table_resize(&h2c->hpack, size);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_table_resize(ngx_http_v2_hpack_t *hpack, size_t size)
+{
+    ssize_t                needed;
+    ngx_http_v2_header_t  *entry;
+
+    needed = hpack->size - size;
+
+    while (needed > (ssize_t) hpack->free) {
+        entry = hpack->entries[hpack->deleted++ % hpack->allocated];
+        hpack->free += 32 + entry->name.len + entry->value.len;
+    }
+
+    hpack->size = size;
+    hpack->free -= needed;
+}
+
+
+
+/*
+ * The encoder table mirrors the client's decoder table: each field emitted
+ * with incremental indexing must be added to it in the same order as header
+ * blocks are sent, that is, at the time a HEADERS frame is created.
+ */
+
+ngx_int_t
+ngx_http_v2_table_encoder(ngx_http_v2_connection_t *h2c)
+{
+    size_t                   size;
+    ngx_http_v2_srv_conf_t  *h2scf;
 
-    while (needed > (ssize_t) h2c->hpack.free) {
-        entry = h2c->hpack.entries[h2c->hpack.deleted++ % h2c->hpack.allocated];
-        h2c->hpack.free += 32 + entry->name.len + entry->value.len;
+    if (h2c->hpack_enc.entries) {
+        return NGX_OK;
+    }
+
+    h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
+                                         ngx_http_v2_module);
+
+    if (h2scf->hpack_table_size == 0) {
+        return NGX_DECLINED;
     }
 
-    h2c->hpack.size = size;
-    h2c->hpack.free -= needed;
+    size = ngx_min(h2scf->hpack_table_size, h2c->table_size);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 hpack encoder table size: %uz", size);
+
+    if (ngx_http_v2_table_alloc(h2c, &h2c->hpack_enc, size,
+                                h2scf->hpack_table_size)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    h2c->hpack_enc.buckets = ngx_pcalloc(h2c->connection->pool,
+                                         sizeof(ngx_uint_t)
+                                         * NGX_HTTP_V2_TABLE_BUCKETS);
+    if (h2c->hpack_enc.buckets == NULL) {
+        return NGX_ERROR;
+    }
+
+    h2c->hpack_enc.next = ngx_palloc(h2c->connection->pool,
+                                     sizeof(ngx_uint_t)
+                                     * h2c->hpack_enc.allocated);
+    if (h2c->hpack_enc.next == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (size != NGX_HTTP_V2_TABLE_SIZE) {
+        h2c->table_update = 1;
+    }
 
     return NGX_OK;
 }
+
+
+void
+ngx_http_v2_table_update_size(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    h2c->table_size = size;
+
+    if (h2c->hpack_enc.entries == NULL) {
+        return;
+    }
+
+    /*
+     * the encoder table is never grown once allocated, so there is
+     * only one size to signal even after several SETTINGS frames
+     */
+
+    if (size >= h2c->hpack_enc.size) {
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 new hpack encoder table size: %uz was:%uz",
+                   size, h2c->hpack_enc.size);
+
+    ngx_http_v2_table_resize(&h2c->hpack_enc, size);
+
+    h2c->table_update = 1;
+}
+
+
+ngx_uint_t
+ngx_http_v2_table_lookup(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_header_t *header, ngx_uint_t *name_index)
+{
+    ngx_uint_t             i, n;
+    ngx_http_v2_hpack_t   *hpack;
+    ngx_http_v2_header_t  *entry;
+
+    *name_index = 0;
+
+    for (i = 0; i < NGX_HTTP_V2_STATIC_TABLE_ENTRIES; i++) {
+        entry = &ngx_http_v2_static_table[i];
+
+        if (entry->name.len != header->name.len
+            || ngx_strncmp(entry->name.data, header->name.data,
+                           header->name.len)
+               != 0)
+        {
+            continue;
+        }
+
+        if (entry->value.len == header->value.len
+            && ngx_strncmp(entry->value.data, header->value.data,
+                           header->value.len)
+               == 0)
+        {
+            return i + 1;
+        }
+
+        if (*name_index == 0) {
+            *name_index = i + 1;
+        }
+    }
+
+    hpack = &h2c->hpack_enc;
+
+    n = hpack->buckets[ngx_hash_key(header->name.data, header->name.len)
+                       % NGX_HTTP_V2_TABLE_BUCKETS];
+
+    for ( /* void */ ; n > hpack->deleted;
+         n = hpack->next[(n - 1) % hpack->allocated])
+    {
+        entry = hpack->entries[(n - 1) % hpack->allocated];
+        i = hpack->added - n;
+
+        if (entry->name.len != header->name.len
+            || ngx_http_v2_table_cmp(hpack, &entry->name, header->name.data)
+               != 0)
+        {
+            continue;
+        }
+
+        if (entry->value.len == header->value.len
+            && ngx_http_v2_table_cmp(hpack, &entry->value, header->value.data)
+               == 0)
+        {
+            return NGX_HTTP_V2_STATIC_TABLE_ENTRIES + i + 1;
+        }
+
+        if (*name_index == 0) {
+            *name_index = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + i + 1;
+        }
+    }
+
+    return 0;
+}
+
+
+ngx_int_t
+ngx_http_v2_table_add(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_header_t *header)
+{
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 add header to hpack encoder table: \"%V: %V\"",
+                   &header->name, &header->value);
+
+    return ngx_http_v2_table_insert(h2c, &h2c->hpack_enc, header);
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_cmp(ngx_http_v2_hpack_t *hpack, ngx_str_t *entry,
+    u_char *data)
+{
+    size_t  rest;
+
+    rest = hpack->end - entry->data;
+
+    if (entry->len > rest) {
+        if (ngx_memcmp(entry->data, data, rest) != 0) {
+            return 1;
+        }
+
+        return ngx_memcmp(hpack->storage, data + rest, entry->len - rest);
+    }
+
+    return ngx_memcmp(entry->data, data, entry->len);
+}
@@ -0,0 +1,1316 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * the parser microbenchmarks, built and run by "make bench"
+ *
+ * each benchmark runs over its corpus, misc/bench/<name>.txt, and over
+ * a copy of the corpus with random bytes mutated, which exercises
+ * the error paths of the parsers; the results are reported in
+ * nanoseconds per operation and in input bytes per TSC cycle
+ *
+ * the escaping functions are also run over the corpora of inputs with
+ * nothing, a few, and mostly bytes to be escaped, misc/bench/escape_*.txt
+ *
+ * before the runs, the request line and the header parsers are checked
+ * to produce the same results with the CPU specific scanners and with
+ * the generic code, "-n", over each entry split in two reads at every byte
+ */
+
+
+#define NGX_BENCH_DURATION   200
+#define NGX_BENCH_MUTATIONS  4
+#define NGX_BENCH_SEED       0x2545f491
+
+
+typedef struct ngx_bench_s  ngx_bench_t;
+
+typedef struct {
+    ngx_str_t               data;
+    ngx_str_t               arg;
+} ngx_bench_input_t;
+
+typedef ngx_int_t (*ngx_bench_init_pt)(ngx_bench_t *bench);
+typedef uintptr_t (*ngx_bench_handler_pt)(ngx_bench_t *bench,
+    ngx_bench_input_t *in);
+typedef uint32_t (*ngx_bench_check_pt)(ngx_bench_t *bench,
+    ngx_bench_input_t *in, size_t split);
+
+struct ngx_bench_s {
+    char                   *name;
+    char                   *corpus;
+    ngx_bench_init_pt       init;
+    ngx_bench_handler_pt    handler;
+    ngx_bench_check_pt      check;
+    ngx_uint_t              type;
+
+    ngx_array_t             inputs;
+    u_char                 *buf;
+    void                   *data;
+};
+
+
+static ngx_int_t ngx_bench_get_options(int argc, char *const *argv);
+static ngx_int_t ngx_bench_prepare(ngx_bench_t *bench);
+static ngx_int_t ngx_bench_load(char *name, ngx_array_t *inputs);
+static size_t ngx_bench_unescape(u_char *dst, u_char *src, size_t len);
+static ngx_int_t ngx_bench_mutate(ngx_array_t *inputs, ngx_array_t *mutated);
+static uint32_t ngx_bench_random(void);
+static ngx_int_t ngx_bench_check(ngx_bench_t *bench, ngx_array_t *inputs,
+    char *class);
+static void ngx_bench_run(ngx_bench_t *bench, ngx_array_t *inputs,
+    char *class);
+static uint64_t ngx_bench_nsec(void);
+static uint64_t ngx_bench_cycles(void);
+static u_char *ngx_bench_pad(u_char *p, u_char *start, size_t width);
+
+static uintptr_t ngx_bench_request_line(ngx_bench_t *bench,
+    ngx_bench_input_t *in);
+static uint32_t ngx_bench_request_line_check(ngx_bench_t *bench,
+    ngx_bench_input_t *in, size_t split);
+static uintptr_t ngx_bench_header_line(ngx_bench_t *bench,
+    ngx_bench_input_t *in);
+static uint32_t ngx_bench_header_line_check(ngx_bench_t *bench,
+    ngx_bench_input_t *in, size_t split);
+static uintptr_t ngx_bench_complex_uri(ngx_bench_t *bench,
+    ngx_bench_input_t *in);
+#if (NGX_HTTP_V2)
+static ngx_int_t ngx_bench_huff_init(ngx_bench_t *bench);
+static uintptr_t ngx_bench_huff_decode(ngx_bench_t *bench,
+    ngx_bench_input_t *in);
+#endif
+static ngx_int_t ngx_bench_hash_init(ngx_bench_t *bench);
+static int ngx_libc_cdecl ngx_bench_cmp_dns_wildcards(const void *one,
+    const void *two);
+static uintptr_t ngx_bench_hash_find(ngx_bench_t *bench,
+    ngx_bench_input_t *in);
+static uintptr_t ngx_bench_escape_uri(ngx_bench_t *bench,
+    ngx_bench_input_t *in);
+static uintptr_t ngx_bench_escape_html(ngx_bench_t *bench,
+    ngx_bench_input_t *in);
+static uintptr_t ngx_bench_escape_json(ngx_bench_t *bench,
+    ngx_bench_input_t *in);
+static uintptr_t ngx_bench_unescape_uri(ngx_bench_t *bench,
+    ngx_bench_input_t *in);
+static uintptr_t ngx_bench_arg(ngx_bench_t *bench, ngx_bench_input_t *in);
+
+
+static ngx_bench_t  ngx_bench_list[] = {
+
+    { "request_line", "request_line",
+      NULL, ngx_bench_request_line, ngx_bench_request_line_check, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "header_line", "header_line",
+      NULL, ngx_bench_header_line, ngx_bench_header_line_check, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "complex_uri", "complex_uri",
+      NULL, ngx_bench_complex_uri, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+#if (NGX_HTTP_V2)
+    { "huff_decode", "huff_decode",
+      ngx_bench_huff_init, ngx_bench_huff_decode, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+#endif
+
+    { "hash_find", "hash_find",
+      ngx_bench_hash_init, ngx_bench_hash_find, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "escape_uri", "escape_uri",
+      NULL, ngx_bench_escape_uri, NULL, NGX_ESCAPE_URI,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "escape_args", "escape_uri",
+      NULL, ngx_bench_escape_uri, NULL, NGX_ESCAPE_ARGS,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "arg", "arg",
+      NULL, ngx_bench_arg, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "uri_clean", "escape_clean",
+      NULL, ngx_bench_escape_uri, NULL, NGX_ESCAPE_URI,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "uri_sparse", "escape_sparse",
+      NULL, ngx_bench_escape_uri, NULL, NGX_ESCAPE_URI,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "uri_dense", "escape_dense",
+      NULL, ngx_bench_escape_uri, NULL, NGX_ESCAPE_URI,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "html_clean", "escape_clean",
+      NULL, ngx_bench_escape_html, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "html_sparse", "escape_sparse",
+      NULL, ngx_bench_escape_html, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "html_dense", "escape_dense",
+      NULL, ngx_bench_escape_html, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "json_clean", "escape_clean",
+      NULL, ngx_bench_escape_json, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "json_sparse", "escape_sparse",
+      NULL, ngx_bench_escape_json, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "json_dense", "escape_dense",
+      NULL, ngx_bench_escape_json, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "unescape_clean", "escape_clean",
+      NULL, ngx_bench_unescape_uri, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "unescape_sparse", "escape_sparse",
+      NULL, ngx_bench_unescape_uri, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { "unescape_dense", "escape_dense",
+      NULL, ngx_bench_unescape_uri, NULL, 0,
+      { NULL, 0, 0, 0, NULL }, NULL, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, 0, { NULL, 0, 0, 0, NULL }, NULL, NULL }
+};
+
+
+static ngx_uint_t           ngx_bench_duration = NGX_BENCH_DURATION;
+static ngx_uint_t           ngx_bench_mutations = NGX_BENCH_MUTATIONS;
+static ngx_uint_t           ngx_bench_generic;
+static ngx_uint_t           ngx_bench_cpu_features;
+static ngx_str_t            ngx_bench_dir = ngx_string("misc/bench");
+static char *const         *ngx_bench_names;
+static uint32_t             ngx_bench_state = NGX_BENCH_SEED;
+static volatile uintptr_t   ngx_bench_sink;
+
+static ngx_pool_t          *ngx_bench_pool;
+static ngx_open_file_t      ngx_bench_log_file;
+static ngx_log_t            ngx_bench_log;
+static ngx_connection_t     ngx_bench_connection;
+static ngx_http_request_t   ngx_bench_request;
+
+
+/* nginx.o is not linked, these are not used by the benchmarks */
+
+ngx_module_t  ngx_core_module = {
+    NGX_MODULE_V1,
+    NULL,                                  /* module context */
+    NULL,                                  /* module directives */
+    NGX_CORE_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+char **
+ngx_set_environment(ngx_cycle_t *cycle, ngx_uint_t *last)
+{
+    return NULL;
+}
+
+
+ngx_pid_t
+ngx_exec_new_binary(ngx_cycle_t *cycle, char *const *argv)
+{
+    return NGX_INVALID_PID;
+}
+
+
+ngx_cpuset_t *
+ngx_get_cpu_affinity(ngx_uint_t n)
+{
+    return NULL;
+}
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    u_char       *p, line[NGX_MAX_ERROR_STR];
+    ngx_uint_t    n;
+    ngx_array_t   mutated;
+    ngx_bench_t  *bench;
+
+    if (ngx_strerror_init() != NGX_OK) {
+        return 1;
+    }
+
+    if (ngx_bench_get_options(argc, argv) != NGX_OK) {
+        return 1;
+    }
+
+    ngx_time_init();
+
+    ngx_pid = ngx_getpid();
+
+    ngx_bench_log_file.fd = ngx_stderr;
+    ngx_bench_log.file = &ngx_bench_log_file;
+    ngx_bench_log.log_level = NGX_LOG_NOTICE;
+
+    ngx_os_argv = (char **) argv;
+
+    if (ngx_os_init(&ngx_bench_log) != NGX_OK) {
+        return 1;
+    }
+
+    ngx_bench_cpu_features = ngx_cpu_features;
+
+    if (ngx_bench_generic) {
+        ngx_cpu_features = 0;
+    }
+
+    ngx_http_parse_init();
+
+    ngx_bench_pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &ngx_bench_log);
+    if (ngx_bench_pool == NULL) {
+        return 1;
+    }
+
+    ngx_bench_connection.log = &ngx_bench_log;
+    ngx_bench_request.connection = &ngx_bench_connection;
+
+    p = ngx_snprintf(line, NGX_MAX_ERROR_STR,
+                     NGINX_VER " parser benchmarks, cpu features:%s%s"
+                     NGX_LINEFEED NGX_LINEFEED,
+                     (ngx_cpu_features & NGX_CPU_SSE42) ? " sse4.2" : "",
+                     ngx_cpu_features ? "" : " none");
+
+    p = ngx_cpymem(p, "benchmark       input    entries        ops"
+                      "  ns/op  bytes/cycle" NGX_LINEFEED,
+                   sizeof("benchmark       input    entries        ops"
+                          "  ns/op  bytes/cycle" NGX_LINEFEED) - 1);
+
+    (void) ngx_write_fd(ngx_stdout, line, p - line);
+
+    for (bench = ngx_bench_list; bench->name; bench++) {
+
+        if (ngx_bench_names && *ngx_bench_names) {
+
+            for (n = 0; ngx_bench_names[n]; n++) {
+                if (ngx_strcmp(ngx_bench_names[n], bench->name) == 0) {
+                    break;
+                }
+            }
+
+            if (ngx_bench_names[n] == NULL) {
+                continue;
+            }
+        }
+
+        if (ngx_bench_prepare(bench) != NGX_OK) {
+            return 1;
+        }
+
+        if (ngx_bench_check(bench, &bench->inputs, "corpus") != NGX_OK) {
+            return 1;
+        }
+
+        ngx_bench_run(bench, &bench->inputs, "corpus");
+
+        if (ngx_bench_mutations == 0) {
+            continue;
+        }
+
+        if (ngx_bench_mutate(&bench->inputs, &mutated) != NGX_OK) {
+            return 1;
+        }
+
+        if (ngx_bench_check(bench, &mutated, "mutated") != NGX_OK) {
+            return 1;
+        }
+
+        ngx_bench_run(bench, &mutated, "mutated");
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_bench_get_options(int argc, char *const *argv)
+{
+    u_char     *p;
+    ngx_int_t   n;
+    ngx_int_t   i;
+
+    for (i = 1; i < argc; i++) {
+
+        p = (u_char *) argv[i];
+
+        if (*p++ != '-') {
+            ngx_bench_names = &argv[i];
+            return NGX_OK;
+        }
+
+        switch (*p) {
+
+        case 'n':
+            ngx_bench_generic = 1;
+            break;
+
+        case 'd':
+        case 't':
+        case 'm':
+
+            if (p[1] || argv[i + 1] == NULL) {
+                ngx_log_stderr(0, "option \"-%c\" requires parameter", *p);
+                return NGX_ERROR;
+            }
+
+            i++;
+
+            if (*p == 'd') {
+                ngx_bench_dir.data = (u_char *) argv[i];
+                ngx_bench_dir.len = ngx_strlen(argv[i]);
+                break;
+            }
+
+            n = ngx_atoi((u_char *) argv[i], ngx_strlen(argv[i]));
+
+            if (n == NGX_ERROR || (*p == 't' && n == 0)) {
+                ngx_log_stderr(0, "invalid option \"-%c\" value: \"%s\"",
+                               *p, argv[i]);
+                return NGX_ERROR;
+            }
+
+            if (*p == 't') {
+                ngx_bench_duration = n;
+
+            } else {
+                ngx_bench_mutations = n;
+            }
+
+            break;
+
+        default:
+            ngx_write_stderr("usage: ngx_bench [-n] [-d corpus] [-t msec] "
+                             "[-m mutations] [benchmark ...]" NGX_LINEFEED
+                             NGX_LINEFEED
+                             "options:" NGX_LINEFEED
+                             "  -n            : use the generic code only"
+                                               NGX_LINEFEED
+                             "  -d corpus     : set the corpus directory "
+                                   "(default: misc/bench)" NGX_LINEFEED
+                             "  -t msec       : set the duration of each run "
+                                   "(default: 200)" NGX_LINEFEED
+                             "  -m mutations  : set the mutations per entry, "
+                                   "0 disables (default: 4)" NGX_LINEFEED);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_bench_prepare(ngx_bench_t *bench)
+{
+    size_t              size;
+    ngx_uint_t          i;
+    ngx_bench_input_t  *in;
+
+    if (ngx_bench_load(bench->corpus, &bench->inputs) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (bench->init && bench->init(bench) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    size = 0;
+    in = bench->inputs.elts;
+
+    for (i = 0; i < bench->inputs.nelts; i++) {
+        size = ngx_max(size, in[i].data.len);
+    }
+
+    /* enough for the escaped and the huffman decoded data */
+
+    bench->buf = ngx_pnalloc(ngx_bench_pool, size * 6 + 16);
+    if (bench->buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_bench_load(char *name, ngx_array_t *inputs)
+{
+    u_char             *p, *last, *start, *tab, *buf, *file;
+    size_t              size;
+    ssize_t             n;
+    ngx_fd_t            fd;
+    ngx_file_info_t     fi;
+    ngx_bench_input_t  *in;
+
+    file = ngx_pnalloc(ngx_bench_pool,
+                       ngx_bench_dir.len + ngx_strlen(name) + sizeof("/.txt"));
+    if (file == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(file, "%V/%s.txt%Z", &ngx_bench_dir, name);
+
+    fd = ngx_open_file(file, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_bench_log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", file);
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_bench_log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file);
+        (void) ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    buf = ngx_pnalloc(ngx_bench_pool, size);
+    if (buf == NULL) {
+        (void) ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    n = ngx_read_fd(fd, buf, size);
+
+    if (n == -1 || (size_t) n != size) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_bench_log, ngx_errno,
+                      ngx_read_fd_n " \"%s\" failed", file);
+        (void) ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    (void) ngx_close_file(fd);
+
+    if (ngx_array_init(inputs, ngx_bench_pool, 64, sizeof(ngx_bench_input_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    /*
+     * one entry per line, the C escapes "\r", "\n", "\t", "\0", "\\",
+     * and "\xHH" are decoded, an optional argument follows a tab
+     */
+
+    last = buf + size;
+
+    for (p = buf; p < last; p = start + 1) {
+
+        start = ngx_strlchr(p, last, LF);
+        if (start == NULL) {
+            start = last;
+        }
+
+        if (start == p || *p == '#') {
+            continue;
+        }
+
+        in = ngx_array_push(inputs);
+        if (in == NULL) {
+            return NGX_ERROR;
+        }
+
+        tab = ngx_strlchr(p, start, '\t');
+
+        if (tab) {
+            in->arg.len = start - tab - 1;
+            in->arg.data = ngx_pnalloc(ngx_bench_pool, in->arg.len + 1);
+            if (in->arg.data == NULL) {
+                return NGX_ERROR;
+            }
+
+            in->arg.len = ngx_bench_unescape(in->arg.data, tab + 1,
+                                             in->arg.len);
+
+        } else {
+            ngx_str_null(&in->arg);
+            tab = start;
+        }
+
+        /* the parsers may look at one byte after the data */
+
+        in->data.data = ngx_pnalloc(ngx_bench_pool, tab - p + 1);
+        if (in->data.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        in->data.len = ngx_bench_unescape(in->data.data, p, tab - p);
+        in->data.data[in->data.len] = LF;
+    }
+
+    if (inputs->nelts == 0) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_bench_log, 0,
+                      "no entries in \"%s\"", file);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static size_t
+ngx_bench_unescape(u_char *dst, u_char *src, size_t len)
+{
+    u_char  *d, *last;
+
+    d = dst;
+    last = src + len;
+
+    while (src < last) {
+
+        if (*src != '\\' || last - src < 2) {
+            *d++ = *src++;
+            continue;
+        }
+
+        src++;
+
+        switch (*src) {
+        case 'r':
+            *d++ = CR;
+            break;
+        case 'n':
+            *d++ = LF;
+            break;
+        case 't':
+            *d++ = '\t';
+            break;
+        case '0':
+            *d++ = '\0';
+            break;
+        case 'x':
+            if (last - src >= 3
+                && ngx_hextoi(src + 1, 2) != NGX_ERROR)
+            {
+                *d++ = (u_char) ngx_hextoi(src + 1, 2);
+                src += 2;
+                break;
+            }
+
+            /* fall through */
+
+        default:
+            *d++ = *src;
+            break;
+        }
+
+        src++;
+    }
+
+    return d - dst;
+}
+
+
+static ngx_int_t
+ngx_bench_mutate(ngx_array_t *inputs, ngx_array_t *mutated)
+{
+    size_t              pos;
+    ngx_uint_t          i, n;
+    ngx_bench_input_t  *in, *mi;
+
+    static u_char  special[] = " \t\r\n%/.?#&=:;*\\";
+
+    if (ngx_array_init(mutated, ngx_bench_pool, inputs->nelts,
+                       sizeof(ngx_bench_input_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    in = inputs->elts;
+
+    for (i = 0; i < inputs->nelts; i++) {
+
+        mi = ngx_array_push(mutated);
+        if (mi == NULL) {
+            return NGX_ERROR;
+        }
+
+        mi->arg = in[i].arg;
+        mi->data.len = in[i].data.len;
+
+        mi->data.data = ngx_pnalloc(ngx_bench_pool, in[i].data.len + 1);
+        if (mi->data.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(mi->data.data, in[i].data.data, in[i].data.len + 1);
+
+        if (mi->data.len == 0) {
+            continue;
+        }
+
+        for (n = 0; n < ngx_bench_mutations; n++) {
+
+            pos = ngx_bench_random() % mi->data.len;
+
+            switch (ngx_bench_random() % 4) {
+
+            case 0:
+                mi->data.data[pos] = special[ngx_bench_random()
+                                             % (sizeof(special) - 1)];
+                break;
+
+            case 1:
+                mi->data.data[pos] = (u_char) ngx_bench_random();
+                break;
+
+            case 2:
+                mi->data.data[pos] = '\0';
+                break;
+
+            default:
+                mi->data.data[pos] =
+                              mi->data.data[ngx_bench_random() % mi->data.len];
+                break;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static uint32_t
+ngx_bench_random(void)
+{
+    /* xorshift32, the mutated inputs are the same from run to run */
+
+    ngx_bench_state ^= ngx_bench_state << 13;
+    ngx_bench_state ^= ngx_bench_state >> 17;
+    ngx_bench_state ^= ngx_bench_state << 5;
+
+    return ngx_bench_state;
+}
+
+
+static ngx_int_t
+ngx_bench_check(ngx_bench_t *bench, ngx_array_t *inputs, char *class)
+{
+    size_t              split;
+    uint32_t            generic, specific;
+    ngx_int_t           rc;
+    ngx_uint_t          i, features;
+    ngx_bench_input_t  *in;
+
+    if (bench->check == NULL || ngx_bench_cpu_features == 0) {
+        return NGX_OK;
+    }
+
+    features = ngx_cpu_features;
+    in = inputs->elts;
+    rc = NGX_OK;
+
+    for (i = 0; i < inputs->nelts; i++) {
+
+        for (split = 1; split <= in[i].data.len; split++) {
+
+            ngx_cpu_features = ngx_bench_cpu_features;
+            ngx_http_parse_init();
+
+            specific = bench->check(bench, &in[i], split);
+
+            ngx_cpu_features = 0;
+            ngx_http_parse_init();
+
+            generic = bench->check(bench, &in[i], split);
+
+            if (specific != generic) {
+                ngx_log_error(NGX_LOG_EMERG, &ngx_bench_log, 0,
+                              "%s: %s entry %ui split at %uz is parsed "
+                              "differently by the CPU specific code",
+                              bench->name, class, i + 1, split);
+                rc = NGX_ERROR;
+                goto done;
+            }
+        }
+    }
+
+done:
+
+    ngx_cpu_features = features;
+    ngx_http_parse_init();
+
+    return rc;
+}
+
+
+static void
+ngx_bench_run(ngx_bench_t *bench, ngx_array_t *inputs, char *class)
+{
+    u_char             *p, line[NGX_MAX_ERROR_STR];
+    uint64_t            start, elapsed, cycles, ops, bytes, size;
+    ngx_uint_t          i;
+    ngx_bench_input_t  *in;
+
+    in = inputs->elts;
+    size = 0;
+
+    /* warm up the caches and the branch predictors */
+
+    for (i = 0; i < inputs->nelts; i++) {
+        ngx_bench_sink += bench->handler(bench, &in[i]);
+        size += in[i].data.len;
+    }
+
+    ops = 0;
+    bytes = 0;
+
+    start = ngx_bench_nsec();
+    cycles = ngx_bench_cycles();
+
+    do {
+        for (i = 0; i < inputs->nelts; i++) {
+            ngx_bench_sink += bench->handler(bench, &in[i]);
+        }
+
+        ops += inputs->nelts;
+        bytes += size;
+
+        elapsed = ngx_bench_nsec() - start;
+
+    } while (elapsed < (uint64_t) ngx_bench_duration * 1000000);
+
+    cycles = ngx_bench_cycles() - cycles;
+
+    p = ngx_cpymem(line, bench->name, ngx_strlen(bench->name));
+    p = ngx_bench_pad(p, line, 16);
+    p = ngx_cpymem(p, class, ngx_strlen(class));
+    p = ngx_bench_pad(p, line, 24);
+
+    p = ngx_snprintf(p, line + NGX_MAX_ERROR_STR - p, "%7ui %10uL %6.1f",
+                     inputs->nelts, ops, (double) elapsed / ops);
+
+    if (cycles) {
+        p = ngx_snprintf(p, line + NGX_MAX_ERROR_STR - p,
+                         " %9.3f" NGX_LINEFEED, (double) bytes / cycles);
+
+    } else {
+        p = ngx_snprintf(p, line + NGX_MAX_ERROR_STR - p,
+                         "         -" NGX_LINEFEED);
+    }
+
+    (void) ngx_write_fd(ngx_stdout, line, p - line);
+}
+
+
+static uint64_t
+ngx_bench_nsec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000000 + (uint64_t) tv.tv_usec * 1000;
+}
+
+
+static uint64_t
+ngx_bench_cycles(void)
+{
+#if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
+
+    uint32_t  lo, hi;
+
+    __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+
+    return ((uint64_t) hi << 32) | lo;
+
+#else
+
+    return 0;
+
+#endif
+}
+
+
+static u_char *
+ngx_bench_pad(u_char *p, u_char *start, size_t width)
+{
+    while ((size_t) (p - start) < width) {
+        *p++ = ' ';
+    }
+
+    return p;
+}
+
+
+static uintptr_t
+ngx_bench_request_line(ngx_bench_t *bench, ngx_bench_input_t *in)
+{
+    ngx_buf_t            b;
+    ngx_http_request_t  *r;
+
+    r = &ngx_bench_request;
+    r->state = 0;
+
+    b.pos = in->data.data;
+    b.last = in->data.data + in->data.len;
+
+    return ngx_http_parse_request_line(r, &b);
+}
+
+
+/* the offset of a parsed position, or 0 if it is not set */
+
+#define ngx_bench_offset(p, start)                                            \
+    ((p) ? (uintptr_t) ((p) - (start)) + 1 : 0)
+
+
+static uint32_t
+ngx_bench_request_line_check(ngx_bench_t *bench, ngx_bench_input_t *in,
+    size_t split)
+{
+    u_char              *start;
+    uint32_t             crc;
+    uintptr_t            v[20];
+    ngx_int_t            rc;
+    ngx_buf_t            b;
+    ngx_http_request_t  *r;
+
+    r = &ngx_bench_request;
+
+    ngx_memzero(r, sizeof(ngx_http_request_t));
+    r->connection = &ngx_bench_connection;
+
+    start = in->data.data;
+
+    b.pos = start;
+    b.last = start + split;
+
+    rc = ngx_http_parse_request_line(r, &b);
+
+    if (rc == NGX_AGAIN && split != in->data.len) {
+        b.last = start + in->data.len;
+        rc = ngx_http_parse_request_line(r, &b);
+    }
+
+    v[0] = rc;
+    v[1] = b.pos - start;
+    v[2] = ngx_bench_offset(r->request_start, start);
+    v[3] = ngx_bench_offset(r->method_end, start);
+    v[4] = ngx_bench_offset(r->schema_start, start);
+    v[5] = ngx_bench_offset(r->schema_end, start);
+    v[6] = ngx_bench_offset(r->host_start, start);
+    v[7] = ngx_bench_offset(r->host_end, start);
+    v[8] = ngx_bench_offset(r->port_end, start);
+    v[9] = ngx_bench_offset(r->uri_start, start);
+    v[10] = ngx_bench_offset(r->uri_end, start);
+    v[11] = ngx_bench_offset(r->uri_ext, start);
+    v[12] = ngx_bench_offset(r->args_start, start);
+    v[13] = ngx_bench_offset(r->request_end, start);
+    v[14] = r->method;
+    v[15] = r->http_version;
+    v[16] = r->complex_uri;
+    v[17] = r->quoted_uri;
+    v[18] = r->plus_in_uri;
+    v[19] = r->space_in_uri;
+
+    ngx_crc32_init(crc);
+    ngx_crc32_update(&crc, (u_char *) v, sizeof(v));
+    ngx_crc32_final(crc);
+
+    return crc;
+}
+
+
+static uintptr_t
+ngx_bench_header_line(ngx_bench_t *bench, ngx_bench_input_t *in)
+{
+    ngx_int_t            rc;
+    ngx_buf_t            b;
+    ngx_http_request_t  *r;
+
+    r = &ngx_bench_request;
+    r->state = 0;
+
+    b.pos = in->data.data;
+    b.last = in->data.data + in->data.len;
+
+    do {
+        rc = ngx_http_parse_header_line(r, &b, 1);
+    } while (rc == NGX_OK);
+
+    return rc;
+}
+
+
+static uint32_t
+ngx_bench_header_line_check(ngx_bench_t *bench, ngx_bench_input_t *in,
+    size_t split)
+{
+    u_char              *start;
+    uint32_t             crc;
+    uintptr_t            v[8];
+    ngx_int_t            rc;
+    ngx_buf_t            b;
+    ngx_http_request_t  *r;
+
+    r = &ngx_bench_request;
+
+    ngx_memzero(r, sizeof(ngx_http_request_t));
+    r->connection = &ngx_bench_connection;
+
+    start = in->data.data;
+
+    b.pos = start;
+    b.last = start + split;
+
+    ngx_crc32_init(crc);
+
+    for ( ;; ) {
+        rc = ngx_http_parse_header_line(r, &b, 1);
+
+        if (rc == NGX_AGAIN && b.last != start + in->data.len) {
+            b.last = start + in->data.len;
+            continue;
+        }
+
+        if (rc != NGX_OK) {
+            break;
+        }
+
+        v[0] = ngx_bench_offset(r->header_name_start, start);
+        v[1] = ngx_bench_offset(r->header_name_end, start);
+        v[2] = ngx_bench_offset(r->header_start, start);
+        v[3] = ngx_bench_offset(r->header_end, start);
+        v[4] = r->header_hash;
+        v[5] = r->lowcase_index;
+        v[6] = r->invalid_header;
+        v[7] = b.pos - start;
+
+        ngx_crc32_update(&crc, (u_char *) v, sizeof(v));
+    }
+
+    v[0] = rc;
+    v[1] = b.pos - start;
+
+    ngx_crc32_update(&crc, (u_char *) v, 2 * sizeof(uintptr_t));
+    ngx_crc32_final(crc);
+
+    return crc;
+}
+
+
+static uintptr_t
+ngx_bench_complex_uri(ngx_bench_t *bench, ngx_bench_input_t *in)
+{
+    ngx_http_request_t  *r;
+
+    r = &ngx_bench_request;
+
+    r->uri_start = in->data.data;
+    r->uri_end = in->data.data + in->data.len;
+    r->uri.data = bench->buf;
+
+    if (in->data.len == 0) {
+        return 0;
+    }
+
+    return ngx_http_parse_complex_uri(r, 1);
+}
+
+
+#if (NGX_HTTP_V2)
+
+static ngx_int_t
+ngx_bench_huff_init(ngx_bench_t *bench)
+{
+    u_char             *p;
+    size_t              len;
+    ngx_uint_t          i, n;
+    ngx_bench_input_t  *in;
+
+    /* the corpus is plain text, the benchmark decodes its huffman code */
+
+    in = bench->inputs.elts;
+    n = 0;
+
+    for (i = 0; i < bench->inputs.nelts; i++) {
+
+        p = ngx_pnalloc(ngx_bench_pool, in[i].data.len + 1);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        len = ngx_http_v2_huff_encode(in[i].data.data, in[i].data.len, p, 0);
+
+        if (len == 0) {
+            continue;
+        }
+
+        in[n].data.data = p;
+        in[n].data.len = len;
+        in[n].arg = in[i].arg;
+        n++;
+    }
+
+    bench->inputs.nelts = n;
+
+    if (n == 0) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_bench_log, 0,
+                      "no huffman encodable entries in \"%s\"",
+                      bench->corpus);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static uintptr_t
+ngx_bench_huff_decode(ngx_bench_t *bench, ngx_bench_input_t *in)
+{
+    u_char   state, *dst;
+
+    state = 0;
+    dst = bench->buf;
+
+    if (ngx_http_v2_huff_decode(&state, in->data.data, in->data.len, &dst, 1,
+                                &ngx_bench_log)
+        != NGX_OK)
+    {
+        return 0;
+    }
+
+    return dst - bench->buf;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_bench_hash_init(ngx_bench_t *bench)
+{
+    ngx_int_t                rc;
+    ngx_uint_t               i;
+    ngx_array_t              names;
+    ngx_hash_init_t          hash;
+    ngx_bench_input_t       *in;
+    ngx_hash_combined_t     *combined;
+    ngx_hash_keys_arrays_t   ha;
+
+    /* the hash is built from the server names, the corpus is looked up */
+
+    if (ngx_bench_load("hash_names", &names) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    combined = ngx_pcalloc(ngx_bench_pool, sizeof(ngx_hash_combined_t));
+    if (combined == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&ha, sizeof(ngx_hash_keys_arrays_t));
+
+    ha.temp_pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &ngx_bench_log);
+    if (ha.temp_pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    ha.pool = ngx_bench_pool;
+
+    if (ngx_hash_keys_array_init(&ha, NGX_HASH_LARGE) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    in = names.elts;
+
+    for (i = 0; i < names.nelts; i++) {
+        rc = ngx_hash_add_key(&ha, &in[i].data, &in[i],
+                              NGX_HASH_WILDCARD_KEY);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_DECLINED) {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_bench_log, 0,
+                          "invalid server name or wildcard \"%V\"",
+                          &in[i].data);
+            return NGX_ERROR;
+        }
+    }
+
+    hash.key = ngx_hash_key_lc;
+    hash.max_size = 4096;
+    hash.bucket_size = ngx_align(64, ngx_cacheline_size);
+    hash.name = "bench_hash";
+    hash.pool = ngx_bench_pool;
+
+    if (ha.keys.nelts) {
+        hash.hash = &combined->hash;
+        hash.temp_pool = NULL;
+
+        if (ngx_hash_init(&hash, ha.keys.elts, ha.keys.nelts) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (ha.dns_wc_head.nelts) {
+
+        ngx_qsort(ha.dns_wc_head.elts, (size_t) ha.dns_wc_head.nelts,
+                  sizeof(ngx_hash_key_t), ngx_bench_cmp_dns_wildcards);
+
+        hash.hash = NULL;
+        hash.temp_pool = ha.temp_pool;
+
+        if (ngx_hash_wildcard_init(&hash, ha.dns_wc_head.elts,
+                                   ha.dns_wc_head.nelts)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        combined->wc_head = (ngx_hash_wildcard_t *) hash.hash;
+    }
+
+    if (ha.dns_wc_tail.nelts) {
+
+        ngx_qsort(ha.dns_wc_tail.elts, (size_t) ha.dns_wc_tail.nelts,
+                  sizeof(ngx_hash_key_t), ngx_bench_cmp_dns_wildcards);
+
+        hash.hash = NULL;
+        hash.temp_pool = ha.temp_pool;
+
+        if (ngx_hash_wildcard_init(&hash, ha.dns_wc_tail.elts,
+                                   ha.dns_wc_tail.nelts)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        combined->wc_tail = (ngx_hash_wildcard_t *) hash.hash;
+    }
+
+    ngx_destroy_pool(ha.temp_pool);
+
+    bench->data = combined;
+
+    return NGX_OK;
+}
+
+
+static int ngx_libc_cdecl
+ngx_bench_cmp_dns_wildcards(const void *one, const void *two)
+{
+    ngx_hash_key_t  *first, *second;
+
+    first = (ngx_hash_key_t *) one;
+    second = (ngx_hash_key_t *) two;
+
+    return ngx_dns_strcmp(first->key.data, second->key.data);
+}
+
+
+static uintptr_t
+ngx_bench_hash_find(ngx_bench_t *bench, ngx_bench_input_t *in)
+{
+    ngx_uint_t  key;
+
+    key = ngx_hash_key(in->data.data, in->data.len);
+
+    return (uintptr_t) ngx_hash_find_combined(bench->data, key, in->data.data,
+                                              in->data.len);
+}
+
+
+/* the escaping functions are called as the callers do: length first */
+
+static uintptr_t
+ngx_bench_escape_uri(ngx_bench_t *bench, ngx_bench_input_t *in)
+{
+    if (ngx_escape_uri(NULL, in->data.data, in->data.len, bench->type) == 0) {
+        return 0;
+    }
+
+    return ngx_escape_uri(bench->buf, in->data.data, in->data.len,
+                          bench->type);
+}
+
+
+static uintptr_t
+ngx_bench_escape_html(ngx_bench_t *bench, ngx_bench_input_t *in)
+{
+    if (ngx_escape_html(NULL, in->data.data, in->data.len) == 0) {
+        return 0;
+    }
+
+    return ngx_escape_html(bench->buf, in->data.data, in->data.len);
+}
+
+
+static uintptr_t
+ngx_bench_escape_json(ngx_bench_t *bench, ngx_bench_input_t *in)
+{
+    if (ngx_escape_json(NULL, in->data.data, in->data.len) == 0) {
+        return 0;
+    }
+
+    return ngx_escape_json(bench->buf, in->data.data, in->data.len);
+}
+
+
+static uintptr_t
+ngx_bench_unescape_uri(ngx_bench_t *bench, ngx_bench_input_t *in)
+{
+    u_char  *dst, *src;
+
+    dst = bench->buf;
+    src = in->data.data;
+
+    ngx_unescape_uri(&dst, &src, in->data.len, bench->type);
+
+    return dst - bench->buf;
+}
+
+
+static uintptr_t
+ngx_bench_arg(ngx_bench_t *bench, ngx_bench_input_t *in)
+{
+    ngx_str_t            value;
+    ngx_http_request_t  *r;
+
+    r = &ngx_bench_request;
+    r->args = in->data;
+
+    if (in->arg.len == 0) {
+        return 0;
+    }
+
+    if (ngx_http_arg(r, in->arg.data, in->arg.len, &value) != NGX_OK) {
+        return 0;
+    }
+
+    return value.len;
+}
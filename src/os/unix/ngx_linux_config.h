@@ -89,6 +89,12 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
+#if (NGX_HAVE_IO_URING)
+#include <poll.h>
+#include <linux/io_uring.h>
+#endif
+
+
 #if (NGX_HAVE_SYS_EVENTFD_H)
 #include <sys/eventfd.h>
 #endif
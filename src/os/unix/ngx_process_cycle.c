@@ -30,6 +30,7 @@ static void ngx_cache_loader_process_handler(ngx_event_t *ev);
 
 ngx_uint_t    ngx_process;
 ngx_uint_t    ngx_worker;
+ngx_uint_t    ngx_cache_manager;
 ngx_pid_t     ngx_pid;
 
 sig_atomic_t  ngx_reap;
@@ -1151,6 +1152,7 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
      * in a master process also removes the Unix domain socket file.
      */
     ngx_process = NGX_PROCESS_HELPER;
+    ngx_cache_manager = (ctx == &ngx_cache_manager_ctx);
 
     ngx_close_listening_sockets(cycle);
 
@@ -40,6 +40,7 @@ void ngx_single_process_cycle(ngx_cycle_t *cycle);
 
 extern ngx_uint_t      ngx_process;
 extern ngx_uint_t      ngx_worker;
+extern ngx_uint_t      ngx_cache_manager;
 extern ngx_pid_t       ngx_pid;
 extern ngx_pid_t       ngx_new_binary;
 extern ngx_uint_t      ngx_inherited;
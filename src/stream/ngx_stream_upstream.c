@@ -326,7 +326,8 @@ ngx_stream_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
                                            |NGX_STREAM_UPSTREAM_MAX_FAILS
                                            |NGX_STREAM_UPSTREAM_FAIL_TIMEOUT
                                            |NGX_STREAM_UPSTREAM_DOWN
-                                           |NGX_STREAM_UPSTREAM_BACKUP);
+                                           |NGX_STREAM_UPSTREAM_BACKUP
+                                           |NGX_STREAM_UPSTREAM_SLOW_START);
     if (uscf == NULL) {
         return NGX_CONF_ERROR;
     }
@@ -409,6 +410,7 @@ ngx_stream_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_str_t                     *value, s;
     ngx_url_t                      u;
     ngx_int_t                      weight, max_conns, max_fails;
+    ngx_msec_t                     slow_start;
     ngx_uint_t                     i;
     ngx_stream_upstream_server_t  *us;
 
@@ -425,6 +427,7 @@ ngx_stream_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     max_conns = 0;
     max_fails = 1;
     fail_timeout = 10;
+    slow_start = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
 
@@ -491,6 +494,24 @@ ngx_stream_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "slow_start=", 11) == 0) {
+
+            if (!(uscf->flags & NGX_STREAM_UPSTREAM_SLOW_START)) {
+                goto not_supported;
+            }
+
+            s.len = value[i].len - 11;
+            s.data = &value[i].data[11];
+
+            slow_start = ngx_parse_time(&s, 0);
+
+            if (slow_start == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
         if (ngx_strcmp(value[i].data, "backup") == 0) {
 
             if (!(uscf->flags & NGX_STREAM_UPSTREAM_BACKUP)) {
@@ -542,6 +563,7 @@ ngx_stream_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     us->max_conns = max_conns;
     us->max_fails = max_fails;
     us->fail_timeout = fail_timeout;
+    us->slow_start = slow_start;
 
     return NGX_CONF_OK;
 
@@ -22,6 +22,7 @@
 #define NGX_STREAM_UPSTREAM_DOWN          0x0010
 #define NGX_STREAM_UPSTREAM_BACKUP        0x0020
 #define NGX_STREAM_UPSTREAM_MAX_CONNS     0x0100
+#define NGX_STREAM_UPSTREAM_SLOW_START    0x0200
 
 
 #define NGX_STREAM_UPSTREAM_NOTIFY_CONNECT     0x1
@@ -100,7 +100,7 @@ ngx_stream_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
     time_t                           now;
     uintptr_t                        m;
-    ngx_int_t                        rc, total;
+    ngx_int_t                        rc, total, weight, best_weight, ew;
     ngx_uint_t                       i, n, p, many;
     ngx_stream_upstream_rr_peer_t   *peer, *best;
     ngx_stream_upstream_rr_peers_t  *peers;
@@ -126,6 +126,7 @@ ngx_stream_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 #if (NGX_SUPPRESS_WARN)
     many = 0;
     p = 0;
+    best_weight = 0;
 #endif
 
     for (peer = peers->peer, i = 0;
@@ -160,14 +161,17 @@ ngx_stream_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
          * based on round-robin
          */
 
+        weight = ngx_stream_upstream_rr_peer_weight(peer, peer->weight);
+
         if (best == NULL
-            || peer->conns * best->weight < best->conns * peer->weight)
+            || peer->conns * best_weight < best->conns * weight)
         {
             best = peer;
+            best_weight = weight;
             many = 0;
             p = i;
 
-        } else if (peer->conns * best->weight == best->conns * peer->weight) {
+        } else if (peer->conns * best_weight == best->conns * weight) {
             many = 1;
         }
     }
@@ -198,7 +202,9 @@ ngx_stream_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
-            if (peer->conns * best->weight != best->conns * peer->weight) {
+            weight = ngx_stream_upstream_rr_peer_weight(peer, peer->weight);
+
+            if (peer->conns * best_weight != best->conns * weight) {
                 continue;
             }
 
@@ -213,8 +219,11 @@ ngx_stream_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
-            peer->current_weight += peer->effective_weight;
-            total += peer->effective_weight;
+            ew = ngx_stream_upstream_rr_peer_weight(peer,
+                                                    peer->effective_weight);
+
+            peer->current_weight += ew;
+            total += ew;
 
             if (peer->effective_weight < peer->weight) {
                 peer->effective_weight++;
@@ -222,6 +231,7 @@ ngx_stream_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
             if (peer->current_weight > best->current_weight) {
                 best = peer;
+                best_weight = weight;
                 p = i;
             }
         }
@@ -304,7 +314,8 @@ ngx_stream_upstream_least_conn(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                   |NGX_STREAM_UPSTREAM_MAX_FAILS
                   |NGX_STREAM_UPSTREAM_FAIL_TIMEOUT
                   |NGX_STREAM_UPSTREAM_DOWN
-                  |NGX_STREAM_UPSTREAM_BACKUP;
+                  |NGX_STREAM_UPSTREAM_BACKUP
+                  |NGX_STREAM_UPSTREAM_SLOW_START;
 
     return NGX_CONF_OK;
 }
@@ -101,6 +101,7 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].max_conns = server[i].max_conns;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
+                peer[n].slow_start = server[i].slow_start;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
 
@@ -165,6 +166,7 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].max_conns = server[i].max_conns;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
+                peer[n].slow_start = server[i].slow_start;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
 
@@ -518,7 +520,7 @@ ngx_stream_upstream_get_peer(ngx_stream_upstream_rr_peer_data_t *rrp)
 {
     time_t                          now;
     uintptr_t                       m;
-    ngx_int_t                       total;
+    ngx_int_t                       total, weight;
     ngx_uint_t                      i, n, p;
     ngx_stream_upstream_rr_peer_t  *peer, *best;
 
@@ -557,8 +559,11 @@ ngx_stream_upstream_get_peer(ngx_stream_upstream_rr_peer_data_t *rrp)
             continue;
         }
 
-        peer->current_weight += peer->effective_weight;
-        total += peer->effective_weight;
+        weight = ngx_stream_upstream_rr_peer_weight(peer,
+                                                    peer->effective_weight);
+
+        peer->current_weight += weight;
+        total += weight;
 
         if (peer->effective_weight < peer->weight) {
             peer->effective_weight++;
@@ -631,6 +636,13 @@ ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
             if (peer->fails >= peer->max_fails) {
                 ngx_log_error(NGX_LOG_WARN, pc->log, 0,
                               "upstream server temporarily disabled");
+
+                /* the ramp starts as soon as the peer is tried again */
+
+                if (peer->slow_start) {
+                    peer->start_time = ngx_current_msec
+                                       + (ngx_msec_t) peer->fail_timeout * 1000;
+                }
             }
         }
 
@@ -662,6 +674,41 @@ ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 }
 
 
+ngx_int_t
+ngx_stream_upstream_rr_peer_weight(ngx_stream_upstream_rr_peer_t *peer,
+    ngx_int_t weight)
+{
+    ngx_int_t       w;
+    ngx_msec_int_t  elapsed;
+
+    /*
+     * the weight of a recovered peer grows linearly during slow start;
+     * weights are scaled to keep the ramp smooth even for "weight=1"
+     */
+
+    weight *= NGX_STREAM_UPSTREAM_RR_WEIGHT_SCALE;
+
+    if (peer->start_time == 0) {
+        return weight;
+    }
+
+    elapsed = (ngx_msec_int_t) (ngx_current_msec - peer->start_time);
+
+    if (elapsed >= (ngx_msec_int_t) peer->slow_start) {
+        peer->start_time = 0;
+        return weight;
+    }
+
+    if (elapsed < 0) {
+        elapsed = 0;
+    }
+
+    w = weight * elapsed / (ngx_msec_int_t) peer->slow_start;
+
+    return w ? w : ngx_min(weight, 1);
+}
+
+
 static void
 ngx_stream_upstream_notify_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t type)
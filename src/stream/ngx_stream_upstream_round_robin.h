@@ -16,6 +16,10 @@
 
 typedef struct ngx_stream_upstream_rr_peer_s   ngx_stream_upstream_rr_peer_t;
 
+
+#define NGX_STREAM_UPSTREAM_RR_WEIGHT_SCALE  100
+
+
 struct ngx_stream_upstream_rr_peer_s {
     struct sockaddr                 *sockaddr;
     socklen_t                        socklen;
@@ -141,6 +145,8 @@ ngx_int_t ngx_stream_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
     void *data);
 void ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
+ngx_int_t ngx_stream_upstream_rr_peer_weight(
+    ngx_stream_upstream_rr_peer_t *peer, ngx_int_t weight);
 
 
 #endif /* _NGX_STREAM_UPSTREAM_ROUND_ROBIN_H_INCLUDED_ */